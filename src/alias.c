@@ -0,0 +1,209 @@
+//========================================================//
+//  alias.c                                               //
+//  Pattern table instrumentation                         //
+//                                                        //
+//  Per-entry last user and distinct-key counts, plus an  //
+//  open-addressing map from each key to its private      //
+//  2-bit counter                                         //
+//========================================================//
+
+#include <stdlib.h>
+#include "alias.h"
+
+// No key has every bit set: histories are at most 30 bits
+#define ALIAS_EMPTY UINT64_MAX
+#define ALIAS_INITIAL_SLOTS 4096
+
+// Upper bounds of the distinct-keys-per-entry histogram buckets
+static const uint32_t key_buckets[] = { 1, 2, 4, 8, 16, 64, UINT32_MAX };
+#define NUM_KEY_BUCKETS (sizeof(key_buckets) / sizeof(key_buckets[0]))
+
+typedef struct {
+  uint64_t key;
+  uint8_t counter;          // The key's private 2-bit counter
+} alias_slot;
+
+struct alias_table {
+  const counter_table *counters;
+  uint8_t init;
+  uint64_t *last_key;       // Key of the last access to each entry
+  uint32_t *distinct;       // Distinct keys seen by each entry, 0 if unused
+
+  alias_slot *slots;        // Every key seen, with its private counter
+  uint64_t slot_mask;
+  uint64_t keys;
+
+  uint64_t accesses;
+  uint64_t aliased;
+  uint64_t destructive;
+  uint64_t constructive;
+};
+
+static inline uint64_t
+alias_hash(uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  return key;
+}
+
+static alias_slot *
+alias_alloc_slots(uint64_t n)
+{
+  alias_slot *slots = malloc(n * sizeof(alias_slot));
+  for (uint64_t i = 0; i < n; i++) {
+    slots[i].key = ALIAS_EMPTY;
+  }
+  return slots;
+}
+
+alias_table *
+alias_create(const counter_table *counters, uint8_t init)
+{
+  alias_table *a = calloc(1, sizeof(alias_table));
+  a->counters = counters;
+  a->init = init;
+  a->last_key = calloc(counters->size, sizeof(uint64_t));
+  a->distinct = calloc(counters->size, sizeof(uint32_t));
+  a->slots = alias_alloc_slots(ALIAS_INITIAL_SLOTS);
+  a->slot_mask = ALIAS_INITIAL_SLOTS - 1;
+  return a;
+}
+
+static void
+alias_grow(alias_table *a)
+{
+  uint64_t old_slots = a->slot_mask + 1;
+  alias_slot *old = a->slots;
+
+  a->slots = alias_alloc_slots(2 * old_slots);
+  a->slot_mask = 2 * old_slots - 1;
+  for (uint64_t i = 0; i < old_slots; i++) {
+    if (old[i].key != ALIAS_EMPTY) {
+      uint64_t s = alias_hash(old[i].key) & a->slot_mask;
+      while (a->slots[s].key != ALIAS_EMPTY) {
+        s = (s + 1) & a->slot_mask;
+      }
+      a->slots[s] = old[i];
+    }
+  }
+  free(old);
+}
+
+// Find the private counter of 'key', adding it (and counting a new
+// distinct key for 'index') the first time the key is seen
+static alias_slot *
+alias_lookup(alias_table *a, uint32_t index, uint64_t key)
+{
+  uint64_t s = alias_hash(key) & a->slot_mask;
+  while (a->slots[s].key != ALIAS_EMPTY) {
+    if (a->slots[s].key == key) {
+      return &a->slots[s];
+    }
+    s = (s + 1) & a->slot_mask;
+  }
+
+  if (2 * (a->keys + 1) > a->slot_mask + 1) {
+    alias_grow(a);
+    return alias_lookup(a, index, key);
+  }
+  a->keys++;
+  a->distinct[index]++;
+  a->slots[s].key = key;
+  a->slots[s].counter = a->init;
+  return &a->slots[s];
+}
+
+void
+alias_record(alias_table *a, uint32_t index, uint64_t key,
+             uint8_t prediction, uint8_t outcome)
+{
+  // An entry is in use once a key has been counted for it
+  int used = a->distinct[index] != 0;
+  alias_slot *slot = alias_lookup(a, index, key);
+  uint8_t private_prediction = slot->counter >> 1;
+
+  a->accesses++;
+  if (used && a->last_key[index] != key) {
+    a->aliased++;
+    if (prediction != outcome && private_prediction == outcome) {
+      a->destructive++;
+    } else if (prediction == outcome && private_prediction != outcome) {
+      a->constructive++;
+    }
+  }
+  a->last_key[index] = key;
+
+  if (outcome && slot->counter < 3) {
+    slot->counter++;
+  } else if (!outcome && slot->counter > 0) {
+    slot->counter--;
+  }
+}
+
+static double
+percent(uint64_t part, uint64_t whole)
+{
+  return whole ? 100.0 * part / whole : 0;
+}
+
+void
+alias_report(const alias_table *a, FILE *out, const char *name)
+{
+  uint32_t size = a->counters->size;
+  uint64_t used = 0;
+  uint64_t keys_hist[NUM_KEY_BUCKETS] = { 0 };
+  uint64_t state_hist[4] = { 0 };
+
+  for (uint32_t i = 0; i < size; i++) {
+    state_hist[counter_get(a->counters, i)]++;
+    if (a->distinct[i] == 0) {
+      continue;
+    }
+    used++;
+    size_t b = 0;
+    while (a->distinct[i] > key_buckets[b]) {
+      b++;
+    }
+    keys_hist[b]++;
+  }
+
+  fprintf(out, "%s: %u entries, %llu used (%.2f%%), %llu distinct keys\n",
+          name, size, (unsigned long long)used, percent(used, size),
+          (unsigned long long)a->keys);
+  fprintf(out, "  Accesses:     %12llu\n", (unsigned long long)a->accesses);
+  fprintf(out, "  Aliased:      %12llu (%.2f%%)\n", (unsigned long long)a->aliased,
+          percent(a->aliased, a->accesses));
+  fprintf(out, "  Destructive:  %12llu (%.2f%%)\n", (unsigned long long)a->destructive,
+          percent(a->destructive, a->accesses));
+  fprintf(out, "  Constructive: %12llu (%.2f%%)\n", (unsigned long long)a->constructive,
+          percent(a->constructive, a->accesses));
+
+  fprintf(out, "  Keys per used entry:");
+  for (size_t b = 0; b < NUM_KEY_BUCKETS; b++) {
+    uint32_t low = b ? key_buckets[b - 1] + 1 : 1;
+    if (key_buckets[b] == UINT32_MAX) {
+      fprintf(out, " >%u:", low - 1);
+    } else if (low == key_buckets[b]) {
+      fprintf(out, " %u:", low);
+    } else {
+      fprintf(out, " %u-%u:", low, key_buckets[b]);
+    }
+    fprintf(out, "%llu", (unsigned long long)keys_hist[b]);
+  }
+  fprintf(out, "\n");
+
+  fprintf(out, "  Counter states: SN:%llu WN:%llu WT:%llu ST:%llu\n",
+          (unsigned long long)state_hist[0], (unsigned long long)state_hist[1],
+          (unsigned long long)state_hist[2], (unsigned long long)state_hist[3]);
+}
+
+void
+alias_destroy(alias_table *a)
+{
+  free(a->last_key);
+  free(a->distinct);
+  free(a->slots);
+  free(a);
+}
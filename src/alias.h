@@ -0,0 +1,45 @@
+//========================================================//
+//  alias.h                                               //
+//  Header file for the pattern table instrumentation     //
+//                                                        //
+//  Measures how the branches sharing a table of 2-bit    //
+//  counters interfere with each other.  Only used in     //
+//  builds made with 'make INSTRUMENT=1'                  //
+//========================================================//
+
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "counter.h"
+
+typedef struct alias_table alias_table;
+
+// Key of a table access: the branch PC and the history that selected the
+// entry (0 for tables indexed by the PC alone).  Distinct keys are what
+// the table would ideally keep apart.
+#define ALIAS_KEY(pc, history) (((uint64_t)(history) << 32) | (uint32_t)(pc))
+
+// Track the accesses to 'counters', whose counters all start at 'init'
+//
+alias_table *alias_create(const counter_table *counters, uint8_t init);
+
+// Record an access to entry 'index' by 'key', where the shared counter
+// predicted 'prediction' and the branch went 'outcome'.
+//
+// Each key also trains a private counter of its own.  An access is
+// aliased when the entry was last used by another key; it is destructive
+// if the private counter was right and the shared one wrong, and
+// constructive if the other way around.
+//
+void alias_record(alias_table *a, uint32_t index, uint64_t key,
+                  uint8_t prediction, uint8_t outcome);
+
+// Print the access, aliasing, occupancy and counter state statistics
+//
+void alias_report(const alias_table *a, FILE *out, const char *name);
+
+void alias_destroy(alias_table *a);
+
+#endif
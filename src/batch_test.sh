@@ -14,9 +14,21 @@ PREDICTOR="./predictor"
 START_HISTORY=5
 END_HISTORY=5
 
+# Predictors to evaluate; every one of them is simulated in a single
+# pass over each trace
+# SPEC="--bimodal:15"
+# SPEC="--gshare:$START_HISTORY..$END_HISTORY"
+# SPEC="--gshare:15"
+# SPEC="--tournament:12:11:12"
+SPEC="--custom"
+
 # Output file to store the results
 OUTPUT_FILE="test_results.csv"
 
+# Results already simulated are reused from here; set CACHE= to disable
+CACHE="${CACHE-test_results.cache}"
+CACHE_OPT=${CACHE:+--cache=$CACHE}
+
 # Clear the output file if it exists and add the header
 > "$OUTPUT_FILE"
 echo "TESTCASE,history_bits,misp_rate" >> "$OUTPUT_FILE"
@@ -25,21 +37,14 @@ echo "TESTCASE,history_bits,misp_rate" >> "$OUTPUT_FILE"
 for TRACE_FILE in "$TRACE_DIR"/*.bz2
 do
     TESTCASE=$(basename "$TRACE_FILE")
-    
-    # Loop through the specified range of history lengths
-    for ((historyLen=$START_HISTORY; historyLen<=$END_HISTORY; historyLen++))
+
+    # Run all predictors at once; each CSV row is
+    # predictor,history_bits,branches,incorrect,misp_rate,storage_bits
+    "$PREDICTOR" $CACHE_OPT $SPEC --csv "$TRACE_FILE" | tail -n +2 |
+    while IFS=, read -r bp historyLen branches incorrect misp_rate storage
     do
-        # echo "Testing $TESTCASE with --gshare:$historyLen ..."
-        
-        # Run the predictor command and extract the misprediction rate
-        # misp_rate=$(bunzip2 -kc "$TRACE_FILE" | "$PREDICTOR" --bimodal:15 | grep "Misprediction Rate" | awk '{print $3}')
-        # misp_rate=$(bunzip2 -kc "$TRACE_FILE" | "$PREDICTOR" --gshare:$historyLen | grep "Misprediction Rate" | awk '{print $3}')
-        # misp_rate=$(bunzip2 -kc "$TRACE_FILE" | "$PREDICTOR" --gshare:15 | grep "Misprediction Rate" | awk '{print $3}')
-        # misp_rate=$(bunzip2 -kc "$TRACE_FILE" | "$PREDICTOR" --tournament:12:11:12 | grep "Misprediction Rate" | awk '{print $3}')
-        misp_rate=$(bunzip2 -kc "$TRACE_FILE" | "$PREDICTOR" --custom | grep "Misprediction Rate" | awk '{print $3}')
-        
         # Print the result to the console
-        echo "Trace: $TESTCASE, BP: custom, Misprediction Rate: $misp_rate%"
+        echo "Trace: $TESTCASE, BP: $bp, Misprediction Rate: $misp_rate%"
 
         # Write the result to the output file
         echo "$TESTCASE,$historyLen,$misp_rate" >> "$OUTPUT_FILE"
@@ -0,0 +1,296 @@
+//========================================================//
+//  bench.c                                               //
+//  Throughput benchmark for the trace reader and the     //
+//  predictors                                            //
+//                                                        //
+//  Times the parse and predict phases separately over    //
+//  each trace and writes the results as JSON             //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "predictor.h"
+#include "trace.h"
+
+// Predictors benchmarked when none are given: one of each kind, at the
+// sizes the README compares
+static const char *default_specs[] = {
+  "static", "bimodal:15", "gshare:15", "tournament:12:11:12", "custom",
+  "perceptron", "tage",
+};
+
+typedef struct {
+  double total;             // Seconds over the timed iterations
+  double best;              // Fastest iteration
+  long peak_rss_kb;
+} phase_stats;
+
+const char **trace_paths = NULL;
+int num_traces = 0;
+predictor_config *configs = NULL;
+int num_configs = 0;
+int iterations = 5;
+int warmup = 1;
+
+// Print out the Usage information to stderr
+//
+void
+usage()
+{
+  fprintf(stderr,"Usage: bench <options> <trace>... [--<type>...]\n");
+  fprintf(stderr," Options:\n");
+  fprintf(stderr," --help            Print this message\n");
+  fprintf(stderr," --iterations=<n>  Timed runs of each phase (default: 5)\n");
+  fprintf(stderr," --warmup=<n>      Untimed runs before them (default: 1)\n");
+  fprintf(stderr," --output=<file>   Write the JSON to <file> instead of stdout\n");
+  fprintf(stderr," --<type>          Predictors to time, as accepted by predictor\n"
+                 "                   (default: one of each kind)\n");
+}
+
+static void
+add_spec(const char *spec)
+{
+  int count;
+  predictor_config *parsed = parse_predictor_spec(spec, &count);
+  if (!parsed) {
+    printf("Unrecognized option --%s\n", spec);
+    usage();
+    exit(1);
+  }
+  configs = realloc(configs, (num_configs + count) * sizeof(predictor_config));
+  memcpy(configs + num_configs, parsed, count * sizeof(predictor_config));
+  num_configs += count;
+  free(parsed);
+}
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Reset the peak RSS so the next phase measures its own high-water mark.
+// Writing 5 to clear_refs does this on Linux; elsewhere the peak of the
+// whole run is reported instead.
+//
+static void
+reset_peak_rss()
+{
+  FILE *f = fopen("/proc/self/clear_refs", "w");
+  if (f) {
+    fputs("5", f);
+    fclose(f);
+  }
+}
+
+static long
+peak_rss_kb()
+{
+  FILE *f = fopen("/proc/self/status", "r");
+  if (f) {
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f)) {
+      if (!strncmp(line, "VmHWM:", 6)) {
+        kb = strtol(line + 6, NULL, 10);
+        break;
+      }
+    }
+    fclose(f);
+    if (kb >= 0) {
+      return kb;
+    }
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static void
+record(phase_stats *stats, double seconds, int timed)
+{
+  if (!timed) {
+    return;
+  }
+  stats->total += seconds;
+  if (stats->best == 0 || seconds < stats->best) {
+    stats->best = seconds;
+  }
+}
+
+// Decode the whole trace into 'buffer' (the parse phase)
+//
+static phase_stats
+bench_parse(const char *path, trace_buffer *buffer)
+{
+  phase_stats stats = { 0, 0, 0 };
+  reset_peak_rss();
+
+  for (int i = 0; i < warmup + iterations; i++) {
+    if (i > 0) {
+      trace_buffer_free(buffer);
+    }
+    double start = now();
+    if (trace_load(path, buffer) != 0) {
+      perror(path);
+      exit(1);
+    }
+    record(&stats, now() - start, i >= warmup);
+  }
+
+  stats.peak_rss_kb = peak_rss_kb();
+  return stats;
+}
+
+// Simulate 'config' over the decoded trace (the predict phase), with a
+// fresh predictor for each run so every run does the same work
+//
+static phase_stats
+bench_predict(const predictor_config *config, const trace_buffer *buffer,
+              uint32_t *mispredictions)
+{
+  phase_stats stats = { 0, 0, 0 };
+  reset_peak_rss();
+
+  for (int i = 0; i < warmup + iterations; i++) {
+    predictor *p = predictor_create(config);
+    double start = now();
+    *mispredictions = predictor_run(p, buffer->pcs, buffer->outcomes, NULL,
+                                    buffer->count);
+    record(&stats, now() - start, i >= warmup);
+    predictor_destroy(p);
+  }
+
+  stats.peak_rss_kb = peak_rss_kb();
+  return stats;
+}
+
+// Write 's' as a quoted JSON string
+//
+static void
+print_json_string(FILE *out, const char *s)
+{
+  fputc('"', out);
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      fprintf(out, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(out, "\\u%04x", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+// Write one entry of the JSON results, and a summary line to stderr.
+// 'name' and 'mispredictions' only apply to the predict phase.
+//
+static void
+print_result(FILE *out, int first, const char *trace, const char *phase,
+             const char *name, uint32_t mispredictions, size_t branches,
+             const phase_stats *stats)
+{
+  double mean = stats->total / iterations;
+  fprintf(out, "%s    {\"trace\": ", first ? "" : ",\n");
+  print_json_string(out, trace);
+  fprintf(out, ", \"phase\": \"%s\", ", phase);
+  if (name) {
+    fprintf(out, "\"predictor\": \"%s\", \"mispredictions\": %u, ",
+            name, mispredictions);
+  }
+  fprintf(out, "\"branches\": %zu, \"mean_seconds\": %.6f, \"best_seconds\": %.6f, "
+          "\"branches_per_sec\": %.0f, \"ns_per_branch\": %.3f, \"peak_rss_kb\": %ld}",
+          branches, mean, stats->best, branches / mean, mean * 1e9 / branches,
+          stats->peak_rss_kb);
+
+  fprintf(stderr, "%-10s %-8s %-24s %8.3f ns/branch %12.0f branches/s %8ld KB\n",
+          trace, phase, name ? name : "", mean * 1e9 / branches,
+          branches / mean, stats->peak_rss_kb);
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *output = NULL;
+
+  // Process cmdline Arguments
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i],"--help")) {
+      usage();
+      exit(0);
+    } else if (!strncmp(argv[i],"--iterations=",13)) {
+      iterations = atoi(argv[i] + 13);
+    } else if (!strncmp(argv[i],"--warmup=",9)) {
+      warmup = atoi(argv[i] + 9);
+    } else if (!strncmp(argv[i],"--output=",9)) {
+      output = argv[i] + 9;
+    } else if (!strncmp(argv[i],"--predictor=",12)) {
+      add_spec(argv[i] + 12);
+    } else if (!strncmp(argv[i],"--",2)) {
+      add_spec(argv[i] + 2);
+    } else {
+      trace_paths = realloc(trace_paths, (num_traces + 1) * sizeof(char *));
+      trace_paths[num_traces++] = argv[i];
+    }
+  }
+
+  if (num_traces == 0 || iterations < 1 || warmup < 0) {
+    usage();
+    exit(1);
+  }
+  if (num_configs == 0) {
+    for (size_t s = 0; s < sizeof(default_specs) / sizeof(default_specs[0]); s++) {
+      add_spec(default_specs[s]);
+    }
+  }
+
+  FILE *out = stdout;
+  if (output && !(out = fopen(output, "w"))) {
+    perror(output);
+    exit(1);
+  }
+
+  fprintf(out, "{\n  \"iterations\": %d,\n  \"warmup\": %d,\n  \"results\": [\n",
+          iterations, warmup);
+
+  int first = 1;
+  for (int t = 0; t < num_traces; t++) {
+    const char *name = strrchr(trace_paths[t], '/');
+    name = name ? name + 1 : trace_paths[t];
+
+    trace_buffer buffer;
+    phase_stats parse = bench_parse(trace_paths[t], &buffer);
+    print_result(out, first, name, "parse", NULL, 0, buffer.count, &parse);
+    first = 0;
+
+    for (int c = 0; c < num_configs; c++) {
+      char spec[64];
+      uint32_t mispredictions = 0;
+      format_predictor_spec(&configs[c], spec, sizeof(spec));
+      phase_stats predict = bench_predict(&configs[c], &buffer, &mispredictions);
+      print_result(out, 0, name, "predict", spec, mispredictions, buffer.count,
+                   &predict);
+    }
+
+    trace_buffer_free(&buffer);
+  }
+
+  fprintf(out, "\n  ]\n}\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  free(trace_paths);
+  free(configs);
+
+  return 0;
+}
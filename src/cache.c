@@ -0,0 +1,301 @@
+//========================================================//
+//  cache.c                                               //
+//  Source file for the persistent result cache           //
+//                                                        //
+//  An append-only text file of results, loaded into an   //
+//  open-addressing hash map keyed by digest and spec     //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache.h"
+
+// Slots start at this many and double whenever they are half full
+#define CACHE_INITIAL_SLOTS 1024
+
+// Longest key: digest, space, predictor spec
+#define CACHE_KEY_SIZE (CACHE_DIGEST_CHARS + 1 + 64)
+
+typedef struct {
+  char *key;                // NULL marks an empty slot
+  uint64_t branches;
+  uint64_t mispredictions;
+} cache_entry;
+
+struct result_cache {
+  int fd;                   // Opened for appending
+  char build[64];           // predictor_build_id(), without spaces
+  cache_entry *slots;
+  uint32_t mask;            // Number of slots - 1
+  uint32_t used;
+};
+
+//------------------------------------//
+//           Trace Digests            //
+//------------------------------------//
+
+// The splitmix64 finalizer
+static inline uint64_t
+mix64(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+// Hash 'size' bytes into two 64-bit halves.  Each half absorbs one word
+// of every 16 bytes, so the two multiply chains run in parallel.
+//
+static void
+hash128(const uint8_t *data, size_t size, uint64_t *h1, uint64_t *h2)
+{
+  uint64_t a = 0x9e3779b97f4a7c15ULL;
+  uint64_t b = 0xc2b2ae3d27d4eb4fULL;
+  size_t i = 0;
+
+  for (; size - i >= 16; i += 16) {
+    uint64_t w1, w2;
+    memcpy(&w1, data + i, 8);
+    memcpy(&w2, data + i + 8, 8);
+    a = rotl64(a ^ mix64(w1), 27) * 0x87c37b91114253d5ULL;
+    b = rotl64(b ^ mix64(w2), 31) * 0x4cf5ad432745937fULL;
+  }
+
+  // The tail, zero-padded; the length tells paddings apart
+  uint8_t tail[16] = { 0 };
+  memcpy(tail, data + i, size - i);
+  uint64_t w1, w2;
+  memcpy(&w1, tail, 8);
+  memcpy(&w2, tail + 8, 8);
+  a = rotl64(a ^ mix64(w1 ^ size), 27) * 0x87c37b91114253d5ULL;
+  b = rotl64(b ^ mix64(w2), 31) * 0x4cf5ad432745937fULL;
+
+  *h1 = mix64(a + b);
+  *h2 = mix64(b + *h1);
+}
+
+int
+cache_digest_file(const char *path, char digest[CACHE_DIGEST_CHARS + 1])
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (!S_ISREG(st.st_mode)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+
+  uint64_t h1, h2;
+  if (st.st_size == 0) {
+    hash128(NULL, 0, &h1, &h2);
+  } else {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd);
+      return -1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    hash128(map, st.st_size, &h1, &h2);
+    munmap(map, st.st_size);
+  }
+  close(fd);
+
+  snprintf(digest, CACHE_DIGEST_CHARS + 1, "%016llx%016llx",
+           (unsigned long long)h1, (unsigned long long)h2);
+  return 0;
+}
+
+//------------------------------------//
+//           Result Map               //
+//------------------------------------//
+
+// FNV-1a over the key
+static inline uint32_t
+cache_hash(const char *key)
+{
+  uint32_t h = 2166136261u;
+  for (; *key; key++) {
+    h = (h ^ (uint8_t)*key) * 16777619u;
+  }
+  return h;
+}
+
+static void
+cache_grow(result_cache *cache)
+{
+  uint32_t old_slots = cache->mask + 1;
+  cache_entry *old = cache->slots;
+
+  cache->mask = 2 * old_slots - 1;
+  cache->slots = calloc(2 * old_slots, sizeof(cache_entry));
+  for (uint32_t i = 0; i < old_slots; i++) {
+    if (old[i].key) {
+      uint32_t s = cache_hash(old[i].key) & cache->mask;
+      while (cache->slots[s].key) {
+        s = (s + 1) & cache->mask;
+      }
+      cache->slots[s] = old[i];
+    }
+  }
+  free(old);
+}
+
+// Find the entry for 'key', adding it if 'add' is set
+//
+// Returns NULL if it is missing and not added
+//
+static cache_entry *
+cache_find(result_cache *cache, const char *key, int add)
+{
+  uint32_t s = cache_hash(key) & cache->mask;
+  while (cache->slots[s].key) {
+    if (!strcmp(cache->slots[s].key, key)) {
+      return &cache->slots[s];
+    }
+    s = (s + 1) & cache->mask;
+  }
+  if (!add) {
+    return NULL;
+  }
+
+  if (2 * (cache->used + 1) > cache->mask + 1) {
+    cache_grow(cache);
+    return cache_find(cache, key, add);
+  }
+  cache->used++;
+  cache->slots[s].key = strdup(key);
+  return &cache->slots[s];
+}
+
+static void
+make_key(char key[CACHE_KEY_SIZE], const char *digest,
+         const predictor_config *config)
+{
+  char spec[64];
+  format_predictor_spec(config, spec, sizeof(spec));
+  snprintf(key, CACHE_KEY_SIZE, "%s %s", digest, spec);
+}
+
+//------------------------------------//
+//         Cache Interface            //
+//------------------------------------//
+
+result_cache *
+cache_open(const char *path)
+{
+  int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  result_cache *cache = calloc(1, sizeof(result_cache));
+  cache->fd = fd;
+  cache->slots = calloc(CACHE_INITIAL_SLOTS, sizeof(cache_entry));
+  cache->mask = CACHE_INITIAL_SLOTS - 1;
+  snprintf(cache->build, sizeof(cache->build), "%s", predictor_build_id());
+  for (char *p = cache->build; *p; p++) {
+    if (*p == ' ') {
+      *p = '_';
+    }
+  }
+
+  FILE *f = fdopen(dup(fd), "r");
+  if (f) {
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+      char digest[CACHE_DIGEST_CHARS + 1], build[64], spec[64];
+      unsigned long long branches, mispredictions;
+      if (line[0] == '#' ||
+          sscanf(line, "%32s %63s %63s %llu %llu", digest, build, spec,
+                 &branches, &mispredictions) != 5 ||
+          strcmp(build, cache->build)) {
+        continue;
+      }
+      char key[CACHE_KEY_SIZE];
+      snprintf(key, sizeof(key), "%s %s", digest, spec);
+      cache_entry *e = cache_find(cache, key, 1);
+      e->branches = branches;
+      e->mispredictions = mispredictions;
+    }
+    fclose(f);
+  }
+
+  // A new file starts with a line saying what it holds
+  if (lseek(fd, 0, SEEK_END) == 0) {
+    dprintf(fd, "%s\n", CACHE_HEADER);
+  }
+  return cache;
+}
+
+int
+cache_lookup(result_cache *cache, const char *digest,
+             const predictor_config *config, uint64_t *branches,
+             uint64_t *mispredictions)
+{
+  char key[CACHE_KEY_SIZE];
+  make_key(key, digest, config);
+  const cache_entry *e = cache_find(cache, key, 0);
+  if (!e) {
+    return 0;
+  }
+  *branches = e->branches;
+  *mispredictions = e->mispredictions;
+  return 1;
+}
+
+void
+cache_store(result_cache *cache, const char *digest,
+            const predictor_config *config, uint64_t branches,
+            uint64_t mispredictions)
+{
+  char key[CACHE_KEY_SIZE];
+  make_key(key, digest, config);
+  cache_entry *e = cache_find(cache, key, 1);
+  e->branches = branches;
+  e->mispredictions = mispredictions;
+
+  // One write() per line, so concurrent runs appending to the same file
+  // do not interleave within a line
+  char spec[64], line[256];
+  format_predictor_spec(config, spec, sizeof(spec));
+  int len = snprintf(line, sizeof(line), "%s %s %s %llu %llu\n", digest,
+                     cache->build, spec, (unsigned long long)branches,
+                     (unsigned long long)mispredictions);
+  if (write(cache->fd, line, len) != len) {
+    perror("cache");
+  }
+}
+
+void
+cache_close(result_cache *cache)
+{
+  for (uint32_t i = 0; i <= cache->mask; i++) {
+    free(cache->slots[i].key);
+  }
+  free(cache->slots);
+  close(cache->fd);
+  free(cache);
+}
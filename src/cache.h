@@ -0,0 +1,64 @@
+//========================================================//
+//  cache.h                                               //
+//  Header file for the persistent result cache           //
+//                                                        //
+//  Remembers the mispredictions of each predictor config //
+//  over each trace, keyed by the trace's contents and    //
+//  the build of the predictors that produced them        //
+//========================================================//
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include "predictor.h"
+
+// Hex digits of a trace digest
+#define CACHE_DIGEST_CHARS 32
+
+// Cache file format, one result per line, appended as results come in:
+//
+//   <trace digest> <build id> <predictor spec> <branches> <mispredictions>
+//
+// The digest is a 128-bit hash of the trace file's bytes, so a renamed
+// or copied trace still hits and a changed one misses.  The build id is
+// predictor_build_id(), so results from other versions of the predictors
+// are left alone.  Later lines win over earlier ones with the same key.
+#define CACHE_HEADER "# branch predictor results: digest build spec branches mispredictions"
+
+typedef struct result_cache result_cache;
+
+//------------------------------------//
+//      Cache Function Prototypes     //
+//------------------------------------//
+
+// Hash the contents of the file at 'path' into 'digest'
+//
+// Returns 0 on success, -1 (with errno set) if it cannot be read
+//
+int cache_digest_file(const char *path, char digest[CACHE_DIGEST_CHARS + 1]);
+
+// Open the cache file at 'path', creating it if it does not exist, and
+// load the results of this build of the predictors
+//
+// Returns NULL (with errno set) if the file cannot be opened
+//
+result_cache *cache_open(const char *path);
+
+// Look up the result of 'config' over the trace with 'digest'
+//
+// Returns True if it is cached
+//
+int cache_lookup(result_cache *cache, const char *digest,
+                 const predictor_config *config, uint64_t *branches,
+                 uint64_t *mispredictions);
+
+// Add a result, appending it to the file at once
+//
+void cache_store(result_cache *cache, const char *digest,
+                 const predictor_config *config, uint64_t branches,
+                 uint64_t mispredictions);
+
+void cache_close(result_cache *cache);
+
+#endif
@@ -0,0 +1,107 @@
+//========================================================//
+//  counter.h                                             //
+//  Packed tables of 2-bit saturating counters            //
+//                                                        //
+//  Stores 32 counters per 64-bit word, the same density  //
+//  as the modeled hardware, with branch-free updates     //
+//========================================================//
+
+#ifndef COUNTER_H
+#define COUNTER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Counter i lives in bits 2*(i%32)..2*(i%32)+1 of word i/32
+#define COUNTERS_PER_WORD 32
+
+typedef struct {
+  uint64_t *words;
+  uint32_t size;            // Number of counters
+} counter_table;
+
+// Allocate 'size' counters, all set to 'value' (0..3)
+//
+static inline void
+counter_table_init(counter_table *t, uint32_t size, uint8_t value)
+{
+  size_t words = (size + COUNTERS_PER_WORD - 1) / COUNTERS_PER_WORD;
+  t->size = size;
+  t->words = (uint64_t *)malloc(words * sizeof(uint64_t));
+  // 0x5555... repeats the 2-bit pattern 01 across the word
+  uint64_t fill = (uint64_t)(value & 3) * 0x5555555555555555ULL;
+  for (size_t w = 0; w < words; w++) {
+    t->words[w] = fill;
+  }
+}
+
+static inline void
+counter_table_free(counter_table *t)
+{
+  free(t->words);
+  t->words = NULL;
+}
+
+// Bytes of the packed words behind the table
+//
+static inline size_t
+counter_table_bytes(const counter_table *t)
+{
+  return (size_t)(t->size + COUNTERS_PER_WORD - 1) / COUNTERS_PER_WORD * sizeof(uint64_t);
+}
+
+static inline uint8_t
+counter_get(const counter_table *t, uint32_t i)
+{
+  return (t->words[i / COUNTERS_PER_WORD] >> (2 * (i % COUNTERS_PER_WORD))) & 3;
+}
+
+// Predict taken in the WT and ST states, i.e. when the high bit is set
+//
+static inline uint8_t
+counter_taken(const counter_table *t, uint32_t i)
+{
+  return (t->words[i / COUNTERS_PER_WORD] >> (2 * (i % COUNTERS_PER_WORD) + 1)) & 1;
+}
+
+// Saturating step of counter i towards ST if 'up' is set, else towards SN.
+// A step is added to or subtracted from the field in place; the saturation
+// checks become 0/1 masks, so there is no carry or borrow out of the field
+// and no data-dependent branch.
+//
+static inline void
+counter_update(counter_table *t, uint32_t i, uint8_t up)
+{
+  uint64_t *w = &t->words[i / COUNTERS_PER_WORD];
+  unsigned shift = 2 * (i % COUNTERS_PER_WORD);
+  uint64_t c = (*w >> shift) & 3;
+  uint64_t inc = (uint64_t)(up != 0) & (c != 3);
+  uint64_t dec = (uint64_t)(up == 0) & (c != 0);
+  *w = *w + (inc << shift) - (dec << shift);
+}
+
+// Start loading the word holding counter i, which is about to be updated
+//
+static inline void
+counter_prefetch(const counter_table *t, uint32_t i)
+{
+  __builtin_prefetch(&t->words[i / COUNTERS_PER_WORD], 1);
+}
+
+// Update counter i as counter_update() does and return the prediction it
+// made beforehand, reading the word once
+//
+static inline uint8_t
+counter_predict_update(counter_table *t, uint32_t i, uint8_t up)
+{
+  uint64_t *w = &t->words[i / COUNTERS_PER_WORD];
+  unsigned shift = 2 * (i % COUNTERS_PER_WORD);
+  uint64_t c = (*w >> shift) & 3;
+  uint64_t inc = (uint64_t)(up != 0) & (c != 3);
+  uint64_t dec = (uint64_t)(up == 0) & (c != 0);
+  *w = *w + (inc << shift) - (dec << shift);
+  return c >> 1;
+}
+
+#endif
@@ -0,0 +1,653 @@
+//========================================================//
+//  dist.c                                                //
+//  Source file for distributed sweeps                    //
+//                                                        //
+//  A single-threaded poll() loop hands out jobs to the   //
+//  workers; each worker runs one job at a time           //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "dist.h"
+#include "trace.h"
+
+// Longest message: a JOB of a lockstep group and a long trace path
+#define DIST_LINE_SIZE 8192
+
+// Seconds a worker keeps trying to reach the coordinator
+#define DIST_CONNECT_TRIES 30
+
+typedef struct {
+  int fd;                   // -1 once dropped
+  int ready;                // Said HELLO with a matching build
+  int job;                  // Job it is running, -1 when idle
+  int failed;               // Job it last failed, not handed back to it
+  time_t started;
+  const char *path;         // Trace of its last job
+  char buf[DIST_LINE_SIZE]; // Received bytes not yet parsed
+  size_t len;
+} dist_worker;
+
+typedef struct {
+  int running;              // Workers with a copy of it
+  int failures;
+  int done;
+  time_t started;           // When the oldest running copy was handed out
+} dist_state;
+
+typedef struct {
+  const dist_options *options;
+  dist_job *jobs;
+  dist_state *state;
+  int num_jobs;
+  int remaining;            // Jobs not done yet
+  int failed;               // Set once a job runs out of retries
+  dist_done_fn done;
+  void *arg;
+} dist_run;
+
+static int
+send_line(int fd, const char *line)
+{
+  size_t len = strlen(line);
+  while (len > 0) {
+    ssize_t n = send(fd, line, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    line += n;
+    len -= n;
+  }
+  return 0;
+}
+
+//------------------------------------//
+//            Coordinator             //
+//------------------------------------//
+
+// Listen on 'port', on every interface if 'remote' is set and on the
+// loopback interface otherwise
+//
+static int
+open_listener(int port, int remote, int *bound)
+{
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(remote ? INADDR_ANY : INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  socklen_t len = sizeof(addr);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 64) != 0 ||
+      getsockname(fd, (struct sockaddr *)&addr, &len) != 0) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  *bound = ntohs(addr.sin_port);
+  return fd;
+}
+
+// Start the local workers, pointed at 'port' on the loopback interface
+//
+static pid_t *
+spawn_workers(const dist_options *options, int port)
+{
+  pid_t *children = calloc(options->spawn ? options->spawn : 1, sizeof(pid_t));
+  char address[32];
+  snprintf(address, sizeof(address), "--worker=127.0.0.1:%d", port);
+
+  for (int i = 0; i < options->spawn; i++) {
+    children[i] = fork();
+    if (children[i] == 0) {
+      execlp(options->worker_path, options->worker_path, address, (char *)NULL);
+      perror(options->worker_path);
+      _exit(127);
+    }
+    if (children[i] < 0) {
+      perror("fork");
+    }
+  }
+  return children;
+}
+
+// Returns the number of local workers still running, reaping the others
+//
+static int
+live_children(pid_t *children, int count)
+{
+  int live = 0;
+  for (int i = 0; i < count; i++) {
+    if (children[i] > 0) {
+      if (waitpid(children[i], NULL, WNOHANG) == children[i]) {
+        children[i] = 0;
+      } else {
+        live++;
+      }
+    }
+  }
+  return live;
+}
+
+// Count a failed attempt at 'job', which is retried unless it is out of
+// retries
+//
+static void
+job_failed(dist_run *run, int job, const char *reason)
+{
+  dist_state *s = &run->state[job];
+  if (s->done) {
+    return;
+  }
+  s->failures++;
+  fprintf(stderr, "coordinator: job %d on %s failed (%s)%s\n", job,
+          run->jobs[job].path, reason,
+          s->failures > run->options->retries ? ", giving up" : ", retrying");
+  if (s->failures > run->options->retries) {
+    run->failed = 1;
+  }
+}
+
+// Disconnect a worker, failing the job it held
+//
+static void
+drop_worker(dist_run *run, dist_worker *w, const char *reason)
+{
+  if (w->job >= 0) {
+    run->state[w->job].running--;
+    job_failed(run, w->job, reason);
+  }
+  close(w->fd);
+  w->fd = -1;
+}
+
+// Returns the job to give an idle worker, or -1 if there is none
+//
+static int
+pick_job(dist_run *run, const dist_worker *w)
+{
+  // A waiting job, preferably on the trace the worker has decoded
+  int first = -1;
+  for (int j = 0; j < run->num_jobs; j++) {
+    const dist_state *s = &run->state[j];
+    if (s->done || s->running || j == w->failed) {
+      continue;
+    }
+    if (w->path && !strcmp(run->jobs[j].path, w->path)) {
+      return j;
+    }
+    if (first < 0) {
+      first = j;
+    }
+  }
+  if (first >= 0) {
+    return first;
+  }
+
+  // Otherwise a second copy of the job that has been running longest
+  for (int j = 0; j < run->num_jobs; j++) {
+    const dist_state *s = &run->state[j];
+    if (!s->done && s->running == 1 && j != w->failed &&
+        (first < 0 || s->started < run->state[first].started)) {
+      first = j;
+    }
+  }
+  return first;
+}
+
+// A worker is not given back the job it failed, unless no other worker
+// could take it: then the job would wait forever, so it is retried on
+// the same workers until it runs out of retries
+//
+static void
+release_failed(dist_worker *workers, int num_workers)
+{
+  for (int i = 0; i < num_workers; i++) {
+    int job = workers[i].failed;
+    if (workers[i].fd < 0 || job < 0) {
+      continue;
+    }
+    int eligible = 0;
+    for (int k = 0; k < num_workers && !eligible; k++) {
+      eligible = workers[k].fd >= 0 && workers[k].ready && workers[k].failed != job;
+    }
+    if (!eligible) {
+      for (int k = 0; k < num_workers; k++) {
+        if (workers[k].failed == job) {
+          workers[k].failed = -1;
+        }
+      }
+    }
+  }
+}
+
+static void
+send_job(dist_run *run, dist_worker *w, int job)
+{
+  const dist_job *j = &run->jobs[job];
+  char line[DIST_LINE_SIZE];
+  int len = snprintf(line, sizeof(line), "JOB %d %d", job, j->count);
+  for (int c = 0; c < j->count && len < (int)sizeof(line); c++) {
+    char spec[64];
+    format_predictor_spec(&j->configs[c], spec, sizeof(spec));
+    len += snprintf(line + len, sizeof(line) - len, " %s", spec);
+  }
+  if (len < (int)sizeof(line)) {
+    len += snprintf(line + len, sizeof(line) - len, " %s\n", j->path);
+  }
+  if (len >= (int)sizeof(line)) {
+    fprintf(stderr, "coordinator: job %d does not fit in a message\n", job);
+    run->failed = 1;
+    return;
+  }
+
+  w->job = job;
+  w->started = time(NULL);
+  w->path = j->path;
+  if (run->state[job].running++ == 0) {
+    run->state[job].started = w->started;
+  }
+  if (send_line(w->fd, line) != 0) {
+    drop_worker(run, w, "lost connection");
+  }
+}
+
+static void
+handle_result(dist_run *run, dist_worker *w, char *args)
+{
+  char *end;
+  long job = strtol(args, &end, 10);
+  if (end == args || job != w->job) {
+    drop_worker(run, w, "bad result");
+    return;
+  }
+
+  dist_job *j = &run->jobs[job];
+  uint64_t branches = strtoull(end, &end, 10);
+  uint32_t *m = malloc(j->count * sizeof(uint32_t));
+  for (int c = 0; c < j->count; c++) {
+    char *start = end;
+    m[c] = strtoul(start, &end, 10);
+    if (end == start) {
+      free(m);
+      drop_worker(run, w, "bad result");
+      return;
+    }
+  }
+
+  dist_state *s = &run->state[job];
+  s->running--;
+  w->job = -1;
+  if (!s->done) {
+    s->done = 1;
+    run->remaining--;
+    j->branches = branches;
+    memcpy(j->mispredictions, m, j->count * sizeof(uint32_t));
+    if (run->done) {
+      run->done(j, job, run->arg);
+    }
+  }
+  free(m);
+}
+
+static void
+handle_line(dist_run *run, dist_worker *w, char *line)
+{
+  if (!strncmp(line, "HELLO ", 6)) {
+    if (strcmp(line + 6, predictor_build_id())) {
+      char bye[128];
+      snprintf(bye, sizeof(bye), "BYE predictor build %.64s expected\n",
+               predictor_build_id());
+      send_line(w->fd, bye);
+      fprintf(stderr, "coordinator: turned away a worker of build %s\n", line + 6);
+      drop_worker(run, w, "wrong build");
+    } else {
+      w->ready = 1;
+    }
+  } else if (!strncmp(line, "RESULT ", 7) && w->ready) {
+    handle_result(run, w, line + 7);
+  } else if (!strncmp(line, "FAIL ", 5) && w->ready && w->job >= 0) {
+    char *reason = strchr(line + 5, ' ');
+    int job = w->job;
+    run->state[job].running--;
+    w->job = -1;
+    w->failed = job;
+    job_failed(run, job, reason ? reason + 1 : "no reason given");
+  } else {
+    drop_worker(run, w, "protocol error");
+  }
+}
+
+// Read what a worker has sent and act on each complete line
+//
+static void
+receive(dist_run *run, dist_worker *w)
+{
+  ssize_t n = read(w->fd, w->buf + w->len, sizeof(w->buf) - 1 - w->len);
+  if (n <= 0) {
+    if (n < 0 && errno == EINTR) {
+      return;
+    }
+    drop_worker(run, w, n < 0 ? strerror(errno) : "worker exited");
+    return;
+  }
+  w->len += n;
+  w->buf[w->len] = '\0';
+
+  char *line = w->buf;
+  char *newline;
+  while (w->fd >= 0 && (newline = strchr(line, '\n'))) {
+    *newline = '\0';
+    handle_line(run, w, line);
+    line = newline + 1;
+  }
+  if (w->fd < 0) {
+    return;
+  }
+  w->len -= line - w->buf;
+  memmove(w->buf, line, w->len);
+  if (w->len == sizeof(w->buf) - 1) {
+    drop_worker(run, w, "line too long");
+  }
+}
+
+int
+dist_coordinate(const dist_options *options, dist_job *jobs, int num_jobs,
+                dist_done_fn done, void *arg)
+{
+  int port;
+  int listener = open_listener(options->port, options->remote, &port);
+  if (listener < 0) {
+    perror("coordinator");
+    return -1;
+  }
+  fprintf(stderr, "coordinator: %d jobs, listening on port %d\n", num_jobs, port);
+  pid_t *children = spawn_workers(options, port);
+
+  dist_run run = { options, jobs, calloc(num_jobs, sizeof(dist_state)), num_jobs,
+                   num_jobs, 0, done, arg };
+  dist_worker *workers = NULL;
+  int num_workers = 0;
+  struct pollfd *fds = NULL;
+
+  while (run.remaining > 0 && !run.failed) {
+    // Keep every idle worker busy
+    release_failed(workers, num_workers);
+    for (int i = 0; i < num_workers; i++) {
+      dist_worker *w = &workers[i];
+      int job;
+      if (w->fd >= 0 && w->ready && w->job < 0 && (job = pick_job(&run, w)) >= 0) {
+        send_job(&run, w, job);
+      }
+    }
+
+    fds = realloc(fds, (num_workers + 1) * sizeof(struct pollfd));
+    fds[0].fd = listener;
+    fds[0].events = POLLIN;
+    for (int i = 0; i < num_workers; i++) {
+      fds[i + 1].fd = workers[i].fd;
+      fds[i + 1].events = POLLIN;
+    }
+    if (poll(fds, num_workers + 1, 1000) < 0 && errno != EINTR) {
+      perror("coordinator");
+      run.failed = 1;
+      break;
+    }
+
+    for (int i = 0; i < num_workers; i++) {
+      if (workers[i].fd >= 0 && fds[i + 1].revents) {
+        receive(&run, &workers[i]);
+      }
+    }
+
+    time_t now = time(NULL);
+    for (int i = 0; i < num_workers; i++) {
+      dist_worker *w = &workers[i];
+      if (w->fd >= 0 && w->job >= 0 && options->timeout > 0 &&
+          now - w->started > options->timeout) {
+        drop_worker(&run, w, "timed out");
+      }
+    }
+
+    // Forget dropped workers, then take on new ones
+    int kept = 0;
+    for (int i = 0; i < num_workers; i++) {
+      if (workers[i].fd >= 0) {
+        if (kept != i) {
+          workers[kept] = workers[i];
+        }
+        kept++;
+      }
+    }
+    num_workers = kept;
+
+    if (fds[0].revents & POLLIN) {
+      int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+      if (fd >= 0) {
+        workers = realloc(workers, (num_workers + 1) * sizeof(dist_worker));
+        dist_worker *w = &workers[num_workers++];
+        w->fd = fd;
+        w->ready = 0;
+        w->job = -1;
+        w->failed = -1;
+        w->path = NULL;
+        w->len = 0;
+      }
+    }
+
+    if (num_workers == 0 && options->spawn > 0 &&
+        live_children(children, options->spawn) == 0) {
+      fprintf(stderr, "coordinator: every local worker has exited\n");
+      run.failed = 1;
+    }
+  }
+
+  // Release the workers, which exit; local ones are waited for
+  for (int i = 0; i < num_workers; i++) {
+    send_line(workers[i].fd, run.failed ? "BYE sweep failed\n" : "DONE\n");
+    close(workers[i].fd);
+  }
+  close(listener);
+  for (int i = 0; i < options->spawn; i++) {
+    if (children[i] > 0) {
+      if (run.failed) {
+        kill(children[i], SIGTERM);
+      }
+      waitpid(children[i], NULL, 0);
+    }
+  }
+
+  free(children);
+  free(workers);
+  free(fds);
+  free(run.state);
+  return run.failed ? -1 : 0;
+}
+
+//------------------------------------//
+//               Worker               //
+//------------------------------------//
+
+static int
+connect_to(const char *address)
+{
+  char host[256];
+  const char *colon = strrchr(address, ':');
+  if (!colon || colon == address || colon - address >= (int)sizeof(host)) {
+    fprintf(stderr, "worker: expected <host>:<port>, not %s\n", address);
+    return -1;
+  }
+  memcpy(host, address, colon - address);
+  host[colon - address] = '\0';
+
+  struct addrinfo hints, *addrs;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int err = getaddrinfo(host, colon + 1, &hints, &addrs);
+  if (err) {
+    fprintf(stderr, "worker: %s: %s\n", address, gai_strerror(err));
+    return -1;
+  }
+
+  // The coordinator may still be starting up
+  int fd = -1;
+  for (int attempt = 0; fd < 0 && attempt < DIST_CONNECT_TRIES; attempt++) {
+    if (attempt > 0) {
+      sleep(1);
+    }
+    for (struct addrinfo *a = addrs; a && fd < 0; a = a->ai_next) {
+      fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+      if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+  }
+  if (fd < 0) {
+    fprintf(stderr, "worker: cannot reach %s: %s\n", address, strerror(errno));
+  }
+  freeaddrinfo(addrs);
+  return fd;
+}
+
+// Run one JOB ('args' is everything after "JOB "), answering on 'out'.
+// The last trace read is kept in 'trace', named by '*loaded'.
+//
+static void
+run_job(char *args, FILE *out, trace_buffer *trace, char **loaded)
+{
+  char *p = args;
+  long job = strtol(p, &p, 10);
+  long count = strtol(p, &p, 10);
+  if (count <= 0) {
+    fprintf(out, "FAIL %ld malformed job\n", job);
+    return;
+  }
+
+  predictor_config *configs = malloc(count * sizeof(predictor_config));
+  for (long c = 0; c < count; c++) {
+    while (*p == ' ') {
+      p++;
+    }
+    char *end = strchr(p, ' ');
+    int n;
+    predictor_config *parsed = NULL;
+    if (end) {
+      *end = '\0';
+      parsed = parse_predictor_spec(p, &n);
+      p = end + 1;
+    }
+    if (!parsed || n != 1) {
+      fprintf(out, "FAIL %ld bad predictor spec\n", job);
+      free(parsed);
+      free(configs);
+      return;
+    }
+    configs[c] = parsed[0];
+    free(parsed);
+  }
+
+  // p is now the trace path, which runs to the end of the line
+  if (!*loaded || strcmp(*loaded, p)) {
+    if (*loaded) {
+      trace_buffer_free(trace);
+      free(*loaded);
+      *loaded = NULL;
+    }
+    if (trace_load(p, trace) != 0) {
+      fprintf(out, "FAIL %ld %s: %s\n", job, p, strerror(errno));
+      free(configs);
+      return;
+    }
+    *loaded = strdup(p);
+  }
+
+  predictor **predictors = malloc(count * sizeof(predictor *));
+  uint32_t *mispredictions = malloc(count * sizeof(uint32_t));
+  for (long c = 0; c < count; c++) {
+    predictors[c] = predictor_create(&configs[c]);
+  }
+  predictor_run_many(predictors, count, trace->pcs, trace->outcomes, trace->count,
+                     mispredictions);
+
+  fprintf(out, "RESULT %ld %zu", job, trace->count);
+  for (long c = 0; c < count; c++) {
+    fprintf(out, " %u", mispredictions[c]);
+    predictor_destroy(predictors[c]);
+  }
+  fprintf(out, "\n");
+
+  free(predictors);
+  free(mispredictions);
+  free(configs);
+}
+
+int
+dist_work(const char *address)
+{
+  signal(SIGPIPE, SIG_IGN);
+  int fd = connect_to(address);
+  if (fd < 0) {
+    return -1;
+  }
+  FILE *in = fdopen(fd, "r");
+  FILE *out = fdopen(dup(fd), "w");
+  fprintf(out, "HELLO %s\n", predictor_build_id());
+  fflush(out);
+
+  trace_buffer trace;
+  char *loaded = NULL;
+  char line[DIST_LINE_SIZE];
+  int status = -1;
+  for (;;) {
+    if (!fgets(line, sizeof(line), in)) {
+      fprintf(stderr, "worker: coordinator hung up\n");
+      break;
+    }
+    line[strcspn(line, "\n")] = '\0';
+    if (!strcmp(line, "DONE")) {
+      status = 0;
+      break;
+    } else if (!strncmp(line, "BYE ", 4)) {
+      fprintf(stderr, "worker: coordinator says %s\n", line + 4);
+      break;
+    } else if (!strncmp(line, "JOB ", 4)) {
+      run_job(line + 4, out, &trace, &loaded);
+      fflush(out);
+    } else {
+      fprintf(stderr, "worker: unexpected message: %s\n", line);
+      break;
+    }
+  }
+
+  if (loaded) {
+    trace_buffer_free(&trace);
+    free(loaded);
+  }
+  fclose(in);
+  fclose(out);
+  return status;
+}
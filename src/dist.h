@@ -0,0 +1,75 @@
+//========================================================//
+//  dist.h                                                //
+//  Header file for distributed sweeps                    //
+//                                                        //
+//  A coordinator hands sweep jobs to predictor worker    //
+//  processes, on this or other machines, over TCP        //
+//========================================================//
+
+#ifndef DIST_H
+#define DIST_H
+
+#include <stdint.h>
+#include "predictor.h"
+
+// Protocol, one line of text per message:
+//
+//   worker      HELLO <build id>
+//   coordinator JOB <id> <# specs> <spec>... <trace path>
+//   worker      RESULT <id> <branches> <mispredictions>...
+//   worker      FAIL <id> <reason>
+//   coordinator DONE | BYE <reason>
+//
+// A worker sends HELLO once connected, then answers each JOB with one
+// RESULT (one misprediction count per spec) or FAIL, and exits on DONE
+// or BYE.  Trace paths are opened by the worker, so they must name the
+// same file on every node.  Workers of another build are sent BYE, as
+// their results would differ.
+
+// Simulate 'count' configs side by side over one trace
+typedef struct {
+  const char *path;
+  const predictor_config *configs;
+  int count;
+  uint64_t branches;        // Filled in with the result
+  uint32_t *mispredictions; // One per config, filled in with the result
+} dist_job;
+
+typedef struct {
+  int port;                 // Port to listen on, 0 for any free one
+  int remote;               // Accept workers from other hosts, not just
+                            // the loopback interface
+  int spawn;                // Local worker processes to start
+  const char *worker_path;  // predictor binary for the local workers
+  int retries;              // Times a failed job is retried before giving up
+  int timeout;              // Seconds a worker may hold a job, 0 for no limit
+} dist_options;
+
+// Called as each job finishes, with its index in the job array
+typedef void (*dist_done_fn)(const dist_job *job, int index, void *arg);
+
+//------------------------------------//
+//      Dist Function Prototypes      //
+//------------------------------------//
+
+// Run 'jobs' on the workers that connect, after starting 'spawn' local
+// ones.  Each idle worker is given a waiting job, preferring one on the
+// trace it last read; once none are waiting it steals a second copy of
+// the oldest running job, and whichever copy finishes first counts.  A
+// job whose worker disconnects, fails or overruns the timeout is retried
+// elsewhere.
+//
+// Returns 0 once every job is done, -1 if the port cannot be opened, a
+// job still fails after 'retries' retries or every local worker exits
+//
+int dist_coordinate(const dist_options *options, dist_job *jobs, int num_jobs,
+                    dist_done_fn done, void *arg);
+
+// Serve jobs from the coordinator at 'address' (<host>:<port>) until it
+// is done with this worker
+//
+// Returns 0 on DONE, -1 if the coordinator cannot be reached or hangs up
+//
+int dist_work(const char *address);
+
+#endif
@@ -8,11 +8,40 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include "cache.h"
+#include "dist.h"
+#include "perf.h"
 #include "predictor.h"
+#include "profile.h"
+#include "sample.h"
+#include "trace.h"
 
-FILE *stream;
-char *buf = NULL;
-size_t len = 0;
+const char *trace_path = NULL;
+int csv = 0;
+uint64_t budget = 0;     // Storage budget in bits, 0 for none
+int budget_warn = 0;     // Warn about configs over budget instead of dropping them
+int profile_top = 0;     // Branches in the profile table, 0 for no profile
+const char *profile_csv = NULL;
+uint64_t interval = 0;   // Branches per row of the interval stream, 0 for none
+uint64_t warmup = 0;     // Leading branches left out of the final statistics
+const char *load_state = NULL;  // Checkpoint to start the predictor from
+const char *save_state = NULL;  // Checkpoint to write at the end of the run
+simpoint_options simpoint = { 0, 100000, 500000 };  // Sampled if 'phases' is set
+int chunks = 0;          // Segments simulated in parallel, 0 for a serial run
+uint64_t chunk_warmup = 1000000;
+int chunk_verify = 0;    // Also run serially and report the divergence
+const char *cache_path = NULL;  // Result cache to consult and extend
+const char *coordinator = NULL; // <host>:<port> of a sweep to work for
+int perf = 0;            // Count the simulator's own events in each phase
+perf_counters *counters = NULL;
+perf_totals parse_totals;
+trace_buffer perf_trace;  // Under --perf, the trace decoded up front
+size_t perf_next = 0;     // Next branch of perf_trace to simulate
+
+// Predictor instances simulated side by side in this run
+predictor_config *configs = NULL;
+int num_configs = 0;
 
 // Print out the Usage information to stderr
 //
@@ -21,15 +50,63 @@ usage()
 {
   fprintf(stderr,"Usage: predictor <options> [<trace>]\n");
   fprintf(stderr,"       bunzip -kc trace.bz2 | predictor <options>\n");
+  fprintf(stderr," Traces may be plain text or bzip2/gzip/zstd compressed\n");
   fprintf(stderr," Options:\n");
   fprintf(stderr," --help       Print this message\n");
   fprintf(stderr," --verbose    Print predictions on stdout\n");
+  fprintf(stderr," --csv        Print one CSV row per predictor\n");
+  fprintf(stderr," --profile[=<n>]\n"
+                 "              Profile every branch and print the <n> (default 20)\n"
+                 "              with the most mispredictions\n");
+  fprintf(stderr," --profile-csv=<file>\n"
+                 "              Write the profile of every branch to <file>\n");
+  fprintf(stderr," --interval=<n> Stream each predictor's mispredictions every <n>\n"
+                 "              branches as CSV on stdout; the summary moves to stderr\n");
+  fprintf(stderr," --warmup=<n>  Leave the first <n> branches out of the summary\n");
+  fprintf(stderr," --load-state=<file>\n"
+                 "              Start from a checkpoint instead of a cold predictor;\n"
+                 "              the predictor type may then be left out\n");
+  fprintf(stderr," --save-state=<file>\n"
+                 "              Checkpoint the predictor at the end of the trace\n");
+  fprintf(stderr," --simpoint=<phases>[:<interval>[:<warm-up>]]\n"
+                 "              Estimate the rate from a sample: cluster the trace's\n"
+                 "              <interval>-branch intervals (default 100000) into\n"
+                 "              phases and simulate one interval of each, after\n"
+                 "              <warm-up> branches (default 500000) of training\n");
+  fprintf(stderr," --chunks=<n>[:<warm-up>[:verify]]\n"
+                 "              Split the trace into <n> segments simulated in\n"
+                 "              parallel, each trained on the <warm-up> (default\n"
+                 "              1000000) branches before it; 'verify' also runs\n"
+                 "              serially and reports the divergence\n");
+  fprintf(stderr," --cache=<file> Reuse the results stored in <file> and add new ones,\n"
+                 "              simulating only the predictors not found there\n");
+  fprintf(stderr," --perf       Count cycles, instructions, cache and branch misses of\n"
+                 "              the simulator itself while parsing, predicting and\n"
+                 "              training (CPU time only where counters are not allowed)\n");
+  fprintf(stderr," --worker=<host>:<port>\n"
+                 "              Run jobs for the sweep coordinator at <host>:<port>\n"
+                 "              instead of simulating a trace\n");
+  fprintf(stderr," --budget=<bits>[:warn]\n"
+                 "              Drop (or only warn about) predictors whose storage\n"
+                 "              exceeds <bits>; the competition limit is 65792\n");
   fprintf(stderr," --<type>     Branch prediction scheme:\n");
   fprintf(stderr,"    static\n"
-                 "    bimodal\n"
+                 "    bimodal[:<# bhistory>]\n"
                  "    gshare:<# ghistory>\n"
                  "    tournament:<# ghistory>:<# lhistory>:<# index>\n"
-                 "    custom\n");
+                 "    perceptron[:<# ghistory>:<# perceptrons>:<threshold>]\n"
+                 "    tage[:<# tables>:<log2 entries>:<tag bits>:<min history>:\n"
+                 "         <max history>:<log2 base entries>]\n"
+                 "    custom[:hybrid|:tage|:perceptron]\n");
+  fprintf(stderr," --predictor=<type>[:<args>]\n"
+                 "              Same as --<type>, for any registered predictor:\n"
+                 "             ");
+  for (int t = 0; predictor_type_name(t); t++) {
+    fprintf(stderr, " %s", predictor_type_name(t));
+  }
+  fprintf(stderr, "\n");
+  fprintf(stderr," Several schemes may be given and are simulated in one pass over\n"
+                 " the trace.  Any size may be a range, e.g. --gshare:5..15\n");
 }
 
 // Process an option and update the predictor
@@ -40,55 +117,318 @@ usage()
 int
 handle_option(char *arg)
 {
-  if (!strcmp(arg,"--static")) {
-    bpType = STATIC;
-  } else if (!strncmp(arg,"--bimodal",9)) {
-    bpType = BIMODAL;
-    if (sscanf(arg + 9, ":%d", &bhistoryBits) != 1) {
-        bhistoryBits = 12;
-    }
-  } else if (!strncmp(arg,"--gshare:",9)) {
-    bpType = GSHARE;
-    sscanf(arg+9,"%d", &ghistoryBits);
-  } else if (!strncmp(arg,"--tournament:",13)) {
-    bpType = TOURNAMENT;
-    sscanf(arg+13,"%d:%d:%d", &ghistoryBits, &lhistoryBits, &pcIndexBits);
-  } else if (!strcmp(arg,"--custom")) {
-    bpType = CUSTOM;
-  } else if (!strcmp(arg,"--verbose")) {
+  if (!strcmp(arg,"--verbose")) {
     verbose = 1;
+  } else if (!strcmp(arg,"--csv")) {
+    csv = 1;
+  } else if (!strcmp(arg,"--profile")) {
+    profile_top = 20;
+  } else if (!strncmp(arg,"--profile=",10)) {
+    profile_top = atoi(arg + 10);
+    if (profile_top <= 0) {
+      return 0;
+    }
+  } else if (!strncmp(arg,"--profile-csv=",14)) {
+    profile_csv = arg + 14;
+  } else if (!strncmp(arg,"--interval=",11)) {
+    char *end;
+    interval = strtoull(arg + 11, &end, 10);
+    if (end == arg + 11 || *end || interval == 0) {
+      return 0;
+    }
+  } else if (!strncmp(arg,"--warmup=",9)) {
+    char *end;
+    warmup = strtoull(arg + 9, &end, 10);
+    if (end == arg + 9 || *end) {
+      return 0;
+    }
+  } else if (!strncmp(arg,"--load-state=",13)) {
+    load_state = arg + 13;
+  } else if (!strncmp(arg,"--save-state=",13)) {
+    save_state = arg + 13;
+  } else if (!strncmp(arg,"--simpoint=",11)) {
+    char *end;
+    simpoint.phases = strtol(arg + 11, &end, 10);
+    if (*end == ':') {
+      simpoint.interval = strtoull(end + 1, &end, 10);
+    }
+    if (*end == ':') {
+      simpoint.warmup = strtoull(end + 1, &end, 10);
+    }
+    if (*end || simpoint.phases <= 0 || simpoint.interval == 0) {
+      return 0;
+    }
+  } else if (!strncmp(arg,"--chunks=",9)) {
+    char *end;
+    chunks = strtol(arg + 9, &end, 10);
+    if (*end == ':' && end[1] != 'v') {
+      chunk_warmup = strtoull(end + 1, &end, 10);
+    }
+    if (!strcmp(end, ":verify")) {
+      chunk_verify = 1;
+      end += 7;
+    }
+    if (*end || chunks <= 0) {
+      return 0;
+    }
+  } else if (!strncmp(arg,"--cache=",8)) {
+    cache_path = arg + 8;
+  } else if (!strcmp(arg,"--perf")) {
+    perf = 1;
+  } else if (!strncmp(arg,"--worker=",9)) {
+    coordinator = arg + 9;
+  } else if (!strncmp(arg,"--budget=",9)) {
+    char *end;
+    budget = strtoull(arg + 9, &end, 10);
+    budget_warn = !strcmp(end, ":warn");
+    if (end == arg + 9 || (*end && !budget_warn)) {
+      return 0;
+    }
   } else {
-    return 0;
+    // --predictor=<spec> is the long form of --<spec>
+    const char *spec = strncmp(arg, "--predictor=", 12) ? arg + 2 : arg + 12;
+    int count;
+    predictor_config *parsed = parse_predictor_spec(spec, &count);
+    if (!parsed) {
+      return 0;
+    }
+    configs = realloc(configs, (num_configs + count) * sizeof(predictor_config));
+    memcpy(configs + num_configs, parsed, count * sizeof(predictor_config));
+    num_configs += count;
+    free(parsed);
   }
 
   return 1;
 }
 
-// Reads a line from the input stream and extracts the
-// PC and Outcome of a branch
+// Print the statistics of predictor 'j': a CSV row, or a block of lines
+// headed by its name when there are several predictors.  'skipped' is
+// the warm-up left out of 'branches'.
 //
-// Returns True if Successful 
+static void
+print_summary(FILE *out, int j, uint64_t skipped, uint64_t branches,
+              uint64_t incorrect, float mispredict_rate)
+{
+  char name[64];
+  format_predictor_spec(&configs[j], name, sizeof(name));
+  unsigned long long storage = predictor_storage_bits(&configs[j]);
+
+  if (csv) {
+    fprintf(out, "%s,%d,%llu,%llu,%.3f,%llu\n", name,
+            predictor_history_bits(&configs[j]), (unsigned long long)branches,
+            (unsigned long long)incorrect, mispredict_rate, storage);
+    return;
+  }
+  if (num_configs > 1) {
+    fprintf(out, "%sPredictor:       %s\n", j ? "\n" : "", name);
+  }
+  fprintf(out, "Storage Bits:    %10llu\n", storage);
+  if (skipped) {
+    fprintf(out, "Warm-up:         %10llu\n", (unsigned long long)skipped);
+  }
+  fprintf(out, "Branches:        %10llu\n", (unsigned long long)branches);
+  fprintf(out, "Incorrect:       %10llu\n", (unsigned long long)incorrect);
+  fprintf(out, "Misprediction Rate: %7.3f\n", mispredict_rate);
+}
+
+static void
+print_csv_header(FILE *out)
+{
+  if (csv) {
+    fprintf(out, "predictor,history_bits,branches,incorrect,misp_rate,storage_bits\n");
+  }
+}
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Estimate every predictor's misprediction rate from a SimPoint sample of
+// the trace.  The incorrect count is the estimated rate over the whole
+// trace.
 //
-int
-read_branch(uint32_t *pc, uint8_t *outcome)
+// Returns the exit status
+//
+static int
+run_simpoint()
 {
-  if (getline(&buf, &len, stream) == -1) {
-    return 0;
+  simpoint_result *results = malloc(num_configs * sizeof(simpoint_result));
+  uint64_t branches;
+  int intervals, phases;
+  if (simpoint_run(trace_path, configs, num_configs, &simpoint, results,
+                   &branches, &intervals, &phases) != 0) {
+    perror(trace_path ? trace_path : "simpoint");
+    return 1;
   }
+  fprintf(stderr, "simpoint: %d phases from %d intervals of %llu branches\n",
+          phases, intervals, (unsigned long long)simpoint.interval);
 
-  uint32_t tmp;
-  sscanf(buf,"0x%x %d\n",pc,&tmp);
-  *outcome = tmp;
+  print_csv_header(stdout);
+  for (int j = 0; j < num_configs; j++) {
+    char name[64];
+    format_predictor_spec(&configs[j], name, sizeof(name));
+    uint64_t incorrect = (uint64_t)(results[j].misp_rate * branches / 100 + 0.5);
+    print_summary(stdout, j, 0, branches, incorrect, results[j].misp_rate);
+    if (!csv) {
+      printf("Standard Error:     %7.3f\n", results[j].error);
+    }
+    fprintf(stderr, "simpoint: %s: %.3f +/- %.3f, simulated %llu of %llu branches\n",
+            name, results[j].misp_rate, results[j].error,
+            (unsigned long long)results[j].simulated, (unsigned long long)branches);
+  }
 
-  return 1;
+  free(results);
+  return 0;
+}
+
+// Simulate every predictor over the trace in parallel chunks
+//
+// Returns the exit status
+//
+static int
+run_chunked()
+{
+  trace_buffer trace;
+  if (trace_load(trace_path, &trace) != 0) {
+    perror(trace_path ? trace_path : "chunks");
+    return 1;
+  }
+  pool *workers = pool_create(0);
+
+  print_csv_header(stdout);
+  for (int j = 0; j < num_configs; j++) {
+    char name[64];
+    format_predictor_spec(&configs[j], name, sizeof(name));
+    double start = now();
+    uint64_t incorrect = chunked_run(workers, &configs[j], &trace, chunks, chunk_warmup);
+    double seconds = now() - start;
+    float mispredict_rate = trace.count ? 100*((float)incorrect / (float)trace.count) : 0;
+    print_summary(stdout, j, 0, trace.count, incorrect, mispredict_rate);
+
+    fprintf(stderr, "chunks: %s: %d chunks on %d threads in %.3f s",
+            name, chunks, pool_threads(workers), seconds);
+    if (chunk_verify) {
+      // A single chunk is the serial simulation
+      start = now();
+      uint64_t serial = chunked_run(workers, &configs[j], &trace, 1, 0);
+      seconds = now() - start;
+      long long divergence = (long long)incorrect - (long long)serial;
+      fprintf(stderr, "; serial %llu incorrect in %.3f s, divergence %+lld (%+.4f%%)",
+              (unsigned long long)serial, seconds, divergence,
+              serial ? 100.0 * divergence / serial : 0);
+    }
+    fprintf(stderr, "\n");
+  }
+
+  pool_destroy(workers);
+  trace_buffer_free(&trace);
+  return 0;
+}
+
+// Write one row of the interval stream per predictor for the interval
+// ending at branch 'end', and start the next interval's counts from zero
+//
+static void
+print_interval(char (*names)[64], uint64_t *interval_mispredictions,
+               uint64_t end, uint64_t branches)
+{
+  for (int j = 0; j < num_configs; j++) {
+    printf("%llu,%s,%llu,%.3f\n", (unsigned long long)end, names[j],
+           (unsigned long long)interval_mispredictions[j],
+           100.0 * interval_mispredictions[j] / branches);
+    interval_mispredictions[j] = 0;
+  }
+}
+
+// Read the next block of the trace, which --perf has already decoded
+//
+static size_t
+read_block(trace_reader *trace, uint32_t *pcs, uint8_t *outcomes)
+{
+  if (!counters) {
+    return trace_read_block(trace, pcs, outcomes, TRACE_BLOCK_SIZE);
+  }
+  size_t count = perf_trace.count - perf_next;
+  if (count > TRACE_BLOCK_SIZE) {
+    count = TRACE_BLOCK_SIZE;
+  }
+  memcpy(pcs, perf_trace.pcs + perf_next, count * sizeof(uint32_t));
+  memcpy(outcomes, perf_trace.outcomes + perf_next, count);
+  perf_next += count;
+  return count;
+}
+
+// Simulate 'count' branches on 'p' one predict and one train step at a
+// time, counting both into 'both'.  'shadow' starts in the same state as
+// 'p': the predict steps alone are run on it, counted into 'predict',
+// before it is brought level with 'p'.
+//
+// Returns the number of mispredictions
+//
+static uint32_t
+run_split(predictor *p, predictor *shadow, const uint32_t *pcs,
+          const uint8_t *outcomes, size_t count, perf_totals *both,
+          perf_totals *predict)
+{
+  uint32_t mispredictions = 0;
+  perf_begin(counters);
+  for (size_t i = 0; i < count; i++) {
+    mispredictions += predictor_predict(p, pcs[i]) != outcomes[i];
+    predictor_train(p, pcs[i], outcomes[i]);
+  }
+  perf_end(counters, both);
+
+  // Without train steps the history stays as it was at the start of the
+  // block, but every lookup is done in full
+  volatile uint32_t taken = 0;
+  perf_begin(counters);
+  for (size_t i = 0; i < count; i++) {
+    taken += predictor_predict(shadow, pcs[i]);
+  }
+  perf_end(counters, predict);
+
+  predictor_run(shadow, pcs, outcomes, NULL, count);
+  return mispredictions;
+}
+
+// Print the counts of each phase, in total and per branch.  The train
+// phase is what the predict and train steps cost beyond the predict
+// steps alone.
+//
+static void
+report_perf(FILE *out, char (*names)[64], const int *simulated, int num_simulated,
+            uint64_t branches, const perf_totals *both, const perf_totals *predict)
+{
+  fprintf(out, "\nPerformance counters of the simulator, in user space:\n");
+  if (perf_unavailable(counters)) {
+    fprintf(out, "  (hardware counters unavailable: %s; CPU time only)\n",
+            perf_unavailable(counters));
+  }
+  for (int per_branch = 0; per_branch <= 1; per_branch++) {
+    fprintf(out, "\n%s:\n", per_branch ? "Per branch" : "Totals");
+    perf_print_header(counters, out);
+    perf_print_row(counters, out, "parse", "", &parse_totals, branches, per_branch);
+    for (int k = 0; k < num_simulated; k++) {
+      perf_totals train = both[k];
+      for (int e = 0; e < PERF_EVENTS; e++) {
+        train.counts[e] -= predict[k].counts[e];
+      }
+      perf_print_row(counters, out, "predict", names[simulated[k]], &predict[k],
+                     branches, per_branch);
+      perf_print_row(counters, out, "train", names[simulated[k]], &train,
+                     branches, per_branch);
+    }
+  }
 }
 
 int
 main(int argc, char *argv[])
 {
   // Set defaults
-  stream = stdin;
-  bpType = STATIC;
   verbose = 0;
 
   // Process cmdline Arguments
@@ -104,45 +444,339 @@ main(int argc, char *argv[])
       }
     } else {
       // Use as input file
-      stream = fopen(argv[i], "r");
+      trace_path = argv[i];
     }
   }
 
-  // Initialize the predictor
-  init_predictor();
+  // A worker takes its predictors and traces from the coordinator
+  if (coordinator) {
+    return dist_work(coordinator) == 0 ? 0 : 1;
+  }
 
-  uint32_t num_branches = 0;
-  uint32_t mispredictions = 0;
-  uint32_t pc = 0;
-  uint8_t outcome = NOTTAKEN;
+  // A checkpoint brings its own config, which must match any given one
+  predictor *loaded = NULL;
+  if (load_state) {
+    if (!(loaded = predictor_load(load_state))) {
+      perror(load_state);
+      exit(1);
+    }
+    char name[64], given[64];
+    format_predictor_spec(predictor_get_config(loaded), name, sizeof(name));
+    if (num_configs == 1) {
+      format_predictor_spec(&configs[0], given, sizeof(given));
+    }
+    if (num_configs > 1 || (num_configs == 1 && strcmp(name, given))) {
+      fprintf(stderr, "%s holds a %s predictor\n", load_state, name);
+      exit(1);
+    }
+    configs = realloc(configs, sizeof(predictor_config));
+    configs[0] = *predictor_get_config(loaded);
+    num_configs = 1;
+  }
 
-  // Reach each branch from the trace
-  while (read_branch(&pc, &outcome)) {
-    num_branches++;
+  if (num_configs == 0) {
+    handle_option("--static");
+  }
 
-    // Make a prediction and compare with actual outcome
-    uint8_t prediction = make_prediction(pc);
-    if (prediction != outcome) {
-      mispredictions++;
+  // Check every predictor against the storage budget before simulating
+  if (budget > 0) {
+    int kept = 0;
+    for (int j = 0; j < num_configs; j++) {
+      uint64_t bits = predictor_storage_bits(&configs[j]);
+      if (bits > budget) {
+        char name[64];
+        format_predictor_spec(&configs[j], name, sizeof(name));
+        fprintf(stderr, "%s: %s uses %llu bits, over the %llu bit budget\n",
+                budget_warn ? "warning" : "skipping", name,
+                (unsigned long long)bits, (unsigned long long)budget);
+        if (!budget_warn) {
+          continue;
+        }
+      }
+      configs[kept++] = configs[j];
+    }
+    num_configs = kept;
+    if (num_configs == 0) {
+      fprintf(stderr, "No predictor fits the budget\n");
+      exit(1);
+    }
+  }
+  if (verbose && num_configs > 1) {
+    fprintf(stderr, "--verbose needs a single predictor\n");
+    exit(1);
+  }
+  if ((profile_top || profile_csv) && num_configs > 1) {
+    fprintf(stderr, "--profile needs a single predictor\n");
+    exit(1);
+  }
+  if (save_state && num_configs > 1) {
+    fprintf(stderr, "--save-state needs a single predictor\n");
+    exit(1);
+  }
+  if ((simpoint.phases || chunks) &&
+      (verbose || interval || warmup || profile_top || profile_csv ||
+       load_state || save_state)) {
+    fprintf(stderr, "--simpoint and --chunks replace the serial simulation and cannot\n"
+                    "be combined with --verbose, --interval, --warmup, --profile or\n"
+                    "checkpoints\n");
+    exit(1);
+  }
+  if (cache_path && (verbose || interval || warmup || profile_top || profile_csv ||
+                     load_state || save_state || simpoint.phases || chunks)) {
+    fprintf(stderr, "--cache only keeps whole-trace results, and cannot be combined\n"
+                    "with --verbose, --interval, --warmup, --profile, checkpoints,\n"
+                    "--simpoint or --chunks\n");
+    exit(1);
+  }
+  if (perf && (verbose || profile_top || profile_csv || load_state || cache_path ||
+               simpoint.phases || chunks)) {
+    fprintf(stderr, "--perf cannot be combined with --verbose, --profile, --load-state,\n"
+                    "--cache, --simpoint or --chunks\n");
+    exit(1);
+  }
+  if (cache_path && (!trace_path || !strcmp(trace_path, "-"))) {
+    fprintf(stderr, "--cache needs a trace file, not STDIN\n");
+    exit(1);
+  }
+  if (simpoint.phases && chunks) {
+    fprintf(stderr, "--simpoint and --chunks cannot be combined\n");
+    exit(1);
+  }
+  if (simpoint.phases) {
+    return run_simpoint();
+  }
+  if (chunks) {
+    return run_chunked();
+  }
+  if (verbose && interval) {
+    fprintf(stderr, "--interval and --verbose both write to stdout\n");
+    exit(1);
+  }
+
+  // Results already in the cache are reported without simulating them;
+  // predictors[k] simulates configs[simulated[k]]
+  uint64_t *mispredictions = calloc(num_configs, sizeof(uint64_t));
+  int *simulated = malloc(num_configs * sizeof(int));
+  int num_simulated = 0;
+  result_cache *cache = NULL;
+  char digest[CACHE_DIGEST_CHARS + 1];
+  uint64_t cached_branches = 0;
+  if (cache_path) {
+    if (cache_digest_file(trace_path, digest) != 0) {
+      perror(trace_path);
+      exit(1);
+    }
+    if (!(cache = cache_open(cache_path))) {
+      perror(cache_path);
+      exit(1);
+    }
+  }
+  for (int j = 0; j < num_configs; j++) {
+    if (!cache || !cache_lookup(cache, digest, &configs[j], &cached_branches,
+                                &mispredictions[j])) {
+      simulated[num_simulated++] = j;
+    }
+  }
+
+  trace_reader *trace = NULL;
+  if (num_simulated > 0 && !perf && !(trace = trace_open(trace_path))) {
+    perror(trace_path);
+    exit(1);
+  }
+
+  // Initialize the predictors
+  predictor **predictors = malloc(num_configs * sizeof(predictor *));
+  uint64_t *interval_mispredictions = calloc(num_configs, sizeof(uint64_t));
+  uint32_t *block_mispredictions = calloc(num_configs, sizeof(uint32_t));
+  char (*names)[64] = malloc(num_configs * sizeof(*names));
+  for (int k = 0; k < num_simulated; k++) {
+    predictors[k] = loaded ? loaded : predictor_create(&configs[simulated[k]]);
+  }
+
+  // --perf decodes the whole trace before simulating it, counting every
+  // decoding thread, so that the parse phase is complete and no decoding
+  // runs alongside the predictors.  The simulation is split into predict
+  // and train steps; shadow predictors run the predict steps alone, to
+  // tell the two apart.
+  predictor **shadows = NULL;
+  perf_totals *both_totals = NULL, *predict_totals = NULL;
+  if (perf) {
+    perf_counters *parse = perf_open(1);
+    perf_begin(parse);
+    if (trace_load(trace_path, &perf_trace) != 0) {
+      perror(trace_path);
+      exit(1);
+    }
+    perf_end(parse, &parse_totals);
+    perf_close(parse);
+
+    counters = perf_open(0);
+    shadows = malloc(num_configs * sizeof(predictor *));
+    both_totals = calloc(num_configs, sizeof(perf_totals));
+    predict_totals = calloc(num_configs, sizeof(perf_totals));
+    for (int k = 0; k < num_simulated; k++) {
+      shadows[k] = predictor_create(&configs[simulated[k]]);
+    }
+  }
+  for (int j = 0; j < num_configs; j++) {
+    format_predictor_spec(&configs[j], names[j], sizeof(names[j]));
+  }
+  profile *prof = NULL;
+  if (profile_top || profile_csv) {
+    prof = profile_create(&configs[0]);
+  }
+
+  uint64_t num_branches = num_simulated ? 0 : cached_branches;
+  uint64_t interval_branches = 0;
+  static uint32_t pcs[TRACE_BLOCK_SIZE];
+  static uint8_t outcomes[TRACE_BLOCK_SIZE];
+  static uint8_t predictions[TRACE_BLOCK_SIZE];
+  size_t count;
+
+  if (interval) {
+    printf("branch,predictor,incorrect,misp_rate\n");
+  }
+
+  // Read the trace a block of branches at a time and run every
+  // predictor over each block while it is hot in cache
+  while ((trace || counters) && (count = read_block(trace, pcs, outcomes))) {
+    // Split the block where the warm-up or an interval ends, so that each
+    // piece counts towards a single interval and one side of the warm-up
+    for (size_t start = 0; start < count; ) {
+      size_t n = count - start;
+      if (num_branches < warmup && warmup - num_branches < n) {
+        n = warmup - num_branches;
+      }
+      if (interval && interval - interval_branches < n) {
+        n = interval - interval_branches;
+      }
+      uint8_t *piece_predictions = verbose ? predictions + start : NULL;
+
+      if (prof) {
+        block_mispredictions[0] = profile_run(prof, predictors[0], pcs + start,
+                                              outcomes + start, piece_predictions, n);
+      } else if (verbose) {
+        block_mispredictions[0] = predictor_run(predictors[0], pcs + start,
+                                                outcomes + start, piece_predictions, n);
+      } else if (counters) {
+        for (int k = 0; k < num_simulated; k++) {
+          block_mispredictions[k] = run_split(predictors[k], shadows[k], pcs + start,
+                                              outcomes + start, n, &both_totals[k],
+                                              &predict_totals[k]);
+        }
+      } else {
+        // Predictors of one type and different widths share a pass
+        predictor_run_many(predictors, num_simulated, pcs + start, outcomes + start,
+                           n, block_mispredictions);
+      }
+      for (int k = 0; k < num_simulated; k++) {
+        interval_mispredictions[simulated[k]] += block_mispredictions[k];
+        if (num_branches >= warmup) {
+          mispredictions[simulated[k]] += block_mispredictions[k];
+        }
+      }
+      num_branches += n;
+      interval_branches += n;
+      start += n;
+
+      if (interval_branches == interval) {
+        print_interval(names, interval_mispredictions, num_branches, interval_branches);
+        interval_branches = 0;
+      }
     }
     if (verbose != 0) {
-      printf ("0x%x    %d\n", pc, prediction);
+      for (size_t i = 0; i < count; i++) {
+        printf ("0x%x    %d\n", pcs[i], predictions[i]);
+      }
+    }
+  }
+
+  // The last interval may be short
+  if (interval && interval_branches) {
+    print_interval(names, interval_mispredictions, num_branches, interval_branches);
+  }
+
+  // Print out the mispredict statistics, to stderr if stdout has the
+  // interval stream
+  FILE *out = interval ? stderr : stdout;
+  uint64_t measured = num_branches > warmup ? num_branches - warmup : 0;
+  print_csv_header(out);
+  for (int j = 0; j < num_configs; j++) {
+    float mispredict_rate = measured ? 100*((float)mispredictions[j] / (float)measured) : 0;
+    print_summary(out, j, num_branches - measured, measured, mispredictions[j],
+                  mispredict_rate);
+  }
+
+#ifdef INSTRUMENT
+  // Instrumented builds report the pattern tables' aliasing after that,
+  // on stderr if stdout is CSV
+  for (int k = 0; k < num_simulated; k++) {
+    FILE *out = csv || interval ? stderr : stdout;
+    fprintf(out, "\nAliasing in %s:\n", names[simulated[k]]);
+    if (!predictor_report_aliasing(predictors[k], out)) {
+      fprintf(out, "  (not instrumented)\n");
+    }
+  }
+#endif
+
+  // So do the performance counters
+  if (counters) {
+    report_perf(csv || interval ? stderr : stdout, names, simulated, num_simulated,
+                num_branches, both_totals, predict_totals);
+    for (int k = 0; k < num_simulated; k++) {
+      predictor_destroy(shadows[k]);
+    }
+    free(shadows);
+    free(both_totals);
+    free(predict_totals);
+    perf_close(counters);
+    trace_buffer_free(&perf_trace);
+  }
+
+  // The profile table follows the summary, on stderr if stdout is CSV
+  if (prof) {
+    if (profile_top) {
+      profile_report(prof, csv || interval ? stderr : stdout, profile_top);
     }
+    if (profile_csv) {
+      FILE *f = fopen(profile_csv, "w");
+      if (!f) {
+        perror(profile_csv);
+        exit(1);
+      }
+      profile_write_csv(prof, f);
+      fclose(f);
+    }
+    profile_destroy(prof);
+  }
 
-    // Train the predictor
-    train_predictor(pc, outcome);
+  if (save_state && predictor_save(predictors[0], save_state) != 0) {
+    perror(save_state);
+    exit(1);
   }
 
-  // Print out the mispredict statistics
-  printf("Branches:        %10d\n", num_branches);
-  printf("Incorrect:       %10d\n", mispredictions);
-  float mispredict_rate = 100*((float)mispredictions / (float)num_branches);
-  printf("Misprediction Rate: %7.3f\n", mispredict_rate);
+  if (cache) {
+    for (int k = 0; k < num_simulated; k++) {
+      cache_store(cache, digest, &configs[simulated[k]], num_branches,
+                  mispredictions[simulated[k]]);
+    }
+    cache_close(cache);
+  }
 
   // Cleanup
-  cleanup_predictor();
-  fclose(stream);
-  free(buf);
+  for (int k = 0; k < num_simulated; k++) {
+    predictor_destroy(predictors[k]);
+  }
+  free(predictors);
+  free(simulated);
+  free(mispredictions);
+  free(interval_mispredictions);
+  free(block_mispredictions);
+  free(names);
+  free(configs);
+  if (trace) {
+    trace_close(trace);
+  }
 
   return 0;
 }
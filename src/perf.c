@@ -0,0 +1,185 @@
+//========================================================//
+//  perf.c                                                //
+//  Source file for hardware performance counters         //
+//                                                        //
+//  One perf_event_open counter per event, read at the    //
+//  start and end of each interval                        //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "perf.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+typedef struct {
+  const char *name;         // Column heading
+  uint32_t type;
+  uint64_t config;
+} perf_event;
+
+#ifdef __linux__
+#define CACHE_EVENT(cache, result) \
+  ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | ((result) << 16))
+
+static const perf_event events[PERF_EVENTS] = {
+  { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "L1d-misses", PERF_TYPE_HW_CACHE,
+    CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+  { "LLC-misses", PERF_TYPE_HW_CACHE,
+    CACHE_EVENT(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_RESULT_MISS) },
+  { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  { "cpu-ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+};
+#else
+static const perf_event events[PERF_EVENTS] = {
+  { "cycles" }, { "instructions" }, { "L1d-misses" }, { "LLC-misses" },
+  { "branch-misses" }, { "cpu-ns" },
+};
+#endif
+
+struct perf_counters {
+  int fds[PERF_EVENTS];     // -1 for events not counted
+  int error;                // errno from the first hardware event refused
+  int inherit;              // Also counting the threads started since
+  double start[PERF_EVENTS];
+};
+
+static int
+open_event(const perf_event *event, int inherit)
+{
+#ifdef __linux__
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = event->type;
+  attr.config = event->config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.inherit = inherit;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+#else
+  (void)inherit;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+perf_counters *
+perf_open(int inherit)
+{
+  perf_counters *c = calloc(1, sizeof(perf_counters));
+  c->inherit = inherit;
+  for (int e = 0; e < PERF_EVENTS; e++) {
+    c->fds[e] = open_event(&events[e], inherit);
+    if (c->fds[e] < 0 && e != PERF_TIME && !c->error) {
+      c->error = errno;
+    }
+  }
+  return c;
+}
+
+int
+perf_available(perf_counters *c, int event)
+{
+  return event == PERF_TIME || c->fds[event] >= 0;
+}
+
+const char *
+perf_unavailable(perf_counters *c)
+{
+  return c->error ? strerror(c->error) : NULL;
+}
+
+// Read every event's count so far, scaled up for the time it was
+// multiplexed off the hardware
+//
+static void
+read_counts(perf_counters *c, double *counts)
+{
+  for (int e = 0; e < PERF_EVENTS; e++) {
+    uint64_t value[3];
+    if (c->fds[e] >= 0 && read(c->fds[e], value, sizeof(value)) == sizeof(value)) {
+      counts[e] = value[2] ? (double)value[0] * value[1] / value[2] : 0;
+    } else if (e == PERF_TIME) {
+      struct timespec ts;
+      clock_gettime(c->inherit ? CLOCK_PROCESS_CPUTIME_ID : CLOCK_THREAD_CPUTIME_ID,
+                    &ts);
+      counts[e] = ts.tv_sec * 1e9 + ts.tv_nsec;
+    } else {
+      counts[e] = 0;
+    }
+  }
+}
+
+void
+perf_begin(perf_counters *c)
+{
+  read_counts(c, c->start);
+}
+
+void
+perf_end(perf_counters *c, perf_totals *totals)
+{
+  double end[PERF_EVENTS];
+  read_counts(c, end);
+  for (int e = 0; e < PERF_EVENTS; e++) {
+    totals->counts[e] += end[e] - c->start[e];
+  }
+}
+
+void
+perf_print_header(perf_counters *c, FILE *out)
+{
+  fprintf(out, "%-8s %-24s %12s", "Phase", "Predictor", "Branches");
+  for (int e = 0; e < PERF_EVENTS; e++) {
+    if (perf_available(c, e)) {
+      fprintf(out, " %14s", events[e].name);
+    }
+  }
+  if (perf_available(c, PERF_CYCLES) && perf_available(c, PERF_INSTRUCTIONS)) {
+    fprintf(out, " %6s", "IPC");
+  }
+  fprintf(out, "\n");
+}
+
+void
+perf_print_row(perf_counters *c, FILE *out, const char *phase,
+               const char *name, const perf_totals *totals,
+               uint64_t branches, int per_branch)
+{
+  double scale = per_branch && branches ? 1.0 / branches : 1.0;
+  fprintf(out, "%-8s %-24s %12llu", phase, name, (unsigned long long)branches);
+  for (int e = 0; e < PERF_EVENTS; e++) {
+    if (perf_available(c, e)) {
+      // Phases found by subtraction can come out slightly negative
+      double count = totals->counts[e] > 0 ? totals->counts[e] * scale : 0;
+      fprintf(out, per_branch ? " %14.3f" : " %14.0f", count);
+    }
+  }
+  if (perf_available(c, PERF_CYCLES) && perf_available(c, PERF_INSTRUCTIONS)) {
+    double cycles = totals->counts[PERF_CYCLES];
+    fprintf(out, " %6.2f", cycles > 0 ? totals->counts[PERF_INSTRUCTIONS] / cycles : 0);
+  }
+  fprintf(out, "\n");
+}
+
+void
+perf_close(perf_counters *c)
+{
+  for (int e = 0; e < PERF_EVENTS; e++) {
+    if (c->fds[e] >= 0) {
+      close(c->fds[e]);
+    }
+  }
+  free(c);
+}
@@ -0,0 +1,74 @@
+//========================================================//
+//  perf.h                                                //
+//  Header file for hardware performance counters         //
+//                                                        //
+//  Counts the simulator's own cycles, instructions and   //
+//  misses in each phase with perf_event_open             //
+//========================================================//
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Events counted, in user space only.  PERF_TIME is the thread's CPU
+// time in ns, and is the one event that is always available.
+enum {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_BRANCH_MISSES,
+  PERF_TIME,
+  PERF_EVENTS
+};
+
+typedef struct perf_counters perf_counters;
+
+// Counts accumulated over the intervals of one phase
+typedef struct {
+  double counts[PERF_EVENTS];
+} perf_totals;
+
+//------------------------------------//
+//      Perf Function Prototypes      //
+//------------------------------------//
+
+// Open a counter for each event on the calling thread, and with
+// 'inherit' set also on every thread it starts from then on.  Events the
+// kernel or the hardware does not allow are left out.
+//
+perf_counters *perf_open(int inherit);
+
+// Returns True if 'event' is being counted
+//
+int perf_available(perf_counters *c, int event);
+
+// Returns why the hardware events could not be counted, or NULL if all
+// of them are
+//
+const char *perf_unavailable(perf_counters *c);
+
+// Start an interval
+//
+void perf_begin(perf_counters *c);
+
+// End the interval started by perf_begin and add its counts to 'totals'
+//
+void perf_end(perf_counters *c, perf_totals *totals);
+
+// Print a header for perf_print_row
+//
+void perf_print_header(perf_counters *c, FILE *out);
+
+// Print one row of 'totals' over 'branches' branches: the totals, or
+// their averages per branch if 'per_branch' is set
+//
+void perf_print_row(perf_counters *c, FILE *out, const char *phase,
+                    const char *name, const perf_totals *totals,
+                    uint64_t branches, int per_branch);
+
+void perf_close(perf_counters *c);
+
+#endif
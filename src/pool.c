@@ -0,0 +1,230 @@
+//========================================================//
+//  pool.c                                                //
+//  Source file for the work-stealing thread pool         //
+//                                                        //
+//  Each worker owns a deque: it pops its newest job and  //
+//  idle workers steal the oldest job of a busy one       //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pool.h"
+
+typedef struct {
+  pool_fn fn;
+  void *arg;
+} job;
+
+typedef struct {
+  pthread_mutex_t lock;
+  job *jobs;
+  size_t head;          // Oldest job, taken by thieves
+  size_t tail;          // One past the newest job, taken by the owner
+  size_t capacity;
+} deque;
+
+struct pool {
+  int threads;
+  pthread_t *workers;
+  deque *deques;
+  size_t next;          // Deque the next submitted job goes to
+
+  pthread_mutex_t lock;
+  pthread_cond_t work;  // Signalled when jobs are queued or on shutdown
+  pthread_cond_t idle;  // Signalled when 'pending' drops to zero
+  size_t pending;       // Jobs submitted but not yet finished
+  int shutdown;
+};
+
+typedef struct {
+  pool *p;
+  int id;
+} worker_arg;
+
+static void
+deque_push(deque *d, job j)
+{
+  pthread_mutex_lock(&d->lock);
+  if (d->tail == d->capacity) {
+    // Compact before growing so a long-lived deque stays small
+    size_t live = d->tail - d->head;
+    if (d->head > 0) {
+      for (size_t i = 0; i < live; i++) {
+        d->jobs[i] = d->jobs[d->head + i];
+      }
+      d->head = 0;
+      d->tail = live;
+    }
+    if (d->tail == d->capacity) {
+      d->capacity = d->capacity ? 2 * d->capacity : 64;
+      d->jobs = realloc(d->jobs, d->capacity * sizeof(job));
+    }
+  }
+  d->jobs[d->tail++] = j;
+  pthread_mutex_unlock(&d->lock);
+}
+
+// Take the newest job (owner) or the oldest one (thief)
+//
+// Returns True if a job was taken
+//
+static int
+deque_take(deque *d, int steal, job *out)
+{
+  int found = 0;
+  pthread_mutex_lock(&d->lock);
+  if (d->head < d->tail) {
+    *out = steal ? d->jobs[d->head++] : d->jobs[--d->tail];
+    found = 1;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return found;
+}
+
+// Find a job: first in the worker's own deque, then in the others
+//
+static int
+find_job(pool *p, int id, job *out)
+{
+  if (deque_take(&p->deques[id], 0, out)) {
+    return 1;
+  }
+  for (int k = 1; k < p->threads; k++) {
+    if (deque_take(&p->deques[(id + k) % p->threads], 1, out)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void
+run_job(pool *p, job *j)
+{
+  j->fn(j->arg);
+
+  pthread_mutex_lock(&p->lock);
+  if (--p->pending == 0) {
+    pthread_cond_broadcast(&p->idle);
+  }
+  pthread_mutex_unlock(&p->lock);
+}
+
+static void *
+worker_main(void *arg)
+{
+  worker_arg *w = arg;
+  pool *p = w->p;
+  int id = w->id;
+  free(w);
+
+  for (;;) {
+    job j;
+    if (!find_job(p, id, &j)) {
+      // Jobs are queued before 'work' is signalled under the pool lock,
+      // so checking again while holding it cannot miss a wakeup
+      pthread_mutex_lock(&p->lock);
+      int found = 0;
+      while (!p->shutdown && !(found = find_job(p, id, &j))) {
+        pthread_cond_wait(&p->work, &p->lock);
+      }
+      pthread_mutex_unlock(&p->lock);
+      if (!found) {
+        break;
+      }
+    }
+    run_job(p, &j);
+  }
+
+  return NULL;
+}
+
+pool *
+pool_create(int threads)
+{
+  if (threads <= 0) {
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) {
+      threads = 1;
+    }
+  }
+
+  pool *p = calloc(1, sizeof(pool));
+  p->threads = threads;
+  p->workers = calloc(threads, sizeof(pthread_t));
+  p->deques = calloc(threads, sizeof(deque));
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->work, NULL);
+  pthread_cond_init(&p->idle, NULL);
+
+  for (int i = 0; i < threads; i++) {
+    pthread_mutex_init(&p->deques[i].lock, NULL);
+  }
+  for (int i = 0; i < threads; i++) {
+    worker_arg *w = malloc(sizeof(worker_arg));
+    w->p = p;
+    w->id = i;
+    pthread_create(&p->workers[i], NULL, worker_main, w);
+  }
+
+  return p;
+}
+
+int
+pool_threads(pool *p)
+{
+  return p->threads;
+}
+
+void
+pool_submit(pool *p, pool_fn fn, void *arg)
+{
+  job j = { fn, arg };
+
+  pthread_mutex_lock(&p->lock);
+  p->pending++;
+  int target = p->next++ % p->threads;
+  pthread_mutex_unlock(&p->lock);
+
+  deque_push(&p->deques[target], j);
+
+  pthread_mutex_lock(&p->lock);
+  pthread_cond_broadcast(&p->work);
+  pthread_mutex_unlock(&p->lock);
+}
+
+void
+pool_wait(pool *p)
+{
+  pthread_mutex_lock(&p->lock);
+  while (p->pending > 0) {
+    pthread_cond_wait(&p->idle, &p->lock);
+  }
+  pthread_mutex_unlock(&p->lock);
+}
+
+void
+pool_destroy(pool *p)
+{
+  pool_wait(p);
+
+  pthread_mutex_lock(&p->lock);
+  p->shutdown = 1;
+  pthread_cond_broadcast(&p->work);
+  pthread_mutex_unlock(&p->lock);
+
+  for (int i = 0; i < p->threads; i++) {
+    pthread_join(p->workers[i], NULL);
+  }
+  for (int i = 0; i < p->threads; i++) {
+    pthread_mutex_destroy(&p->deques[i].lock);
+    free(p->deques[i].jobs);
+  }
+  pthread_mutex_destroy(&p->lock);
+  pthread_cond_destroy(&p->work);
+  pthread_cond_destroy(&p->idle);
+  free(p->deques);
+  free(p->workers);
+  free(p);
+}
@@ -0,0 +1,38 @@
+//========================================================//
+//  pool.h                                                //
+//  Header file for the work-stealing thread pool         //
+//                                                        //
+//  Used by the sweep tools to run independent jobs on    //
+//  every core                                            //
+//========================================================//
+
+#ifndef POOL_H
+#define POOL_H
+
+typedef struct pool pool;
+
+// A unit of work; 'arg' is passed back unchanged
+typedef void (*pool_fn)(void *arg);
+
+// Start a pool with 'threads' workers (0 picks one per online CPU)
+//
+pool *pool_create(int threads);
+
+// Number of worker threads in the pool
+//
+int pool_threads(pool *p);
+
+// Queue a job.  Jobs are spread over the workers' deques; a worker that
+// runs out of work steals from the others
+//
+void pool_submit(pool *p, pool_fn fn, void *arg);
+
+// Block until every submitted job has finished
+//
+void pool_wait(pool *p);
+
+// Wait for outstanding jobs and stop the workers
+//
+void pool_destroy(pool *p);
+
+#endif
@@ -5,10 +5,26 @@
 //  Implement the various branch predictors below as      //
 //  described in the README                               //
 //========================================================//
+#define _GNU_SOURCE
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSSE3__
+#include <immintrin.h>
+#endif
+#include "counter.h"
 #include "predictor.h"
+#ifdef INSTRUMENT
+#include "alias.h"
+#endif
 
 const char *studentName = "Qi Ling";
 const char *studentID   = "037771523";
@@ -19,13 +35,16 @@ const char *email       = "ling102@purdue.edu";
 //------------------------------------//
 
 // Handy Global for use in output routines
-const char *bpName[5] = { "Static", "Gshare",
-                          "Tournament", "Custom", "Bimodal" };
+const char *bpName[7] = { "Static", "Gshare",
+                          "Tournament", "Custom", "Bimodal", "Perceptron",
+                          "TAGE" };
 
 int ghistoryBits; // Number of bits used for Global History
 int lhistoryBits; // Number of bits used for Local History
 int bhistoryBits; // Number of bits used for Bimodal History
 int pcIndexBits;  // Number of bits used for PC index
+int numPerceptrons;      // Number of perceptrons (weight rows)
+int perceptronThreshold; // Training threshold for the perceptrons
 int bpType;       // Branch Prediction Type
 int verbose;
 
@@ -35,489 +54,2088 @@ int verbose;
 
 #define false 0
 #define true 1
+
+// How many branches ahead the block loops prefetch table entries, and the
+// smallest table (in counters, 256KB here) worth prefetching: below that
+// the table stays in cache and the prefetches only add work
+#define PREFETCH_DISTANCE 16
+#define PREFETCH_MIN_COUNTERS (1u << 20)
+
+// Aliasing instrumentation of the pattern tables, built with
+// 'make INSTRUMENT=1'.  Otherwise the tables carry no statistics and the
+// hooks expand to nothing.
+#ifdef INSTRUMENT
+#define ALIAS_TABLE(name) alias_table *name;
+#define ALIAS_CREATE(a, table, init) ((a) = alias_create(table, init))
+#define ALIAS_RECORD(a, index, key, prediction, outcome) \
+    alias_record(a, index, key, prediction, outcome)
+#define ALIAS_DESTROY(a) alias_destroy(a)
+#else
+#define ALIAS_TABLE(name)
+#define ALIAS_CREATE(a, table, init) ((void)0)
+#define ALIAS_RECORD(a, index, key, prediction, outcome) ((void)0)
+#define ALIAS_DESTROY(a) ((void)0)
+#endif
 #define ST 3 // Strongly Taken (11)
 #define WT 2 // Weakly Taken (10)
 #define WN 1 // Weakly Not Taken (01)
 #define SN 0 // Strongly Not Taken (00)
 
 // bimodal branch predictor with 2-bit saturation counters
-uint8_t *bht_bimodal;                   // Branch History Table (2-bit counters)
-uint32_t bht_size_bimodal;              // Size of the Branch History Table
+typedef struct {
+    counter_table bht;                  // Branch History Table (packed 2-bit counters)
+    ALIAS_TABLE(bht_alias)
+} bimodal_predictor;
+
 void
-init_bimodal()
+init_bimodal(bimodal_predictor *bp, int historyBits)
 {
-    bht_size_bimodal = 1 << bhistoryBits;      // Calculate the size of the BHT as 2^bhistoryBits
-    bht_bimodal = (uint8_t *)malloc(bht_size_bimodal * sizeof(uint8_t));
-
-    // Initialize all counters in the BHT to Weakly Taken (10)
-    for (uint32_t i = 0; i < bht_size_bimodal; i++) {
-        bht_bimodal[i] = WN;
-    }
+    // Size the BHT as 2^bhistoryBits, all counters Weakly Not Taken (01)
+    counter_table_init(&bp->bht, 1 << historyBits, WN);
+    ALIAS_CREATE(bp->bht_alias, &bp->bht, WN);
 }
 
 uint8_t
-predict_bimodal(uint32_t pc)
+predict_bimodal(bimodal_predictor *bp, uint32_t pc)
 {
-    uint32_t index = pc & (bht_size_bimodal - 1); // Use the lower bits of PC to index into the BHT
-    uint8_t counter = bht_bimodal[index];
+    uint32_t index = pc & (bp->bht.size - 1); // Use the lower bits of PC to index into the BHT
 
     // Predict taken if the counter is in state WT or ST
-    return (counter >= WT) ? 1 : 0; // 1 for taken, 0 for not taken
+    return counter_taken(&bp->bht, index);
 }
 
-void
-train_bimodal(uint32_t pc, uint8_t outcome)
+// Predict and train in one step, indexing the BHT once
+uint8_t
+predict_and_update_bimodal(bimodal_predictor *bp, uint32_t pc, uint8_t outcome)
 {
-    uint32_t index = pc & (bht_size_bimodal - 1); // Use the lower bits of PC to index into the BHT
-    uint8_t counter = bht_bimodal[index];
+    uint32_t index = pc & (bp->bht.size - 1); // Use the lower bits of PC to index into the BHT
 
     // Update the 2-bit saturating counter based on the actual outcome
-    if (outcome == 1) { // If the actual outcome is taken
-        if (counter < ST) {
-            bht_bimodal[index]++; // Increment the counter towards Strongly Taken (ST)
+    uint8_t prediction = counter_predict_update(&bp->bht, index, outcome);
+    ALIAS_RECORD(bp->bht_alias, index, ALIAS_KEY(pc, 0), prediction, outcome);
+    return prediction;
+}
+
+void
+train_bimodal(bimodal_predictor *bp, uint32_t pc, uint8_t outcome)
+{
+    predict_and_update_bimodal(bp, pc, outcome);
+}
+
+// Simulate a block of branches.  A branch's BHT index depends only on its
+// PC, so for large tables the counter of the branch PREFETCH_DISTANCE
+// ahead is prefetched while the current one is updated.  The table is
+// held in a local so that stores to 'predictions' cannot force it to be
+// reloaded.
+static uint32_t
+run_bimodal(bimodal_predictor *bp, const uint32_t *pcs, const uint8_t *outcomes,
+            uint8_t *predictions, size_t count)
+{
+    counter_table bht = bp->bht;
+    uint32_t mask = bht.size - 1;
+    uint32_t mispredictions = 0;
+    size_t prefetch_end = bht.size >= PREFETCH_MIN_COUNTERS ? count : 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (i + PREFETCH_DISTANCE < prefetch_end) {
+            counter_prefetch(&bht, pcs[i + PREFETCH_DISTANCE] & mask);
         }
-    } else { // If the actual outcome is not taken
-        if (counter > SN) {
-            bht_bimodal[index]--; // Decrement the counter towards Strongly Not Taken (SN)
+        uint8_t prediction = counter_predict_update(&bht, pcs[i] & mask, outcomes[i]);
+        ALIAS_RECORD(bp->bht_alias, pcs[i] & mask, ALIAS_KEY(pcs[i], 0), prediction, outcomes[i]);
+        mispredictions += prediction != outcomes[i];
+        if (predictions) {
+            predictions[i] = prediction;
         }
     }
+    return mispredictions;
 }
 
 void
-cleanup_bimodal()
+cleanup_bimodal(bimodal_predictor *bp)
 {
-    assert(bht_bimodal != NULL);
-    free(bht_bimodal);
-    bht_bimodal = NULL;
+    assert(bp->bht.words != NULL);
+    counter_table_free(&bp->bht);
+    ALIAS_DESTROY(bp->bht_alias);
 }
 
 // Gshare branch predictor with 2-bit saturation counters
-uint8_t *bht_gshare;            // Branch History Table (2-bit counters) for Gshare
-uint32_t bht_size_gshare;       // Size of the Branch History Table for Gshare
-uint32_t ghr_gshare = 0;        // Global History Register for Gshare
+typedef struct {
+    counter_table bht;          // Branch History Table (packed 2-bit counters) for Gshare
+    uint32_t ghr;               // Global History Register for Gshare
+    int historyBits;            // Length of the Global History
+    ALIAS_TABLE(bht_alias)
+} gshare_predictor;
 
 void
-init_gshare()
+init_gshare(gshare_predictor *gp, int historyBits)
 {
-    bht_size_gshare = 1 << ghistoryBits;     // Calculate the size of the BHT as 2^ghistoryBits
-    bht_gshare = (uint8_t *)malloc(bht_size_gshare * sizeof(uint8_t));
+    gp->historyBits = historyBits;
 
-    // Initialize all counters in the BHT to Weakly Taken (10)
-    for (uint32_t i = 0; i < bht_size_gshare; i++) {
-        bht_gshare[i] = WN;
-    }
+    // Size the BHT as 2^ghistoryBits, all counters Weakly Not Taken (01)
+    counter_table_init(&gp->bht, 1 << historyBits, WN);
+    ALIAS_CREATE(gp->bht_alias, &gp->bht, WN);
 
     // Initialize the GHR to zero
-    ghr_gshare = 0;
+    gp->ghr = 0;
 }
 
 uint8_t
-predict_gshare(uint32_t pc)
+predict_gshare(gshare_predictor *gp, uint32_t pc)
 {
     // XOR the global history register with the lower bits of the PC
-    uint32_t index = (pc ^ (ghr_gshare)) & (bht_size_gshare - 1);  // Ensure we index within the BHT bounds
-    uint8_t counter = bht_gshare[index];
+    uint32_t index = (pc ^ (gp->ghr)) & (gp->bht.size - 1);  // Ensure we index within the BHT bounds
 
     // Predict taken if the counter is in state WT or ST
-    return (counter >= WT) ? 1 : 0; // 1 for taken, 0 for not taken
+    return counter_taken(&gp->bht, index);
 }
 
-void
-train_gshare(uint32_t pc, uint8_t outcome)
+// Predict and train in one step, indexing the BHT once
+uint8_t
+predict_and_update_gshare(gshare_predictor *gp, uint32_t pc, uint8_t outcome)
 {
     // XOR the global history register with the lower bits of the PC
-    uint32_t index = (pc ^ (ghr_gshare)) & (bht_size_gshare - 1);  // Ensure we index within the BHT bounds
-    uint8_t counter = bht_gshare[index];
+    uint32_t index = (pc ^ (gp->ghr)) & (gp->bht.size - 1);  // Ensure we index within the BHT bounds
 
     // Update the 2-bit saturating counter based on the actual outcome
-    if (outcome == 1) { // If the actual outcome is taken
-        if (counter < ST) {
-            bht_gshare[index]++; // Increment the counter towards Strongly Taken (ST)
-        }
-    } else { // If the actual outcome is not taken
-        if (counter > SN) {
-            bht_gshare[index]--; // Decrement the counter towards Strongly Not Taken (SN)
-        }
-    }
+    uint8_t prediction = counter_predict_update(&gp->bht, index, outcome);
+    ALIAS_RECORD(gp->bht_alias, index, ALIAS_KEY(pc, gp->ghr), prediction, outcome);
 
     // Update the Global History Register (shift left and add the new outcome)
-    ghr_gshare = ((ghr_gshare << 1) | outcome) & ((1 << ghistoryBits) - 1);  // Keep only ghistoryBits bits
+    gp->ghr = ((gp->ghr << 1) | outcome) & ((1 << gp->historyBits) - 1);  // Keep only ghistoryBits bits
+    return prediction;
 }
 
 void
-cleanup_gshare()
+train_gshare(gshare_predictor *gp, uint32_t pc, uint8_t outcome)
 {
-    assert(bht_gshare != NULL);
-    free(bht_gshare);
-    bht_gshare = NULL;
+    predict_and_update_gshare(gp, pc, outcome);
 }
 
-// Gshare branch predictor with 2-bit saturation counters
-uint8_t *bht_gshare2;            // Branch History Table (2-bit counters) for Gshare
-uint32_t bht_size_gshare2;       // Size of the Branch History Table for Gshare
-uint32_t ghr_gshare2 = 0;        // Global History Register for Gshare
+// Simulate a block of branches.  The outcomes of the branches in between
+// are in the block, so the GHR a branch PREFETCH_DISTANCE ahead will see
+// is known and, for large tables, its counter can be prefetched.
+static uint32_t
+run_gshare(gshare_predictor *gp, const uint32_t *pcs, const uint8_t *outcomes,
+           uint8_t *predictions, size_t count)
+{
+    counter_table bht = gp->bht;
+    uint32_t mask = bht.size - 1;
+    uint32_t ghr = gp->ghr;
+    uint32_t mispredictions = 0;
+    size_t prefetch_end = bht.size >= PREFETCH_MIN_COUNTERS ? count : 0;
+
+    // GHR as of branch i + PREFETCH_DISTANCE
+    uint32_t ahead = ghr;
+    for (size_t i = 0; i < PREFETCH_DISTANCE && i < count; i++) {
+        ahead = ((ahead << 1) | outcomes[i]) & mask;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (i + PREFETCH_DISTANCE < prefetch_end) {
+            counter_prefetch(&bht, (pcs[i + PREFETCH_DISTANCE] ^ ahead) & mask);
+            ahead = ((ahead << 1) | outcomes[i + PREFETCH_DISTANCE]) & mask;
+        }
+        uint8_t prediction = counter_predict_update(&bht, (pcs[i] ^ ghr) & mask, outcomes[i]);
+        ALIAS_RECORD(gp->bht_alias, (pcs[i] ^ ghr) & mask, ALIAS_KEY(pcs[i], ghr),
+                     prediction, outcomes[i]);
+        ghr = ((ghr << 1) | outcomes[i]) & mask;
+        mispredictions += prediction != outcomes[i];
+        if (predictions) {
+            predictions[i] = prediction;
+        }
+    }
+    gp->ghr = ghr;
+    return mispredictions;
+}
 
 void
-init_gshare2()
+cleanup_gshare(gshare_predictor *gp)
 {
-    bht_size_gshare2 = 1 << 12;     // Calculate the size of the BHT as 2^ghistoryBits
-    bht_gshare2 = (uint8_t *)malloc(bht_size_gshare2 * sizeof(uint8_t));
+    assert(gp->bht.words != NULL);
+    counter_table_free(&gp->bht);
+    ALIAS_DESTROY(gp->bht_alias);
+}
 
-    // Initialize all counters in the BHT to Weakly Taken (10)
-    for (uint32_t i = 0; i < bht_size_gshare2; i++) {
-        bht_gshare2[i] = WN;
-    }
+// Gshare branch predictor with 2-bit saturation counters, with the fixed
+// 2^12-entry geometry the hybrid uses so its index mask is a constant
+#define GSHARE2_MASK ((1u << 12) - 1)
+
+typedef struct {
+    counter_table bht;          // Branch History Table (packed 2-bit counters) for Gshare
+    uint32_t ghr;               // Global History Register for Gshare
+    ALIAS_TABLE(bht_alias)
+} gshare2_predictor;
+
+void
+init_gshare2(gshare2_predictor *gp)
+{
+    // Size the BHT as 2^12, all counters Weakly Not Taken (01)
+    counter_table_init(&gp->bht, GSHARE2_MASK + 1, WN);
+    ALIAS_CREATE(gp->bht_alias, &gp->bht, WN);
 
     // Initialize the GHR to zero
-    ghr_gshare2 = 0;
+    gp->ghr = 0;
 }
 
 uint8_t
-predict_gshare2(uint32_t pc)
+predict_gshare2(gshare2_predictor *gp, uint32_t pc)
 {
     // XOR the global history register with the lower bits of the PC
-    uint32_t index = (pc ^ (ghr_gshare2 << 9)) & (bht_size_gshare2 - 1);  // Ensure we index within the BHT bounds
-    uint8_t counter = bht_gshare2[index];
+    uint32_t index = (pc ^ (gp->ghr << 9)) & GSHARE2_MASK;  // Ensure we index within the BHT bounds
 
     // Predict taken if the counter is in state WT or ST
-    return (counter >= WT) ? 1 : 0; // 1 for taken, 0 for not taken
+    return counter_taken(&gp->bht, index);
 }
 
-void
-train_gshare2(uint32_t pc, uint8_t outcome)
+// Predict and train in one step, indexing the BHT once
+uint8_t
+predict_and_update_gshare2(gshare2_predictor *gp, uint32_t pc, uint8_t outcome)
 {
     // XOR the global history register with the lower bits of the PC
-    uint32_t index = (pc ^ (ghr_gshare2 << 9)) & (bht_size_gshare2 - 1);  // Ensure we index within the BHT bounds
-    uint8_t counter = bht_gshare2[index];
+    uint32_t index = (pc ^ (gp->ghr << 9)) & GSHARE2_MASK;  // Ensure we index within the BHT bounds
 
     // Update the 2-bit saturating counter based on the actual outcome
-    if (outcome == 1) { // If the actual outcome is taken
-        if (counter < ST) {
-            bht_gshare2[index]++; // Increment the counter towards Strongly Taken (ST)
-        }
-    } else { // If the actual outcome is not taken
-        if (counter > SN) {
-            bht_gshare2[index]--; // Decrement the counter towards Strongly Not Taken (SN)
-        }
-    }
+    uint8_t prediction = counter_predict_update(&gp->bht, index, outcome);
+    ALIAS_RECORD(gp->bht_alias, index, ALIAS_KEY(pc, gp->ghr), prediction, outcome);
 
     // Update the Global History Register (shift left and add the new outcome)
-    ghr_gshare2 = ((ghr_gshare2 << 1) | outcome) & (bht_size_gshare2 - 1);  // Keep only ghistoryBits bits
+    gp->ghr = ((gp->ghr << 1) | outcome) & GSHARE2_MASK;  // Keep only ghistoryBits bits
+    return prediction;
 }
 
 void
-cleanup_gshare2()
+train_gshare2(gshare2_predictor *gp, uint32_t pc, uint8_t outcome)
 {
-    assert(bht_gshare2 != NULL);
-    free(bht_gshare2);
-    bht_gshare2 = NULL;
+    predict_and_update_gshare2(gp, pc, outcome);
 }
 
-// tournament branch predictor with 2-bit saturation counters
-uint8_t *global_pht_tournament;  // Global Pattern History Table (PHT) for tournament
-uint8_t *local_pht_tournament;   // Local Pattern History Table (PHT) for tournament
-uint32_t *lht_tournament;        // Local History Table (LHT) for tournament
-uint8_t *choice_pht_tournament;  // Choice predictor to choose between global and local
-uint32_t ghr_tournament;         // Global History Register for tournament
-
-// Sizes for the tables
-uint32_t global_pht_size_tournament;
-uint32_t local_pht_size_tournament;
-uint32_t lht_size_tournament;
-uint32_t choice_pht_size_tournament;
-
 void
-init_tournament()
+cleanup_gshare2(gshare2_predictor *gp)
 {
-    // Initialize sizes for the tables based on the configuration parameters
-    global_pht_size_tournament = 1 << ghistoryBits;
-    local_pht_size_tournament = 1 << lhistoryBits;
-    lht_size_tournament = 1 << pcIndexBits;
-    choice_pht_size_tournament = 1 << ghistoryBits;
+    assert(gp->bht.words != NULL);
+    counter_table_free(&gp->bht);
+    ALIAS_DESTROY(gp->bht_alias);
+}
 
-    // Allocate memory for the tables
-    global_pht_tournament = (uint8_t *)malloc(global_pht_size_tournament * sizeof(uint8_t));
-    local_pht_tournament = (uint8_t *)malloc(local_pht_size_tournament * sizeof(uint8_t));
-    lht_tournament = (uint32_t *)malloc(lht_size_tournament * sizeof(uint32_t));
-    choice_pht_tournament = (uint8_t *)malloc(choice_pht_size_tournament * sizeof(uint8_t));
+// tournament branch predictor with 2-bit saturation counters
+typedef struct {
+    counter_table global_pht;   // Global Pattern History Table (PHT) for tournament
+    counter_table local_pht;    // Local Pattern History Table (PHT) for tournament
+    uint32_t *lht;              // Local History Table (LHT) for tournament
+    counter_table choice_pht;   // Choice predictor to choose between global and local
+    uint32_t ghr;               // Global History Register for tournament
+
+    int ghistoryBits;
+    int lhistoryBits;
+    int pcIndexBits;
+    ALIAS_TABLE(global_alias)
+    ALIAS_TABLE(local_alias)
+} tournament_predictor;
 
-    // Initialize all entries in the tables to their default states
-    for (uint32_t i = 0; i < global_pht_size_tournament; i++) {
-        global_pht_tournament[i] = WN; // Weakly Not Taken
-    }
-    for (uint32_t i = 0; i < local_pht_size_tournament; i++) {
-        local_pht_tournament[i] = WN; // Weakly Not Taken
-    }
-    for (uint32_t i = 0; i < lht_size_tournament; i++) {
-        lht_tournament[i] = 0; // Initialize local history to zero
-    }
-    for (uint32_t i = 0; i < choice_pht_size_tournament; i++) {
-        choice_pht_tournament[i] = WN; // Weakly favor global predictor initially
+void
+init_tournament(tournament_predictor *tp, int ghistoryBits, int lhistoryBits, int pcIndexBits)
+{
+    tp->ghistoryBits = ghistoryBits;
+    tp->lhistoryBits = lhistoryBits;
+    tp->pcIndexBits = pcIndexBits;
+
+    // Allocate the tables based on the configuration parameters, with the
+    // pattern tables Weakly Not Taken and the choice weakly favoring the
+    // global predictor
+    counter_table_init(&tp->global_pht, 1 << ghistoryBits, WN);
+    counter_table_init(&tp->local_pht, 1 << lhistoryBits, WN);
+    counter_table_init(&tp->choice_pht, 1 << ghistoryBits, WN);
+    ALIAS_CREATE(tp->global_alias, &tp->global_pht, WN);
+    ALIAS_CREATE(tp->local_alias, &tp->local_pht, WN);
+
+    uint32_t lht_size = 1 << pcIndexBits;
+    tp->lht = (uint32_t *)malloc(lht_size * sizeof(uint32_t));
+    for (uint32_t i = 0; i < lht_size; i++) {
+        tp->lht[i] = 0; // Initialize local history to zero
     }
 
     // Initialize the global history register to zero
-    ghr_tournament = 0;
+    tp->ghr = 0;
 
 }
 
-uint8_t
-predict_tournament(uint32_t pc)
+// The tournament predictor with its geometry passed in rather than read
+// from 'tp', so a caller with a fixed geometry (the hybrid) gets constant
+// index masks once these are inlined
+//
+static inline uint8_t
+predict_tournament_sized(tournament_predictor *tp, uint32_t pc,
+                         int ghistoryBits, int lhistoryBits, int pcIndexBits)
 {
     // Index into the local history table using the PC
-    uint32_t local_history_index = pc & (lht_size_tournament - 1);
-    uint32_t local_history = lht_tournament[local_history_index];
-    uint32_t local_pht_index = local_history & (local_pht_size_tournament - 1);
+    uint32_t local_history_index = pc & ((1u << pcIndexBits) - 1);
+    uint32_t local_history = tp->lht[local_history_index];
+    uint32_t local_pht_index = local_history & ((1u << lhistoryBits) - 1);
 
     // Index into the global PHT and choice PHT using the global history register
-    uint32_t global_pht_index = ghr_tournament & (global_pht_size_tournament - 1);
-    uint32_t choice_index = ghr_tournament & (choice_pht_size_tournament - 1);
+    uint32_t global_pht_index = tp->ghr & ((1u << ghistoryBits) - 1);
+    uint32_t choice_index = global_pht_index;
 
     // Get predictions from the local, global, and choice predictors
-    uint8_t local_prediction = (local_pht_tournament[local_pht_index] >= WT) ? 1 : 0;
-    uint8_t global_prediction = (global_pht_tournament[global_pht_index] >= WT) ? 1 : 0;
-    uint8_t choice = choice_pht_tournament[choice_index];
+    uint8_t local_prediction = counter_taken(&tp->local_pht, local_pht_index);
+    uint8_t global_prediction = counter_taken(&tp->global_pht, global_pht_index);
+    uint8_t choice = counter_taken(&tp->choice_pht, choice_index);
 
     // Use the choice predictor to select between local and global predictions
-    return (choice >= WT) ? local_prediction : global_prediction;
+    return choice ? local_prediction : global_prediction;
 }
 
-void
-train_tournament(uint32_t pc, uint8_t outcome)
+// Predict and train in one step: each table is indexed and read once
+static inline uint8_t
+predict_and_update_tournament_sized(tournament_predictor *tp, uint32_t pc, uint8_t outcome,
+                                    int ghistoryBits, int lhistoryBits, int pcIndexBits)
 {
-    // Update indices for local and global predictors
-    uint32_t local_history_index = pc & (lht_size_tournament - 1);
-    uint32_t local_history = lht_tournament[local_history_index];
-    uint32_t local_pht_index = local_history & (local_pht_size_tournament - 1);
-
-    uint32_t global_pht_index = ghr_tournament & (global_pht_size_tournament - 1);
-    uint32_t choice_index = ghr_tournament & (choice_pht_size_tournament - 1);
-
-    // Get current predictions
-    uint8_t local_prediction = (local_pht_tournament[local_pht_index] >= WT) ? 1 : 0;
-    uint8_t global_prediction = (global_pht_tournament[global_pht_index] >= WT) ? 1 : 0;
-
-    // Update the choice predictor based on which prediction was correct
+    // Indices for the local and global predictors
+    uint32_t local_history_index = pc & ((1u << pcIndexBits) - 1);
+    uint32_t local_history = tp->lht[local_history_index];
+    uint32_t local_pht_index = local_history & ((1u << lhistoryBits) - 1);
+
+    uint32_t global_pht_index = tp->ghr & ((1u << ghistoryBits) - 1);
+    uint32_t choice_index = global_pht_index;
+
+    // Read the predictions and update the local and global PHTs with the
+    // actual outcome
+    uint8_t local_prediction = counter_predict_update(&tp->local_pht, local_pht_index, outcome);
+    uint8_t global_prediction = counter_predict_update(&tp->global_pht, global_pht_index, outcome);
+    uint8_t choice = counter_taken(&tp->choice_pht, choice_index);
+    ALIAS_RECORD(tp->local_alias, local_pht_index, ALIAS_KEY(pc, local_history),
+                 local_prediction, outcome);
+    ALIAS_RECORD(tp->global_alias, global_pht_index, ALIAS_KEY(pc, tp->ghr),
+                 global_prediction, outcome);
+
+    // Update the choice predictor towards whichever prediction was correct
     if (local_prediction != global_prediction) {
-        if (global_prediction == outcome) {
-            if (choice_pht_tournament[choice_index] > SN) choice_pht_tournament[choice_index]--;
-        } else {
-            if (choice_pht_tournament[choice_index] < ST) choice_pht_tournament[choice_index]++;
-        }
-    }
-
-    // Update the local and global PHTs with the actual outcome
-    if (outcome == 1) { // Branch taken
-        if (local_pht_tournament[local_pht_index] < ST) local_pht_tournament[local_pht_index]++;
-        if (global_pht_tournament[global_pht_index] < ST) global_pht_tournament[global_pht_index]++;
-    } else { // Branch not taken
-        if (local_pht_tournament[local_pht_index] > SN) local_pht_tournament[local_pht_index]--;
-        if (global_pht_tournament[global_pht_index] > SN) global_pht_tournament[global_pht_index]--;
+        counter_update(&tp->choice_pht, choice_index, global_prediction != outcome);
     }
 
     // Update the local history table and the global history register
-    lht_tournament[local_history_index] = ((local_history << 1) | outcome) & ((1 << lhistoryBits) - 1);
-    ghr_tournament = ((ghr_tournament << 1) | outcome) & ((1 << ghistoryBits) - 1);
+    tp->lht[local_history_index] = ((local_history << 1) | outcome) & ((1u << lhistoryBits) - 1);
+    tp->ghr = ((tp->ghr << 1) | outcome) & ((1u << ghistoryBits) - 1);
+
+    // Use the choice predictor to select between local and global predictions
+    return choice ? local_prediction : global_prediction;
+}
+
+uint8_t
+predict_tournament(tournament_predictor *tp, uint32_t pc)
+{
+    return predict_tournament_sized(tp, pc, tp->ghistoryBits,
+                                    tp->lhistoryBits, tp->pcIndexBits);
 }
 
+// Report the local and global predictions and the choice between them
 void
-cleanup_tournament()
+choice_tournament(tournament_predictor *tp, uint32_t pc, predictor_choice *choice)
 {
-    free(global_pht_tournament);
-    free(local_pht_tournament);
-    free(lht_tournament);
-    free(choice_pht_tournament);
+    uint32_t local_history = tp->lht[pc & ((1u << tp->pcIndexBits) - 1)];
+    uint32_t global_pht_index = tp->ghr & ((1u << tp->ghistoryBits) - 1);
+
+    choice->first = counter_taken(&tp->global_pht, global_pht_index);
+    choice->second = counter_taken(&tp->local_pht, local_history & ((1u << tp->lhistoryBits) - 1));
+    choice->chose_second = counter_taken(&tp->choice_pht, global_pht_index);
 }
 
-// hybrid branch predictor 
-uint8_t *choice_pht_hybrid;  // Choice predictor to choose between global and local
-uint32_t ghr_hybrid;         // Global History Register for tournament
+uint8_t
+predict_and_update_tournament(tournament_predictor *tp, uint32_t pc, uint8_t outcome)
+{
+    return predict_and_update_tournament_sized(tp, pc, outcome, tp->ghistoryBits,
+                                               tp->lhistoryBits, tp->pcIndexBits);
+}
 
-// Sizes for the tables
-uint32_t choice_pht_size_hybrid;
+void
+train_tournament(tournament_predictor *tp, uint32_t pc, uint8_t outcome)
+{
+    predict_and_update_tournament(tp, pc, outcome);
+}
 
 void
-init_hybrid()
+cleanup_tournament(tournament_predictor *tp)
 {
-    ghistoryBits = 12;
-    lhistoryBits = 12;
-    pcIndexBits = 11;
+    counter_table_free(&tp->global_pht);
+    counter_table_free(&tp->local_pht);
+    free(tp->lht);
+    counter_table_free(&tp->choice_pht);
+    ALIAS_DESTROY(tp->global_alias);
+    ALIAS_DESTROY(tp->local_alias);
+}
+
+// hybrid branch predictor 
+//
+// Every table has a fixed size, so once the components are inlined into
+// the simulation loop all of its index masks are constants
+#define HYBRID_CHOICE_MASK ((1u << 12) - 1)
+#define HYBRID_TOURNAMENT 12, 12, 11  // ghistoryBits, lhistoryBits, pcIndexBits
 
-    // Initialize sizes for the tables based on the configuration parameters
-    choice_pht_size_hybrid = 1 << 12;
+typedef struct {
+    counter_table choice_pht;   // Choice predictor to choose between global and local
+    uint32_t ghr;               // Global History Register for tournament
 
-    choice_pht_hybrid = (uint8_t *)malloc(choice_pht_size_hybrid * sizeof(uint8_t));
+    tournament_predictor tournament;
+    gshare2_predictor gshare;
+} hybrid_predictor;
 
-    // Initialize all entries in the tables to their default states
-    for (uint32_t i = 0; i < choice_pht_size_hybrid; i++) {
-        choice_pht_hybrid[i] = SN;
-    }
+void
+init_hybrid(hybrid_predictor *hp)
+{
+    // 2^12 choice counters, initially Strongly Not Taken (favor the tournament)
+    counter_table_init(&hp->choice_pht, HYBRID_CHOICE_MASK + 1, SN);
 
     // Initialize the global history register to zero
-    ghr_hybrid = 0;
+    hp->ghr = 0;
 
-    init_tournament();
-    init_gshare2();
+    init_tournament(&hp->tournament, HYBRID_TOURNAMENT);
+    init_gshare2(&hp->gshare);
 }
 
 uint8_t
-predict_hybrid(uint32_t pc)
+predict_hybrid(hybrid_predictor *hp, uint32_t pc)
 {
-    uint32_t choice_index = pc & (choice_pht_size_hybrid - 1);
+    uint32_t choice_index = pc & HYBRID_CHOICE_MASK;
 
-    uint8_t tournament_prediction = predict_tournament(pc);
-    uint8_t gshare_prediction = predict_gshare2(pc);
-    uint8_t choice = choice_pht_hybrid[choice_index];
+    uint8_t tournament_prediction = predict_tournament_sized(&hp->tournament, pc, HYBRID_TOURNAMENT);
+    uint8_t gshare_prediction = predict_gshare2(&hp->gshare, pc);
+    uint8_t choice = counter_taken(&hp->choice_pht, choice_index);
 
     // Use the choice predictor to select between local and global predictions
-    return (choice >= WT) ? gshare_prediction : tournament_prediction;
+    return choice ? gshare_prediction : tournament_prediction;
 }
 
-void
-train_hybrid(uint32_t pc, uint8_t outcome)
+// Predict and train in one step: each component looks up and updates its
+// tables once, and the chooser decides between the predictions they made
+uint8_t
+predict_and_update_hybrid(hybrid_predictor *hp, uint32_t pc, uint8_t outcome)
 {
-    uint32_t choice_index = pc & (choice_pht_size_hybrid - 1);
+    uint32_t choice_index = pc & HYBRID_CHOICE_MASK;
 
-    // Get current predictions
-    uint8_t tournament_prediction = predict_tournament(pc);
-    uint8_t gshare_prediction = predict_gshare2(pc);
+    uint8_t tournament_prediction =
+        predict_and_update_tournament_sized(&hp->tournament, pc, outcome, HYBRID_TOURNAMENT);
+    uint8_t gshare_prediction = predict_and_update_gshare2(&hp->gshare, pc, outcome);
+    uint8_t choice = counter_taken(&hp->choice_pht, choice_index);
 
-    // Update the choice predictor based on which prediction was correct
+    // Update the choice predictor towards whichever prediction was correct
     if (tournament_prediction != gshare_prediction) {
-        if (tournament_prediction == outcome) {
-            if (choice_pht_hybrid[choice_index] > SN) choice_pht_hybrid[choice_index]--;
-        } else {
-            if (choice_pht_hybrid[choice_index] < ST) choice_pht_hybrid[choice_index]++;
-        }
+        counter_update(&hp->choice_pht, choice_index, tournament_prediction != outcome);
     }
 
     // Update the local history table and the global history register
-    ghr_hybrid= ((ghr_hybrid << 1) | outcome) & ((1 << ghistoryBits) - 1);
+    hp->ghr = ((hp->ghr << 1) | outcome) & ((1 << 12) - 1);
 
-    train_tournament(pc, outcome);
-    train_gshare2(pc, outcome);
+    return choice ? gshare_prediction : tournament_prediction;
+}
+
+// Report the tournament and gshare predictions and the choice between them
+void
+choice_hybrid(hybrid_predictor *hp, uint32_t pc, predictor_choice *choice)
+{
+    choice->first = predict_tournament_sized(&hp->tournament, pc, HYBRID_TOURNAMENT);
+    choice->second = predict_gshare2(&hp->gshare, pc);
+    choice->chose_second = counter_taken(&hp->choice_pht, pc & HYBRID_CHOICE_MASK);
 }
 
 void
-cleanup_hybrid()
+train_hybrid(hybrid_predictor *hp, uint32_t pc, uint8_t outcome)
+{
+    predict_and_update_hybrid(hp, pc, outcome);
+}
+
+void
+cleanup_hybrid(hybrid_predictor *hp)
+{
+	cleanup_tournament(&hp->tournament);
+	cleanup_gshare2(&hp->gshare);
+	counter_table_free(&hp->choice_pht);
+}
+
+// Perceptron predictor (Jimenez & Lin) with int8 weights
+//
+// Each perceptron is one row of a flat, cache-line-aligned weight table,
+// padded to a multiple of 32 weights.  The global history is kept as a
+// vector of +1/-1 inputs (input 0 is the constant bias input), so the
+// history can be as long as the configuration asks for and the dot
+// product is a single pass of SIMD sign/add instructions.  Padding
+// inputs are 0 and never contribute.
+typedef struct {
+    int ghistoryBits;           // Number of bits for global history
+    int num_perceptrons;        // Number of perceptrons in the table
+    int threshold;              // Threshold for training the perceptrons
+    int stride;                 // Weights per row, including padding
+
+    // Components of the Perceptron Branch Predictor
+    int8_t *table;              // Table of perceptrons (weights), row-major
+    int8_t *history;            // Global history as +1/-1 inputs
+
+    // Dot product computed by the last prediction, reused by training
+    int cached;
+    uint32_t cached_pc;
+    int cached_y;
+} perceptron_predictor;
+
+// Weights saturate at +/-127 so that negating a weight never overflows
+#define PERCEPTRON_WEIGHT_MAX 127
+
+static inline int8_t *
+perceptron_row(perceptron_predictor *pp, uint32_t pc)
 {
-	cleanup_tournament();
-	cleanup_gshare2();
-	free(choice_pht_hybrid);
+    uint32_t n = pp->num_perceptrons;
+    uint32_t index = (n & (n - 1)) == 0 ? pc & (n - 1) : pc % n;  // Select a perceptron based on the PC
+    return pp->table + (size_t)index * pp->stride;
 }
 
-// Custom Perceptron predictor
-int ghistoryBits_perceptron;   // Number of bits for global history
-int num_perceptrons;           // Number of perceptrons in the table
-int perceptron_threshold;      // Threshold for training the perceptrons
+// Compute y = sum(weights[i] * history[i]) over one row
+static inline int
+perceptron_dot(const int8_t *weights, const int8_t *history, int stride)
+{
+#if defined(__AVX2__)
+    const __m256i ones8 = _mm256_set1_epi8(1);
+    const __m256i ones16 = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+    for (int i = 0; i < stride; i += 32) {
+        __m256i w = _mm256_load_si256((const __m256i *)(weights + i));
+        __m256i x = _mm256_load_si256((const __m256i *)(history + i));
+        __m256i prod = _mm256_sign_epi8(w, x);                    // w * x, x in {-1, 0, 1}
+        __m256i pairs = _mm256_maddubs_epi16(ones8, prod);        // int8 pairs -> int16
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, ones16));
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                                _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+#elif defined(__SSSE3__)
+    const __m128i ones8 = _mm_set1_epi8(1);
+    const __m128i ones16 = _mm_set1_epi16(1);
+    __m128i acc = _mm_setzero_si128();
+    for (int i = 0; i < stride; i += 16) {
+        __m128i w = _mm_load_si128((const __m128i *)(weights + i));
+        __m128i x = _mm_load_si128((const __m128i *)(history + i));
+        __m128i pairs = _mm_maddubs_epi16(ones8, _mm_sign_epi8(w, x));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(pairs, ones16));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc);
+#else
+    int y = 0;
+    for (int i = 0; i < stride; i++) {
+        y += weights[i] * history[i];
+    }
+    return y;
+#endif
+}
 
-// Components of the Perceptron Branch Predictor
-int8_t **perceptron_table;     // Table of perceptrons (weights)
-uint32_t ghr_perceptron;       // Global History Register for perceptron predictor
+// Move every weight one step towards 'actual' * history[i]
+static inline void
+perceptron_update(int8_t *weights, const int8_t *history, int stride, int actual)
+{
+#if defined(__AVX2__)
+    const __m256i floor = _mm256_set1_epi8(-PERCEPTRON_WEIGHT_MAX);
+    for (int i = 0; i < stride; i += 32) {
+        __m256i w = _mm256_load_si256((const __m256i *)(weights + i));
+        __m256i x = _mm256_load_si256((const __m256i *)(history + i));
+        w = actual > 0 ? _mm256_adds_epi8(w, x) : _mm256_subs_epi8(w, x);
+        _mm256_store_si256((__m256i *)(weights + i), _mm256_max_epi8(w, floor));
+    }
+#elif defined(__SSE4_1__)
+    const __m128i floor = _mm_set1_epi8(-PERCEPTRON_WEIGHT_MAX);
+    for (int i = 0; i < stride; i += 16) {
+        __m128i w = _mm_load_si128((const __m128i *)(weights + i));
+        __m128i x = _mm_load_si128((const __m128i *)(history + i));
+        w = actual > 0 ? _mm_adds_epi8(w, x) : _mm_subs_epi8(w, x);
+        _mm_store_si128((__m128i *)(weights + i), _mm_max_epi8(w, floor));
+    }
+#else
+    for (int i = 0; i < stride; i++) {
+        int w = weights[i] + actual * history[i];
+        if (w > PERCEPTRON_WEIGHT_MAX) w = PERCEPTRON_WEIGHT_MAX;
+        if (w < -PERCEPTRON_WEIGHT_MAX) w = -PERCEPTRON_WEIGHT_MAX;
+        weights[i] = w;
+    }
+#endif
+}
 
 // Initialize the Perceptron Branch Predictor
-void init_perceptron()
-{
-    ghistoryBits_perceptron = 58;
-    num_perceptrons = 1<<12;
-    perceptron_threshold = 70;
-
-    // Allocate memory for the perceptron table
-    perceptron_table = (int8_t **)malloc(num_perceptrons * sizeof(int8_t *));
-    for (int i = 0; i < num_perceptrons; i++) {
-        perceptron_table[i] = (int8_t *)malloc((ghistoryBits_perceptron + 1) * sizeof(int8_t));
-        for (int j = 0; j <= ghistoryBits_perceptron; j++) {
-            perceptron_table[i][j] = 0; // Initialize all weights to 0
-        }
+void init_perceptron(perceptron_predictor *pp, int historyBits, int numPerceptrons, int threshold)
+{
+    pp->ghistoryBits = historyBits;
+    pp->num_perceptrons = numPerceptrons;
+    pp->threshold = threshold;
+    pp->stride = (historyBits + 1 + 31) & ~31;     // Bias + history, padded for SIMD
+
+    // Allocate memory for the perceptron table, with all weights set to 0
+    size_t table_bytes = (size_t)pp->num_perceptrons * pp->stride;
+    if (posix_memalign((void **)&pp->table, 64, table_bytes) != 0 ||
+        posix_memalign((void **)&pp->history, 64, pp->stride) != 0) {
+        fprintf(stderr, "perceptron: cannot allocate %zu bytes\n", table_bytes);
+        exit(1);
     }
+    memset(pp->table, 0, table_bytes);
+
+    // Initialize the Global History to all NOTTAKEN (-1), with the bias
+    // input fixed at +1 and the padding at 0
+    memset(pp->history, 0, pp->stride);
+    pp->history[0] = 1;
+    memset(pp->history + 1, -1, historyBits);
 
-    // Initialize the Global History Register to zero
-    ghr_perceptron = 0;
+    pp->cached = 0;
 }
 
 // Predict the outcome of a branch using the Perceptron Branch Predictor
-uint8_t predict_perceptron(uint32_t pc)
+uint8_t predict_perceptron(perceptron_predictor *pp, uint32_t pc)
 {
-    int perceptron_index = pc % num_perceptrons;  // Select a perceptron based on the PC
-    int8_t *weights = perceptron_table[perceptron_index];
-
     // Compute the dot product of the weights and the global history
-    int y = weights[0];  // Bias term
-    for (int i = 0; i < ghistoryBits_perceptron; i++) {
-        int history_bit = (ghr_perceptron >> i) & 1;
-        y += weights[i + 1] * (history_bit ? 1 : -1);
-    }
+    int y = perceptron_dot(perceptron_row(pp, pc), pp->history, pp->stride);
+
+    pp->cached = 1;
+    pp->cached_pc = pc;
+    pp->cached_y = y;
 
     // Predict taken if y > 0, not taken otherwise
     return (y >= 0) ? 1 : 0;
 }
 
 // Train the Perceptron Branch Predictor based on the actual outcome
-void train_perceptron(uint32_t pc, uint8_t outcome)
+void train_perceptron(perceptron_predictor *pp, uint32_t pc, uint8_t outcome)
 {
-    int perceptron_index = pc % num_perceptrons;  // Select a perceptron based on the PC
-    int8_t *weights = perceptron_table[perceptron_index];
+    int8_t *weights = perceptron_row(pp, pc);
 
-    // Compute the dot product of the weights and the global history to get y
-    int y = weights[0];  // Bias term
-    for (int i = 0; i < ghistoryBits_perceptron; i++) {
-        int history_bit = (ghr_perceptron >> i) & 1;
-        y += weights[i + 1] * (history_bit ? 1 : -1);
-    }
+    // Reuse the dot product from the prediction for this branch
+    int y = (pp->cached && pp->cached_pc == pc) ?
+            pp->cached_y : perceptron_dot(weights, pp->history, pp->stride);
+    pp->cached = 0;
 
     // Convert the branch outcome to +1 for taken and -1 for not taken
     int actual = outcome ? 1 : -1;
 
     // Update weights if the prediction was incorrect or |y| <= threshold
-    if ((y >= 0) != (actual == 1) || abs(y) <= perceptron_threshold) {
-        weights[0] += actual;  // Update the bias term
-        for (int i = 0; i < ghistoryBits_perceptron; i++) {
-            int history_bit = (ghr_perceptron >> i) & 1;
-            weights[i + 1] += actual * (history_bit ? 1 : -1);
-        }
+    if ((y >= 0) != (actual == 1) || abs(y) <= pp->threshold) {
+        perceptron_update(weights, pp->history, pp->stride, actual);
+    }
+
+    // Shift the outcome into the Global History
+    if (pp->ghistoryBits > 0) {
+        memmove(pp->history + 2, pp->history + 1, pp->ghistoryBits - 1);
+        pp->history[1] = actual;
     }
+}
 
-    // Update the Global History Register with the actual outcome
-    ghr_perceptron = ((ghr_perceptron << 1) | outcome) & ((1 << ghistoryBits_perceptron) - 1);
+// Predict and train in one step; training reuses the prediction's dot
+// product, so the weight row is read once
+uint8_t predict_and_update_perceptron(perceptron_predictor *pp, uint32_t pc, uint8_t outcome)
+{
+    uint8_t prediction = predict_perceptron(pp, pc);
+    train_perceptron(pp, pc, outcome);
+    return prediction;
 }
 
 // Free the allocated memory for the Perceptron Branch Predictor
-void cleanup_perceptron()
+void cleanup_perceptron(perceptron_predictor *pp)
 {
-    for (int i = 0; i < num_perceptrons; i++) {
-        free(perceptron_table[i]);
+    free(pp->table);
+    free(pp->history);
+}
+
+// TAGE predictor (Seznec & Michaud): a bimodal base predictor backed by
+// several partially tagged tables indexed with geometrically increasing
+// global history lengths
+//
+// Each tagged entry is packed into 16 bits (3-bit counter, 2-bit useful
+// counter, up to 11 tag bits) and all tagged tables share one contiguous
+// allocation.  Index and tag hashes use folded (compressed) copies of the
+// global history that are updated in O(1) per branch.
+#define TAGE_MAX_TABLES   16
+#define TAGE_MAX_HISTORY  1024
+
+// Default configuration (tables : log2 entries : tag bits : min history :
+// max history : log2 base entries).  Storage:
+//   base    2^13 * 2 bits                          = 16384
+//   tagged  6 * 2^9 * (3 + 2 + 10) bits            = 46080
+//   history 200 bits + 6 * (9 + 10 + 9) folded     =   368
+//   use_alt_on_na 4 bits + u-reset tick 18 bits    =    22
+// for 62854 bits, within the 64K + 256 bit budget
+#define TAGE_DEFAULT_CONFIG 6, 9, 10, 4, 200, 13
+#define TAGE_HISTORY_SIZE 2048        // Circular history buffer, power of 2
+
+#define TAGE_CTR(e)  ((e) & 0x7)      // 3-bit prediction counter, taken if >= 4
+#define TAGE_U(e)    (((e) >> 3) & 0x3)
+#define TAGE_TAG(e)  ((e) >> 5)
+#define TAGE_ENTRY(tag, u, ctr) ((uint16_t)(((tag) << 5) | ((u) << 3) | (ctr)))
+
+// Number of updates between halvings of the useful counters
+#define TAGE_U_RESET_PERIOD (1 << 18)
+
+// A global history of 'orig_len' bits folded down to 'comp_len' bits
+typedef struct {
+    uint32_t comp;
+    int comp_len;
+    int orig_len;
+    int outpoint;               // orig_len % comp_len
+} folded_history;
+
+typedef struct {
+    int num_tables;
+    int log_entries;            // log2 of the entries in each tagged table
+    int tag_bits;
+    int history_length[TAGE_MAX_TABLES];
+
+    counter_table base;         // Bimodal base predictor (packed 2-bit counters)
+    uint16_t *tables;           // num_tables tagged tables, back to back
+
+    uint8_t history[TAGE_HISTORY_SIZE];  // Global history, newest at 'ptr'
+    int ptr;
+    folded_history index_fold[TAGE_MAX_TABLES];
+    folded_history tag_fold[2][TAGE_MAX_TABLES];
+
+    int use_alt_on_na;          // 4-bit signed: trust the alternate over new entries
+    uint32_t tick;              // Updates since the last useful-counter reset
+    uint32_t seed;              // LFSR state for picking allocation targets
+
+    // Lookup state of the last prediction, reused by training
+    int cached;
+    uint32_t cached_pc;
+    uint32_t index[TAGE_MAX_TABLES];
+    uint16_t tag[TAGE_MAX_TABLES];
+    int provider;               // Longest matching table, -1 for the base
+    int alt;                    // Next longest matching table, -1 for the base
+    uint8_t provider_pred;
+    uint8_t alt_pred;
+    uint8_t final_pred;
+} tage_predictor;
+
+static void
+init_folded_history(folded_history *fh, int orig_len, int comp_len)
+{
+    fh->comp = 0;
+    fh->orig_len = orig_len;
+    fh->comp_len = comp_len;
+    fh->outpoint = orig_len % comp_len;
+}
+
+// Fold the newest history bit in and the bit that just left the window out
+static inline void
+update_folded_history(folded_history *fh, const uint8_t *history, int ptr)
+{
+    fh->comp = (fh->comp << 1) | history[ptr];
+    fh->comp ^= (uint32_t)history[(ptr + fh->orig_len) & (TAGE_HISTORY_SIZE - 1)] << fh->outpoint;
+    fh->comp ^= fh->comp >> fh->comp_len;
+    fh->comp &= (1u << fh->comp_len) - 1;
+}
+
+void
+init_tage(tage_predictor *tp, const predictor_config *config)
+{
+    tp->num_tables = config->tageTables;
+    tp->log_entries = config->tageLogEntries;
+    tp->tag_bits = config->tageTagBits;
+
+    // Geometric history lengths from tageMinHistory to ghistoryBits
+    int min_len = config->tageMinHistory;
+    int max_len = config->ghistoryBits;
+    for (int i = 0; i < tp->num_tables; i++) {
+        double ratio = tp->num_tables > 1 ? (double)i / (tp->num_tables - 1) : 0;
+        int len = (int)(min_len * pow((double)max_len / min_len, ratio) + 0.5);
+        if (i > 0 && len <= tp->history_length[i - 1]) {
+            len = tp->history_length[i - 1] + 1;
+        }
+        tp->history_length[i] = len;
+    }
+
+    // Bimodal base, initialized to Weakly Not Taken
+    counter_table_init(&tp->base, 1 << config->bhistoryBits, WN);
+
+    // Tagged entries start invalid: tag 0, not useful, weakly not taken
+    size_t entries = (size_t)tp->num_tables << tp->log_entries;
+    tp->tables = (uint16_t *)malloc(entries * sizeof(uint16_t));
+    for (size_t i = 0; i < entries; i++) {
+        tp->tables[i] = TAGE_ENTRY(0, 0, 3);
+    }
+
+    memset(tp->history, 0, sizeof(tp->history));
+    tp->ptr = 0;
+    for (int i = 0; i < tp->num_tables; i++) {
+        init_folded_history(&tp->index_fold[i], tp->history_length[i], tp->log_entries);
+        init_folded_history(&tp->tag_fold[0][i], tp->history_length[i], tp->tag_bits);
+        init_folded_history(&tp->tag_fold[1][i], tp->history_length[i], tp->tag_bits - 1);
+    }
+
+    tp->use_alt_on_na = 0;
+    tp->tick = 0;
+    tp->seed = 0x2545f491;
+    tp->cached = 0;
+}
+
+// Look up every table for 'pc' and record the provider and alternate
+static void
+tage_lookup(tage_predictor *tp, uint32_t pc)
+{
+    uint32_t index_mask = (1u << tp->log_entries) - 1;
+    uint32_t tag_mask = (1u << tp->tag_bits) - 1;
+
+    for (int i = 0; i < tp->num_tables; i++) {
+        tp->index[i] = (pc ^ (pc >> (tp->log_entries - i % tp->log_entries)) ^
+                        tp->index_fold[i].comp) & index_mask;
+        tp->tag[i] = (pc ^ tp->tag_fold[0][i].comp ^
+                      (tp->tag_fold[1][i].comp << 1)) & tag_mask;
+    }
+
+    tp->provider = -1;
+    tp->alt = -1;
+    for (int i = tp->num_tables - 1; i >= 0; i--) {
+        uint16_t e = tp->tables[((size_t)i << tp->log_entries) + tp->index[i]];
+        if (TAGE_TAG(e) == tp->tag[i]) {
+            if (tp->provider < 0) {
+                tp->provider = i;
+            } else {
+                tp->alt = i;
+                break;
+            }
+        }
+    }
+
+    uint8_t base_pred = counter_taken(&tp->base, pc & (tp->base.size - 1));
+    tp->alt_pred = tp->alt >= 0 ?
+        TAGE_CTR(tp->tables[((size_t)tp->alt << tp->log_entries) + tp->index[tp->alt]]) >= 4 :
+        base_pred;
+
+    if (tp->provider < 0) {
+        tp->provider_pred = base_pred;
+        tp->final_pred = base_pred;
+    } else {
+        uint16_t e = tp->tables[((size_t)tp->provider << tp->log_entries) + tp->index[tp->provider]];
+        uint8_t ctr = TAGE_CTR(e);
+        tp->provider_pred = ctr >= 4;
+
+        // A weak, never-useful entry is probably newly allocated; the
+        // alternate prediction is often better for those
+        int weak = (ctr == 3 || ctr == 4) && TAGE_U(e) == 0;
+        tp->final_pred = (weak && tp->use_alt_on_na >= 0) ? tp->alt_pred : tp->provider_pred;
+    }
+
+    tp->cached = 1;
+    tp->cached_pc = pc;
+}
+
+uint8_t
+predict_tage(tage_predictor *tp, uint32_t pc)
+{
+    tage_lookup(tp, pc);
+    return tp->final_pred;
+}
+
+static inline uint8_t
+update_ctr3(uint8_t ctr, uint8_t outcome)
+{
+    if (outcome) {
+        return ctr < 7 ? ctr + 1 : ctr;
+    }
+    return ctr > 0 ? ctr - 1 : ctr;
+}
+
+void
+train_tage(tage_predictor *tp, uint32_t pc, uint8_t outcome)
+{
+    if (!tp->cached || tp->cached_pc != pc) {
+        tage_lookup(tp, pc);
+    }
+    tp->cached = 0;
+
+    int provider = tp->provider;
+    uint16_t *pe = provider >= 0 ?
+        &tp->tables[((size_t)provider << tp->log_entries) + tp->index[provider]] : NULL;
+
+    // Learn whether newly allocated entries or the alternate do better
+    if (pe && TAGE_U(*pe) == 0 && (TAGE_CTR(*pe) == 3 || TAGE_CTR(*pe) == 4) &&
+        tp->provider_pred != tp->alt_pred) {
+        if (tp->alt_pred == outcome) {
+            if (tp->use_alt_on_na < 7) tp->use_alt_on_na++;
+        } else {
+            if (tp->use_alt_on_na > -8) tp->use_alt_on_na--;
+        }
+    }
+
+    // On a misprediction, allocate an entry in a longer-history table
+    if (tp->final_pred != outcome && provider < tp->num_tables - 1) {
+        int start = provider + 1;
+
+        // Skip one candidate table at random so allocations spread out
+        tp->seed = (tp->seed >> 1) ^ (-(tp->seed & 1) & 0xd0000001u);
+        if ((tp->seed & 1) && start < tp->num_tables - 1) {
+            start++;
+        }
+
+        int allocated = 0;
+        for (int i = start; i < tp->num_tables && !allocated; i++) {
+            uint16_t *e = &tp->tables[((size_t)i << tp->log_entries) + tp->index[i]];
+            if (TAGE_U(*e) == 0) {
+                *e = TAGE_ENTRY(tp->tag[i], 0, outcome ? 4 : 3);
+                allocated = 1;
+            }
+        }
+        if (!allocated) {
+            // Every candidate is useful: age them so one frees up later
+            for (int i = provider + 1; i < tp->num_tables; i++) {
+                uint16_t *e = &tp->tables[((size_t)i << tp->log_entries) + tp->index[i]];
+                if (TAGE_U(*e) > 0) {
+                    *e = TAGE_ENTRY(TAGE_TAG(*e), TAGE_U(*e) - 1, TAGE_CTR(*e));
+                }
+            }
+        }
+    }
+
+    // Update the provider, or the base when no tagged table matched
+    if (pe) {
+        uint8_t u = TAGE_U(*pe);
+        if (tp->provider_pred != tp->alt_pred) {
+            if (tp->provider_pred == outcome) {
+                if (u < 3) u++;
+            } else {
+                if (u > 0) u--;
+            }
+        }
+
+        // While the provider is still unproven, train the alternate too
+        if (u == 0) {
+            if (tp->alt >= 0) {
+                uint16_t *ae = &tp->tables[((size_t)tp->alt << tp->log_entries) + tp->index[tp->alt]];
+                *ae = TAGE_ENTRY(TAGE_TAG(*ae), TAGE_U(*ae), update_ctr3(TAGE_CTR(*ae), outcome));
+            } else {
+                counter_update(&tp->base, pc & (tp->base.size - 1), outcome);
+            }
+        }
+        *pe = TAGE_ENTRY(TAGE_TAG(*pe), u, update_ctr3(TAGE_CTR(*pe), outcome));
+    } else {
+        counter_update(&tp->base, pc & (tp->base.size - 1), outcome);
+    }
+
+    // Periodically halve every useful counter so stale entries can be replaced
+    if (++tp->tick == TAGE_U_RESET_PERIOD) {
+        size_t entries = (size_t)tp->num_tables << tp->log_entries;
+        for (size_t i = 0; i < entries; i++) {
+            uint16_t e = tp->tables[i];
+            tp->tables[i] = TAGE_ENTRY(TAGE_TAG(e), TAGE_U(e) >> 1, TAGE_CTR(e));
+        }
+        tp->tick = 0;
+    }
+
+    // Shift the outcome into the global history and the folded copies
+    tp->ptr = (tp->ptr - 1) & (TAGE_HISTORY_SIZE - 1);
+    tp->history[tp->ptr] = outcome;
+    for (int i = 0; i < tp->num_tables; i++) {
+        update_folded_history(&tp->index_fold[i], tp->history, tp->ptr);
+        update_folded_history(&tp->tag_fold[0][i], tp->history, tp->ptr);
+        update_folded_history(&tp->tag_fold[1][i], tp->history, tp->ptr);
     }
-    free(perceptron_table);
+}
+
+// Predict and train in one step; training reuses the prediction's lookup
+uint8_t
+predict_and_update_tage(tage_predictor *tp, uint32_t pc, uint8_t outcome)
+{
+    tage_lookup(tp, pc);
+    uint8_t prediction = tp->final_pred;
+    train_tage(tp, pc, outcome);
+    return prediction;
+}
+
+void
+cleanup_tage(tage_predictor *tp)
+{
+    counter_table_free(&tp->base);
+    free(tp->tables);
+}
+
+//------------------------------------//
+//        Predictor Registry          //
+//------------------------------------//
+
+// The static predictor has no state and always predicts taken
+typedef struct {
+    char unused;
+} static_predictor;
+
+uint8_t
+predict_static(static_predictor *sp, uint32_t pc)
+{
+    return TAKEN;
+}
+
+void
+train_static(static_predictor *sp, uint32_t pc, uint8_t outcome)
+{
+}
+
+uint8_t
+predict_and_update_static(static_predictor *sp, uint32_t pc, uint8_t outcome)
+{
+    return TAKEN;
+}
+
+void
+cleanup_static(static_predictor *sp)
+{
+}
+
+// Generate the block loop of a predictor with no specialized one: each
+// branch goes through predict_and_update, called directly so the compiler
+// can inline it.  Storing predictions gets its own loop, since a byte
+// store may alias the predictor's state and would force it to be reloaded
+// on every branch.
+//
+#define GENERIC_RUN(name, type)                                         \
+static uint32_t                                                         \
+run_##name(type *s, const uint32_t *pcs, const uint8_t *outcomes,       \
+           uint8_t *predictions, size_t count)                          \
+{                                                                       \
+  uint32_t mispredictions = 0;                                          \
+  if (predictions) {                                                    \
+    for (size_t i = 0; i < count; i++) {                                \
+      predictions[i] = predict_and_update_##name(s, pcs[i], outcomes[i]); \
+      mispredictions += predictions[i] != outcomes[i];                  \
+    }                                                                   \
+    return mispredictions;                                              \
+  }                                                                     \
+  for (size_t i = 0; i < count; i++) {                                  \
+    mispredictions += predict_and_update_##name(s, pcs[i], outcomes[i]) \
+                      != outcomes[i];                                   \
+  }                                                                     \
+  return mispredictions;                                                \
+}
+
+GENERIC_RUN(static, static_predictor)
+GENERIC_RUN(tournament, tournament_predictor)
+GENERIC_RUN(hybrid, hybrid_predictor)
+GENERIC_RUN(perceptron, perceptron_predictor)
+GENERIC_RUN(tage, tage_predictor)
+
+// Adapt a predictor's functions to the untyped state the registry passes
+// around.  Dispatch through run costs one indirect call per block of
+// branches instead of one per branch.
+//
+#define PREDICTOR_OPS(name, type)                                       \
+static uint8_t                                                          \
+name##_predict_op(void *state, uint32_t pc)                             \
+{                                                                       \
+  return predict_##name((type *)state, pc);                             \
+}                                                                       \
+                                                                        \
+static void                                                             \
+name##_train_op(void *state, uint32_t pc, uint8_t outcome)              \
+{                                                                       \
+  train_##name((type *)state, pc, outcome);                             \
+}                                                                       \
+                                                                        \
+static uint8_t                                                          \
+name##_update_op(void *state, uint32_t pc, uint8_t outcome)             \
+{                                                                       \
+  return predict_and_update_##name((type *)state, pc, outcome);         \
+}                                                                       \
+                                                                        \
+static uint32_t                                                         \
+name##_run_op(void *state, const uint32_t *pcs, const uint8_t *outcomes, \
+              uint8_t *predictions, size_t count)                       \
+{                                                                       \
+  return run_##name((type *)state, pcs, outcomes, predictions, count);  \
+}                                                                       \
+                                                                        \
+static void                                                             \
+name##_cleanup_op(void *state)                                          \
+{                                                                       \
+  cleanup_##name((type *)state);                                        \
+}
+
+PREDICTOR_OPS(static, static_predictor)
+PREDICTOR_OPS(bimodal, bimodal_predictor)
+PREDICTOR_OPS(gshare, gshare_predictor)
+PREDICTOR_OPS(tournament, tournament_predictor)
+PREDICTOR_OPS(hybrid, hybrid_predictor)
+PREDICTOR_OPS(perceptron, perceptron_predictor)
+PREDICTOR_OPS(tage, tage_predictor)
+
+static void
+tournament_choice_op(void *state, uint32_t pc, predictor_choice *choice)
+{
+  choice_tournament(state, pc, choice);
+}
+
+static void
+hybrid_choice_op(void *state, uint32_t pc, predictor_choice *choice)
+{
+  choice_hybrid(state, pc, choice);
+}
+
+#ifdef INSTRUMENT
+// Aliasing statistics of each instrumented table
+static void
+bimodal_report_op(void *state, FILE *out)
+{
+  alias_report(((bimodal_predictor *)state)->bht_alias, out, "BHT");
+}
+
+static void
+gshare_report_op(void *state, FILE *out)
+{
+  alias_report(((gshare_predictor *)state)->bht_alias, out, "BHT");
+}
+
+static void
+tournament_report_op(void *state, FILE *out)
+{
+  tournament_predictor *tp = state;
+  alias_report(tp->global_alias, out, "Global PHT");
+  alias_report(tp->local_alias, out, "Local PHT");
+}
+
+static void
+hybrid_report_op(void *state, FILE *out)
+{
+  hybrid_predictor *hp = state;
+  alias_report(hp->tournament.global_alias, out, "Tournament global PHT");
+  alias_report(hp->tournament.local_alias, out, "Tournament local PHT");
+  alias_report(hp->gshare.bht_alias, out, "Gshare BHT");
+}
+
+#define REPORT(name) .report = name##_report_op,
+#else
+#define REPORT(name)
+#endif
+
+// The tables the lockstep kernel drives directly; instrumented builds
+// leave them out so that every access goes through the alias hooks
+#ifndef INSTRUMENT
+static void
+bimodal_lane_op(void *state, counter_table **table, uint32_t **ghr)
+{
+  *table = &((bimodal_predictor *)state)->bht;
+  *ghr = NULL;
+}
+
+static void
+gshare_lane_op(void *state, counter_table **table, uint32_t **ghr)
+{
+  gshare_predictor *gp = state;
+  *table = &gp->bht;
+  *ghr = &gp->ghr;
+}
+
+#define LANE(name) .lane = name##_lane_op,
+#else
+#define LANE(name)
+#endif
+
+static void
+static_init_op(void *state, const predictor_config *config)
+{
+}
+
+static void
+bimodal_init_op(void *state, const predictor_config *config)
+{
+  init_bimodal(state, config->bhistoryBits);
+}
+
+static void
+gshare_init_op(void *state, const predictor_config *config)
+{
+  init_gshare(state, config->ghistoryBits);
+}
+
+static void
+tournament_init_op(void *state, const predictor_config *config)
+{
+  init_tournament(state, config->ghistoryBits, config->lhistoryBits,
+                  config->pcIndexBits);
+}
+
+static void
+hybrid_init_op(void *state, const predictor_config *config)
+{
+  init_hybrid(state);
+}
+
+static void
+perceptron_init_op(void *state, const predictor_config *config)
+{
+  init_perceptron(state, config->ghistoryBits, config->numPerceptrons,
+                  config->perceptronThreshold);
+}
+
+static void
+tage_init_op(void *state, const predictor_config *config)
+{
+  init_tage(state, config);
+}
+
+// Exact storage of each design: every table and history register the
+// hardware would need
+
+static uint64_t
+static_storage_bits(const predictor_config *config)
+{
+  return 0;
+}
+
+static uint64_t
+bimodal_storage_bits(const predictor_config *config)
+{
+  return (1ull << config->bhistoryBits) * 2;
+}
+
+static uint64_t
+gshare_storage_bits(const predictor_config *config)
+{
+  uint64_t g = config->ghistoryBits;
+  return (1ull << g) * 2 + g;
+}
+
+static uint64_t
+tournament_storage_bits(const predictor_config *config)
+{
+  uint64_t g = config->ghistoryBits;
+  uint64_t l = config->lhistoryBits;
+  // Global and choice PHTs, local PHT, local history table, GHR
+  return (1ull << g) * 2 * 2 + (1ull << l) * 2 +
+         (1ull << config->pcIndexBits) * l + g;
+}
+
+static uint64_t
+hybrid_storage_bits(const predictor_config *config)
+{
+  // tournament:12:12:11 and gshare2 tables, the 2^12 chooser, and one
+  // 12-bit GHR: the three GHRs in the code shift in the same outcomes
+  return (1ull << 12) * 2 * 2 + (1ull << 12) * 2 + (1ull << 11) * 12 +
+         (1ull << 12) * 2 + (1ull << 12) * 2 + 12;
+}
+
+static uint64_t
+perceptron_storage_bits(const predictor_config *config)
+{
+  uint64_t g = config->ghistoryBits;
+  // 8-bit weights for the bias and each history bit, plus the history
+  return (uint64_t)config->numPerceptrons * (g + 1) * 8 + g;
+}
+
+static uint64_t
+tage_storage_bits(const predictor_config *config)
+{
+  uint64_t g = config->ghistoryBits;
+  uint64_t t = config->tageTables;
+  uint64_t log = config->tageLogEntries;
+  uint64_t tag = config->tageTagBits;
+  // Base, tagged entries (ctr + u + tag), global history, folded
+  // index/tag registers, use_alt_on_na and the u-reset tick
+  return (1ull << config->bhistoryBits) * 2 + t * (1ull << log) * (3 + 2 + tag) +
+         g + t * (log + tag + tag - 1) + 4 + 18;
+}
+
+// The tables and registers of each design, in the order checkpoints
+// store them.  Everything else in the state is fixed by the config or is
+// a cache that is rebuilt on the next prediction.
+
+typedef struct {
+  void *data;
+  size_t bytes;
+} state_section;
+
+#define MAX_STATE_SECTIONS 16
+#define SECTION(ptr, size) ((state_section){ (void *)(ptr), (size) })
+#define COUNTER_SECTION(t) SECTION((t).words, counter_table_bytes(&(t)))
+
+static int
+static_sections(void *state, state_section *s)
+{
+  return 0;
+}
+
+static int
+bimodal_sections(void *state, state_section *s)
+{
+  bimodal_predictor *bp = state;
+  s[0] = COUNTER_SECTION(bp->bht);
+  return 1;
+}
+
+static int
+gshare_sections(void *state, state_section *s)
+{
+  gshare_predictor *gp = state;
+  s[0] = COUNTER_SECTION(gp->bht);
+  s[1] = SECTION(&gp->ghr, sizeof(gp->ghr));
+  return 2;
+}
+
+static int
+tournament_sections(void *state, state_section *s)
+{
+  tournament_predictor *tp = state;
+  s[0] = COUNTER_SECTION(tp->global_pht);
+  s[1] = COUNTER_SECTION(tp->local_pht);
+  s[2] = SECTION(tp->lht, ((size_t)1 << tp->pcIndexBits) * sizeof(uint32_t));
+  s[3] = COUNTER_SECTION(tp->choice_pht);
+  s[4] = SECTION(&tp->ghr, sizeof(tp->ghr));
+  return 5;
+}
+
+static int
+hybrid_sections(void *state, state_section *s)
+{
+  hybrid_predictor *hp = state;
+  int n = tournament_sections(&hp->tournament, s);
+  s[n++] = COUNTER_SECTION(hp->gshare.bht);
+  s[n++] = SECTION(&hp->gshare.ghr, sizeof(hp->gshare.ghr));
+  s[n++] = COUNTER_SECTION(hp->choice_pht);
+  s[n++] = SECTION(&hp->ghr, sizeof(hp->ghr));
+  return n;
+}
+
+static int
+perceptron_sections(void *state, state_section *s)
+{
+  perceptron_predictor *pp = state;
+  s[0] = SECTION(pp->table, (size_t)pp->num_perceptrons * pp->stride);
+  s[1] = SECTION(pp->history, pp->stride);
+  return 2;
+}
+
+static int
+tage_sections(void *state, state_section *s)
+{
+  tage_predictor *tp = state;
+  s[0] = COUNTER_SECTION(tp->base);
+  s[1] = SECTION(tp->tables, ((size_t)tp->num_tables << tp->log_entries) * sizeof(uint16_t));
+  // The history, its folds, use_alt_on_na, tick and seed, which sit
+  // together in the struct
+  s[2] = SECTION(tp->history, offsetof(tage_predictor, cached) -
+                              offsetof(tage_predictor, history));
+  return 3;
+}
+
+static int
+perceptron_valid(const predictor_config *config)
+{
+  return config->numPerceptrons > 0;
+}
+
+static int
+tage_valid(const predictor_config *config)
+{
+  return config->tageTables > 0 && config->tageLogEntries > 0 &&
+         config->tageTagBits >= 2 && config->tageMinHistory > 0 &&
+         config->ghistoryBits >= config->tageMinHistory + config->tageTables - 1;
+}
+
+#define MAX_SPEC_FIELDS 6
+
+typedef struct {
+  const char *name;
+
+  // Shape of the spec after the name, e.g. "tournament:<g>:<l>:<p>"
+  int fields;                     // Number of numeric fields
+  int optional;                   // True if the fields may be left out entirely
+  int defaults[MAX_SPEC_FIELDS];  // Field values used when they are left out
+  int max[MAX_SPEC_FIELDS];       // Largest value allowed in each field
+  size_t member[MAX_SPEC_FIELDS]; // predictor_config member each field sets
+  int history_field;              // Field reported as the history bits, or -1
+
+  // Components a chooser picks between, for predictors that have one
+  const char *components[2];
+  void (*choice)(void *state, uint32_t pc, predictor_choice *choice);
+
+  // Print the instrumented tables' statistics; only set in INSTRUMENT builds
+  void (*report)(void *state, FILE *out);
+
+  // Expose the single 2-bit counter table, and the GHR it is indexed
+  // with (NULL if by PC alone), to the lockstep kernel; NULL otherwise
+  void (*lane)(void *state, counter_table **table, uint32_t **ghr);
+
+  // False if a parsed config cannot be built; NULL accepts every config
+  int (*valid)(const predictor_config *config);
+  uint64_t (*storage_bits)(const predictor_config *config);
+
+  // Instance state lives in the predictor's union
+  void (*init)(void *state, const predictor_config *config);
+  uint8_t (*predict)(void *state, uint32_t pc);
+  void (*train)(void *state, uint32_t pc, uint8_t outcome);
+  uint8_t (*update)(void *state, uint32_t pc, uint8_t outcome);
+  uint32_t (*run)(void *state, const uint32_t *pcs, const uint8_t *outcomes,
+                  uint8_t *predictions, size_t count);
+  void (*cleanup)(void *state);
+
+  // List the tables and registers a checkpoint saves, returning how many
+  int (*sections)(void *state, state_section *sections);
+} predictor_ops;
+
+#define MEMBER(field) offsetof(predictor_config, field)
+#define OPS(name)                                                       \
+  .storage_bits = name##_storage_bits, .init = name##_init_op,          \
+  .predict = name##_predict_op, .train = name##_train_op,               \
+  .update = name##_update_op,                                           \
+  .run = name##_run_op, .cleanup = name##_cleanup_op,              \
+  .sections = name##_sections
+
+// Every predictor, indexed by its type.  Adding a predictor means adding
+// its type above and one entry here.
+static const predictor_ops registry[] = {
+  [STATIC] = {
+    .name = "static", .history_field = -1,
+    OPS(static),
+  },
+  [GSHARE] = {
+    .name = "gshare", .fields = 1, .max = { 30 },
+    .member = { MEMBER(ghistoryBits) },
+    REPORT(gshare)
+    LANE(gshare)
+    OPS(gshare),
+  },
+  [TOURNAMENT] = {
+    .name = "tournament", .fields = 3, .max = { 30, 30, 30 },
+    .member = { MEMBER(ghistoryBits), MEMBER(lhistoryBits), MEMBER(pcIndexBits) },
+    .components = { "global", "local" },
+    .choice = tournament_choice_op,
+    REPORT(tournament)
+    OPS(tournament),
+  },
+  [CUSTOM] = {
+    .name = "custom", .history_field = -1,
+    .components = { "tournament", "gshare" },
+    .choice = hybrid_choice_op,
+    REPORT(hybrid)
+    OPS(hybrid),
+  },
+  [BIMODAL] = {
+    .name = "bimodal", .fields = 1, .optional = 1,
+    .defaults = { 12 }, .max = { 30 },
+    .member = { MEMBER(bhistoryBits) },
+    REPORT(bimodal)
+    LANE(bimodal)
+    OPS(bimodal),
+  },
+  [PERCEPTRON] = {
+    .name = "perceptron", .fields = 3, .optional = 1,
+    .defaults = { 58, 4096, 70 }, .max = { 1024, 1 << 24, 1 << 16 },
+    .member = { MEMBER(ghistoryBits), MEMBER(numPerceptrons),
+                MEMBER(perceptronThreshold) },
+    .valid = perceptron_valid,
+    OPS(perceptron),
+  },
+  [TAGE] = {
+    .name = "tage", .fields = 6, .optional = 1,
+    .defaults = { TAGE_DEFAULT_CONFIG },
+    .max = { TAGE_MAX_TABLES, 24, 11, TAGE_MAX_HISTORY, TAGE_MAX_HISTORY, 30 },
+    .member = { MEMBER(tageTables), MEMBER(tageLogEntries), MEMBER(tageTagBits),
+                MEMBER(tageMinHistory), MEMBER(ghistoryBits), MEMBER(bhistoryBits) },
+    .history_field = 4,
+    .valid = tage_valid,
+    OPS(tage),
+  },
+};
+
+#define NUM_PREDICTOR_TYPES ((int)(sizeof(registry) / sizeof(registry[0])))
+
+const char *
+predictor_type_name(int type)
+{
+  return type >= 0 && type < NUM_PREDICTOR_TYPES ? registry[type].name : NULL;
+}
+
+#ifndef PREDICTOR_BUILD_ID
+#define PREDICTOR_BUILD_ID __DATE__ " " __TIME__
+#endif
+
+const char *
+predictor_build_id(void)
+{
+  return PREDICTOR_BUILD_ID;
+}
+
+//------------------------------------//
+//        Predictor Instances         //
+//------------------------------------//
+
+struct predictor {
+  predictor_config config;
+  const predictor_ops *ops;
+  union {
+    bimodal_predictor bimodal;
+    gshare_predictor gshare;
+    tournament_predictor tournament;
+    hybrid_predictor hybrid;
+    perceptron_predictor perceptron;
+    tage_predictor tage;
+  } u;
+};
+
+static int
+get_config_field(const predictor_config *config, size_t member)
+{
+  return *(const int *)((const char *)config + member);
+}
+
+static void
+set_config_field(predictor_config *config, size_t member, int value)
+{
+  *(int *)((char *)config + member) = value;
+}
+
+// Parse one field of a spec, either "n" or "lo..hi", with values
+// limited to [0, max]
+//
+// Returns True if Successful
+//
+static int
+parse_spec_field(const char *field, int max, int *lo, int *hi)
+{
+  char *end;
+  *lo = strtol(field, &end, 10);
+  if (end == field) {
+    return 0;
+  }
+  *hi = *lo;
+  if (!strncmp(end, "..", 2)) {
+    const char *rest = end + 2;
+    *hi = strtol(rest, &end, 10);
+    if (end == rest) {
+      return 0;
+    }
+  }
+  return (*end == '\0' || *end == ':') && *lo >= 0 && *hi >= *lo && *hi <= max;
+}
+
+predictor_config *
+parse_predictor_spec(const char *spec, int *count)
+{
+  // The custom designs other than the hybrid are aliases
+  if (!strcmp(spec, "custom:hybrid")) {
+    spec = "custom";
+  } else if (!strncmp(spec, "custom:", 7)) {
+    spec += 7;
+    if (strcmp(spec, "tage") && strcmp(spec, "perceptron")) {
+      return NULL;
+    }
+  }
+
+  size_t name_len = strcspn(spec, ":");
+  int type = -1;
+  for (int t = 0; t < NUM_PREDICTOR_TYPES; t++) {
+    if (strlen(registry[t].name) == name_len &&
+        !strncmp(spec, registry[t].name, name_len)) {
+      type = t;
+    }
+  }
+  if (type < 0) {
+    return NULL;
+  }
+  const predictor_ops *ops = &registry[type];
+
+  int lo[MAX_SPEC_FIELDS], hi[MAX_SPEC_FIELDS];
+  for (int f = 0; f < MAX_SPEC_FIELDS; f++) {
+    lo[f] = hi[f] = ops->defaults[f];
+  }
+  const char *field = spec + name_len;
+  int nfields = 0;
+  while (*field == ':') {
+    field++;
+    if (nfields == ops->fields ||
+        !parse_spec_field(field, ops->max[nfields], &lo[nfields], &hi[nfields])) {
+      return NULL;
+    }
+    nfields++;
+    field += strcspn(field, ":");
+  }
+  if (*field != '\0' ||
+      (nfields != ops->fields && !(nfields == 0 && ops->optional))) {
+    return NULL;
+  }
+
+  // One config per point of the cartesian product of the ranges
+  int total = 1;
+  for (int f = 0; f < ops->fields; f++) {
+    total *= hi[f] - lo[f] + 1;
+  }
+
+  predictor_config *configs = calloc(total, sizeof(predictor_config));
+  for (int n = 0; n < total; n++) {
+    int rest = n;
+    configs[n].type = type;
+    for (int f = ops->fields - 1; f >= 0; f--) {
+      set_config_field(&configs[n], ops->member[f],
+                       lo[f] + rest % (hi[f] - lo[f] + 1));
+      rest /= hi[f] - lo[f] + 1;
+    }
+
+    // Reject configurations the predictor cannot be built with
+    if (ops->valid && !ops->valid(&configs[n])) {
+      free(configs);
+      return NULL;
+    }
+  }
+
+  *count = total;
+  return configs;
+}
+
+void
+format_predictor_spec(const predictor_config *config, char *buf, size_t len)
+{
+  const predictor_ops *ops = &registry[config->type];
+  size_t used = snprintf(buf, len, "%s", ops->name);
+  for (int f = 0; f < ops->fields && used < len; f++) {
+    used += snprintf(buf + used, len - used, ":%d",
+                     get_config_field(config, ops->member[f]));
+  }
+}
+
+int
+predictor_history_bits(const predictor_config *config)
+{
+  const predictor_ops *ops = &registry[config->type];
+  return ops->history_field < 0 ? 0 :
+         get_config_field(config, ops->member[ops->history_field]);
+}
+
+uint64_t
+predictor_storage_bits(const predictor_config *config)
+{
+  return registry[config->type].storage_bits(config);
+}
+
+predictor *
+predictor_create(const predictor_config *config)
+{
+  assert(config->type >= 0 && config->type < NUM_PREDICTOR_TYPES);
+
+  predictor *p = calloc(1, sizeof(predictor));
+  p->config = *config;
+  p->ops = &registry[config->type];
+  p->ops->init(&p->u, config);
+
+  return p;
+}
+
+uint8_t
+predictor_predict(predictor *p, uint32_t pc)
+{
+  return p->ops->predict(&p->u, pc);
+}
+
+void
+predictor_train(predictor *p, uint32_t pc, uint8_t outcome)
+{
+  p->ops->train(&p->u, pc, outcome);
+}
+
+int
+predictor_choice_components(const predictor_config *config,
+                            const char **first, const char **second)
+{
+  const predictor_ops *ops = &registry[config->type];
+  *first = ops->components[0];
+  *second = ops->components[1];
+  return ops->choice != NULL;
+}
+
+void
+predictor_peek_choice(predictor *p, uint32_t pc, predictor_choice *choice)
+{
+  assert(p->ops->choice != NULL);
+  p->ops->choice(&p->u, pc, choice);
+}
+
+uint8_t
+predictor_predict_and_update(predictor *p, uint32_t pc, uint8_t outcome)
+{
+  return p->ops->update(&p->u, pc, outcome);
+}
+
+uint32_t
+predictor_run(predictor *p, const uint32_t *pcs, const uint8_t *outcomes,
+              uint8_t *predictions, size_t count)
+{
+  return p->ops->run(&p->u, pcs, outcomes, predictions, count);
+}
+
+//------------------------------------//
+//        Lockstep Width Sweeps       //
+//------------------------------------//
+
+// Tables of up to PREDICTOR_LANES predictors of one type.  Lane k indexes
+// its table with (pc ^ ghr) & mask[k]: each gshare's GHR is the shared
+// one cut to its width, and bimodal tables are indexed with a GHR of 0.
+typedef struct {
+  uint64_t base[PREDICTOR_LANES];   // Address of each table's words
+  uint64_t mask[PREDICTOR_LANES];
+  uint64_t spare[PREDICTOR_LANES];  // Stand-in tables for unused lanes
+  int lanes;
+} lockstep_group;
+
+// Simulate a block on every lane of 'g', starting from the shared GHR.
+// 'history' masks the bits shifted into the GHR, 0 for bimodal tables.
+//
+// Returns the GHR after the block
+//
+static uint32_t
+run_lockstep(lockstep_group *g, uint32_t ghr, uint32_t history,
+             const uint32_t *pcs, const uint8_t *outcomes, size_t count,
+             uint32_t *mispredictions)
+{
+  for (int k = g->lanes; k < PREDICTOR_LANES; k++) {
+    g->base[k] = (uint64_t)(uintptr_t)&g->spare[k];
+    g->mask[k] = 0;
+  }
+
+#ifdef __AVX512F__
+  // One 64-bit lane per table: gather the word holding each lane's
+  // counter, step the counters as counter_predict_update() does, and
+  // scatter the words back.  The tables are distinct, so no two lanes
+  // share a word.
+  const __m512i base = _mm512_loadu_si512(g->base);
+  const __m512i mask = _mm512_loadu_si512(g->mask);
+  const __m512i one = _mm512_set1_epi64(1);
+  const __m512i three = _mm512_set1_epi64(3);
+  const __m512i low = _mm512_set1_epi64(COUNTERS_PER_WORD - 1);
+  __m512i wrong = _mm512_setzero_si512();
+
+  for (size_t i = 0; i < count; i++) {
+    // Outcomes other than 0 and 1 train as taken and always mispredict
+    __mmask8 up = -(__mmask8)(outcomes[i] != 0);
+    __mmask8 odd = -(__mmask8)(outcomes[i] > 1);
+    __m512i index = _mm512_and_si512(_mm512_set1_epi64(pcs[i] ^ ghr), mask);
+    __m512i addr = _mm512_add_epi64(base, _mm512_slli_epi64(_mm512_srli_epi64(index, 5), 3));
+    __m512i shift = _mm512_slli_epi64(_mm512_and_si512(index, low), 1);
+    __m512i words = _mm512_i64gather_epi64(addr, NULL, 1);
+    __m512i c = _mm512_and_si512(_mm512_srlv_epi64(words, shift), three);
+    __m512i step = _mm512_sllv_epi64(one, shift);
+
+    __mmask8 taken = _mm512_cmpgt_epu64_mask(c, one);
+    __mmask8 inc = up & _mm512_cmpneq_epu64_mask(c, three);
+    __mmask8 dec = ~up & _mm512_test_epi64_mask(c, c);
+    words = _mm512_mask_add_epi64(words, inc, words, step);
+    words = _mm512_mask_sub_epi64(words, dec, words, step);
+    _mm512_i64scatter_epi64(NULL, addr, words, 1);
+
+    wrong = _mm512_mask_add_epi64(wrong, (taken ^ up) | odd, wrong, one);
+    ghr = ((ghr << 1) | outcomes[i]) & history;
+  }
+
+  uint64_t lanes[PREDICTOR_LANES];
+  _mm512_storeu_si512(lanes, wrong);
+  for (int k = 0; k < g->lanes; k++) {
+    mispredictions[k] = lanes[k];
+  }
+#else
+  // Every table is visited for a branch before the next one, so the
+  // lanes' loads overlap
+  uint32_t wrong[PREDICTOR_LANES] = { 0 };
+  counter_table tables[PREDICTOR_LANES];
+  for (int k = 0; k < PREDICTOR_LANES; k++) {
+    tables[k].words = (uint64_t *)(uintptr_t)g->base[k];
+    tables[k].size = g->mask[k] + 1;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    uint32_t hash = pcs[i] ^ ghr;
+    for (int k = 0; k < g->lanes; k++) {
+      uint8_t prediction = counter_predict_update(&tables[k], hash & g->mask[k],
+                            outcomes[i]);
+      wrong[k] += prediction != outcomes[i];
+    }
+    ghr = ((ghr << 1) | outcomes[i]) & history;
+  }
+
+  for (int k = 0; k < g->lanes; k++) {
+    mispredictions[k] = wrong[k];
+  }
+#endif
+  return ghr;
+}
+
+// Find the table and GHR of a predictor that can join a lockstep group
+//
+// Returns False if it should run on its own
+//
+static int
+lockstep_lane(predictor *p, counter_table **table, uint32_t **ghr)
+{
+  if (!p->ops->lane) {
+    return 0;
+  }
+  p->ops->lane(&p->u, table, ghr);
+
+  // Out of cache the prefetching block loop does better
+  return (*table)->size < PREFETCH_MIN_COUNTERS;
+}
+
+int
+predictor_lockstep(const predictor_config *config)
+{
+  return registry[config->type].lane != NULL;
+}
+
+void
+predictor_run_many(predictor **predictors, int num, const uint32_t *pcs,
+                   const uint8_t *outcomes, size_t count,
+                   uint32_t *mispredictions)
+{
+  char *done = calloc(num, 1);
+
+  for (int j = 0; j < num; j++) {
+    if (done[j]) {
+      continue;
+    }
+    counter_table *table;
+    uint32_t *history;
+    if (!lockstep_lane(predictors[j], &table, &history)) {
+      mispredictions[j] = predictor_run(predictors[j], pcs, outcomes, NULL, count);
+      continue;
+    }
+
+    // Gather the next predictors of this type into a group; the widest
+    // gshare's GHR holds every narrower one's
+    lockstep_group g;
+    int members[PREDICTOR_LANES];
+    uint32_t *ghrs[PREDICTOR_LANES];
+    uint32_t ghr = 0;
+    uint64_t widest = 0;
+    g.lanes = 0;
+    for (int i = j; i < num && g.lanes < PREDICTOR_LANES; i++) {
+      counter_table *table;
+      if (done[i] || predictors[i]->ops != predictors[j]->ops ||
+          !lockstep_lane(predictors[i], &table, &ghrs[g.lanes])) {
+        continue;
+      }
+      g.base[g.lanes] = (uint64_t)(uintptr_t)table->words;
+      g.mask[g.lanes] = table->size - 1;
+      if (ghrs[g.lanes] && g.mask[g.lanes] >= widest) {
+        widest = g.mask[g.lanes];
+        ghr = *ghrs[g.lanes];
+      }
+      members[g.lanes++] = i;
+      done[i] = 1;
+    }
+
+    // A predictor whose GHR disagrees (e.g. one restored from a checkpoint)
+    // runs on its own
+    int kept = 0;
+    for (int k = 0; k < g.lanes; k++) {
+      if (ghrs[k] && *ghrs[k] != (ghr & g.mask[k])) {
+        mispredictions[members[k]] = predictor_run(predictors[members[k]], pcs,
+                                                   outcomes, NULL, count);
+        continue;
+      }
+      g.base[kept] = g.base[k];
+      g.mask[kept] = g.mask[k];
+      ghrs[kept] = ghrs[k];
+      members[kept++] = members[k];
+    }
+    g.lanes = kept;
+
+    uint32_t wrong[PREDICTOR_LANES];
+    ghr = run_lockstep(&g, ghr, ghrs[0] ? ~0u : 0, pcs, outcomes, count, wrong);
+    for (int k = 0; k < g.lanes; k++) {
+      mispredictions[members[k]] = wrong[k];
+      if (ghrs[k]) {
+        *ghrs[k] = ghr & g.mask[k];
+      }
+    }
+  }
+
+  free(done);
+}
+
+const predictor_config *
+predictor_get_config(predictor *p)
+{
+  return &p->config;
+}
+
+// Fixed part of a checkpoint, followed by the byte count of each section
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t sections;
+  char spec[64];
+} checkpoint_header;
+
+static size_t
+checkpoint_align(size_t offset)
+{
+  return (offset + CHECKPOINT_ALIGN - 1) & ~(size_t)(CHECKPOINT_ALIGN - 1);
+}
+
+int
+predictor_save(predictor *p, const char *path)
+{
+  state_section sections[MAX_STATE_SECTIONS];
+  checkpoint_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+  header.version = CHECKPOINT_VERSION;
+  header.sections = p->ops->sections(&p->u, sections);
+  format_predictor_spec(&p->config, header.spec, sizeof(header.spec));
+
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    return -1;
+  }
+  static const char padding[CHECKPOINT_ALIGN];
+  size_t offset = sizeof(header) + header.sections * sizeof(uint64_t);
+  int ok = fwrite(&header, sizeof(header), 1, f) == 1;
+  for (uint32_t i = 0; i < header.sections; i++) {
+    uint64_t bytes = sections[i].bytes;
+    ok = ok && fwrite(&bytes, sizeof(bytes), 1, f) == 1;
+  }
+  for (uint32_t i = 0; i < header.sections; i++) {
+    size_t start = checkpoint_align(offset);
+    ok = ok && fwrite(padding, 1, start - offset, f) == start - offset;
+    ok = ok && fwrite(sections[i].data, 1, sections[i].bytes, f) == sections[i].bytes;
+    offset = start + sections[i].bytes;
+  }
+  if (fclose(f) != 0 || !ok) {
+    return -1;
+  }
+  return 0;
+}
+
+// Copy the sections of the mapped checkpoint 'map' into a new predictor
+static predictor *
+checkpoint_restore(const char *map, size_t size)
+{
+  const checkpoint_header *header = (const checkpoint_header *)map;
+  if (size < sizeof(*header) ||
+      memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) ||
+      header->version != CHECKPOINT_VERSION ||
+      !memchr(header->spec, 0, sizeof(header->spec)) ||
+      header->sections > MAX_STATE_SECTIONS ||
+      size < sizeof(*header) + header->sections * sizeof(uint64_t)) {
+    return NULL;
+  }
+
+  int count;
+  predictor_config *config = parse_predictor_spec(header->spec, &count);
+  if (!config) {
+    return NULL;
+  }
+  predictor *p = count == 1 ? predictor_create(config) : NULL;
+  free(config);
+  if (!p) {
+    return NULL;
+  }
+
+  // The state must have exactly the shape the config gives it
+  state_section sections[MAX_STATE_SECTIONS];
+  const uint64_t *bytes = (const uint64_t *)(header + 1);
+  size_t offset = sizeof(*header) + header->sections * sizeof(uint64_t);
+  int ok = p->ops->sections(&p->u, sections) == (int)header->sections;
+  for (uint32_t i = 0; ok && i < header->sections; i++) {
+    offset = checkpoint_align(offset);
+    ok = bytes[i] == sections[i].bytes && offset + bytes[i] <= size;
+    if (ok) {
+      memcpy(sections[i].data, map + offset, bytes[i]);
+      offset += bytes[i];
+    }
+  }
+  if (!ok) {
+    predictor_destroy(p);
+    return NULL;
+  }
+  return p;
+}
+
+predictor *
+predictor_load(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return NULL;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    errno = EINVAL;
+    return NULL;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  predictor *p = checkpoint_restore(map, st.st_size);
+  munmap(map, st.st_size);
+  if (!p) {
+    errno = EINVAL;
+  }
+  return p;
+}
+
+int
+predictor_report_aliasing(predictor *p, FILE *out)
+{
+  if (!p->ops->report) {
+    return 0;
+  }
+  p->ops->report(&p->u, out);
+  return 1;
+}
+
+void
+predictor_destroy(predictor *p)
+{
+  p->ops->cleanup(&p->u);
+  free(p);
 }
 
 //------------------------------------//
 //        Predictor Functions         //
 //------------------------------------//
 
+// The predictor behind the functions below
+static predictor *default_predictor;
+
 // Initialize the predictor
 //
 void
 init_predictor()
 {
-  switch (bpType) {
-    case STATIC:
-	    break;
-    case BIMODAL:
-	    init_bimodal();
-	    break;
-    case GSHARE:
-	    init_gshare();
-	    break;
-    case TOURNAMENT:
-	    init_tournament();
-	    break;
-    case CUSTOM:
-	    // init_tage();
-	    // init_perceptron();
-	    init_hybrid();
-	    break;
-    default:
-	    assert(false && "Not implemented");
+  predictor_config config = { 0 };
+  config.type = bpType;
+  config.ghistoryBits = ghistoryBits;
+  config.lhistoryBits = lhistoryBits;
+  config.bhistoryBits = bhistoryBits;
+  config.pcIndexBits = pcIndexBits;
+  config.numPerceptrons = numPerceptrons;
+  config.perceptronThreshold = perceptronThreshold;
+  if (bpType == TAGE) {
+    int defaults[6] = { TAGE_DEFAULT_CONFIG };
+    config.tageTables = defaults[0];
+    config.tageLogEntries = defaults[1];
+    config.tageTagBits = defaults[2];
+    config.tageMinHistory = defaults[3];
+    config.ghistoryBits = defaults[4];
+    config.bhistoryBits = defaults[5];
   }
+  if (bpType == PERCEPTRON) {
+    // The perceptron globals are left at 0 by drivers that predate them
+    const int *defaults = registry[PERCEPTRON].defaults;
+    if (config.ghistoryBits <= 0) {
+      config.ghistoryBits = defaults[0];
+    }
+    if (config.numPerceptrons <= 0) {
+      config.numPerceptrons = defaults[1];
+    }
+    if (config.perceptronThreshold <= 0) {
+      config.perceptronThreshold = defaults[2];
+    }
+  }
+
+  default_predictor = predictor_create(&config);
 }
 
 // Make a prediction for conditional branch instruction at PC 'pc'
@@ -527,26 +2145,7 @@ init_predictor()
 uint8_t
 make_prediction(uint32_t pc)
 {
-  // Make a prediction based on the bpType
-  switch (bpType) {
-    case STATIC:
-      return TAKEN;
-    case BIMODAL:
-      return predict_bimodal(pc);
-    case GSHARE:
-      return predict_gshare(pc);
-    case TOURNAMENT:
-      return predict_tournament(pc);
-    case CUSTOM:
-      // return predict_tage(pc);
-      // return predict_perceptron(pc);
-      return predict_hybrid(pc);
-    default:
-	    assert(false && "Not implemented");
-  }
-
-  // If there is not a compatable bpType then return NOTTAKEN
-  return NOTTAKEN;
+  return predictor_predict(default_predictor, pc);
 }
 
 // Train the predictor the last executed branch at PC 'pc' and with
@@ -556,49 +2155,12 @@ make_prediction(uint32_t pc)
 void
 train_predictor(uint32_t pc, uint8_t outcome)
 {
-  switch (bpType) {
-    case STATIC:
-      break;
-    case BIMODAL:
-      train_bimodal(pc, outcome);
-      break;
-    case GSHARE:
-      train_gshare(pc, outcome);
-      break;
-    case TOURNAMENT:
-      train_tournament(pc, outcome);
-      break;
-    case CUSTOM:
-      // train_tage(pc, outcome);
-      // train_perceptron(pc, outcome);
-      train_hybrid(pc, outcome);
-      break;
-    default:
-	    assert(false && "Not implemented");
-  }
+  predictor_train(default_predictor, pc, outcome);
 }
 
 void
 cleanup_predictor()
 {
-  switch (bpType) {
-    case STATIC:
-      break;
-    case BIMODAL:
-      cleanup_bimodal();
-      break;
-    case GSHARE:
-      cleanup_gshare();
-      break;
-    case TOURNAMENT:
-      cleanup_tournament();
-      break;
-    case CUSTOM:
-      // cleanup_tage();
-      // cleanup_perceptron();
-      cleanup_hybrid();
-      break;
-    default:
-	    assert(false && "Not implemented");
-  }
+  predictor_destroy(default_predictor);
+  default_predictor = NULL;
 }
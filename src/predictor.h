@@ -9,6 +9,7 @@
 #ifndef PREDICTOR_H
 #define PREDICTOR_H
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -31,6 +32,8 @@ extern const char *email;
 #define TOURNAMENT  2
 #define CUSTOM      3
 #define BIMODAL     4
+#define PERCEPTRON  5
+#define TAGE        6
 extern const char *bpName[];
 
 // Definitions for 2-bit counters
@@ -46,13 +49,186 @@ extern int ghistoryBits; // Number of bits used for Global History
 extern int lhistoryBits; // Number of bits used for Local History
 extern int bhistoryBits; // Number of bits used for Bimodal History
 extern int pcIndexBits;  // Number of bits used for PC index
+extern int numPerceptrons;      // Number of perceptrons (weight rows)
+extern int perceptronThreshold; // Training threshold for the perceptrons
 extern int bpType;       // Branch Prediction Type
 extern int verbose;
 
+//------------------------------------//
+//      Predictor Instances           //
+//------------------------------------//
+
+// Configuration of a single predictor instance
+typedef struct {
+  int type;          // Branch Prediction Type
+  int ghistoryBits;  // Number of bits used for Global History
+  int lhistoryBits;  // Number of bits used for Local History
+  int bhistoryBits;  // Number of bits used for Bimodal History
+  int pcIndexBits;   // Number of bits used for PC index
+  int numPerceptrons;      // Number of perceptrons (weight rows)
+  int perceptronThreshold; // Training threshold for the perceptrons
+  int tageTables;          // Number of tagged TAGE tables
+  int tageLogEntries;      // log2 of the entries in each tagged table
+  int tageTagBits;         // Tag width of the tagged tables
+  int tageMinHistory;      // Shortest history length (longest is ghistoryBits)
+} predictor_config;
+
+// A predictor with its own tables and history registers, so that
+// several can be simulated side by side
+typedef struct predictor predictor;
+
+// Parse a predictor spec such as "gshare:13" or "tournament:12:11:12".
+// Any numeric field may be a range "lo..hi", in which case one config is
+// produced per value (e.g. "gshare:5..15" gives 11 configs).
+// "custom:<type>" selects one of the custom designs (hybrid, tage or
+// perceptron) with its default parameters.
+//
+// Returns a malloc'd array of '*count' configs, or NULL if the spec is
+// invalid
+//
+predictor_config *parse_predictor_spec(const char *spec, int *count);
+
+// Write the canonical spec of 'config' (e.g. "gshare:13") into 'buf'
+//
+void format_predictor_spec(const predictor_config *config, char *buf,
+                           size_t len);
+
+// The table-size parameter a sweep over 'config' varies: bhistoryBits for
+// bimodal, ghistoryBits for gshare, tournament, perceptron and TAGE,
+// 0 otherwise
+//
+int predictor_history_bits(const predictor_config *config);
+
+// Exact number of bits of state (tables and history registers) the
+// hardware for 'config' would need, for checking against a budget such
+// as the competition's 64K + 256 bits
+//
+uint64_t predictor_storage_bits(const predictor_config *config);
+
+// Name of the predictor registered as 'type' (e.g. "gshare"), or NULL
+// past the last one
+//
+const char *predictor_type_name(int type);
+
+// Identifies the predictor code of this build, so that stored results
+// are only reused by the code that produced them.  The Makefile sets it
+// to a checksum of the predictor sources; builds without it use their
+// compile time.
+//
+const char *predictor_build_id(void);
+
+// How a predictor that chooses between two components would predict a
+// branch: what each component predicts and which one its chooser picks
+typedef struct {
+  uint8_t first;          // Prediction of the first component
+  uint8_t second;         // Prediction of the second component
+  uint8_t chose_second;   // True if the chooser picks the second
+} predictor_choice;
+
+// Name the two components 'config' chooses between, e.g. "tournament"
+// and "gshare" for the custom hybrid
+//
+// Returns False if the predictor has no chooser
+//
+int predictor_choice_components(const predictor_config *config,
+                                const char **first, const char **second);
+
+// Fill 'choice' for the branch at 'pc' without training; only for
+// predictors with a chooser
+//
+void predictor_peek_choice(predictor *p, uint32_t pc, predictor_choice *choice);
+
+predictor *predictor_create(const predictor_config *config);
+uint8_t predictor_predict(predictor *p, uint32_t pc);
+void predictor_train(predictor *p, uint32_t pc, uint8_t outcome);
+
+// Predict the branch at 'pc' and train on 'outcome' in one step, looking
+// up each table once
+//
+// Returns the prediction made before training, as predictor_predict would
+//
+uint8_t predictor_predict_and_update(predictor *p, uint32_t pc, uint8_t outcome);
+
+// Predict and train on 'count' branches in order, in a loop specialized
+// for the predictor's type.  If 'predictions' is not NULL the prediction
+// for each branch is stored in it.
+//
+// Returns the number of mispredictions
+//
+uint32_t predictor_run(predictor *p, const uint32_t *pcs,
+                       const uint8_t *outcomes, uint8_t *predictions,
+                       size_t count);
+
+// Predictors predictor_run_many updates together in one pass
+#define PREDICTOR_LANES 8
+
+// Run 'num' predictors over the same 'count' branches, storing the
+// mispredictions of predictors[j] in mispredictions[j].  bimodal and
+// gshare predictors that differ only in width are simulated in lockstep,
+// PREDICTOR_LANES at a time: each branch's table indices are computed
+// from its PC and one shared GHR, and all their counters updated, with
+// SIMD gathers where the CPU has them.  Other predictors run in turn.
+//
+void predictor_run_many(predictor **predictors, int num, const uint32_t *pcs,
+                        const uint8_t *outcomes, size_t count,
+                        uint32_t *mispredictions);
+
+// Returns True if predictor_run_many simulates predictors of this
+// config's type in lockstep
+//
+int predictor_lockstep(const predictor_config *config);
+
+// Print how the branches sharing each pattern table entry interfered:
+// occupancy, distinct keys per entry, aliasing events and counter states
+//
+// Returns False if 'p' has no instrumented tables; only bimodal, gshare,
+// tournament and the custom hybrid have them, and only in builds made
+// with 'make INSTRUMENT=1'
+//
+int predictor_report_aliasing(predictor *p, FILE *out);
+
+// The config 'p' was created from
+//
+const predictor_config *predictor_get_config(predictor *p);
+
+// Checkpoint format (.bps), in host byte order so a checkpoint can be
+// mapped and copied straight into the tables:
+//
+//   header    "BPSTATE\0", u32 version, u32 section count,
+//             char[64] spec of the predictor (as format_predictor_spec),
+//             u64 byte count of each section
+//   sections  the predictor's tables and history registers, each at a
+//             CHECKPOINT_ALIGN-aligned offset
+//
+// The sections and their order depend on the predictor type.  A
+// checkpoint from a host of the other byte order fails the version check.
+#define CHECKPOINT_MAGIC   "BPSTATE"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_ALIGN   64
+
+// Save the tables and history registers of 'p' to 'path'
+//
+// Returns 0 on success, or -1 with errno set
+//
+int predictor_save(predictor *p, const char *path);
+
+// Map a checkpoint written by predictor_save and create a predictor of
+// the saved config in the saved state
+//
+// Returns NULL with errno set if the file cannot be read or is not a
+// valid checkpoint (EINVAL)
+//
+predictor *predictor_load(const char *path);
+
+void predictor_destroy(predictor *p);
+
 //------------------------------------//
 //    Predictor Function Prototypes   //
 //------------------------------------//
 
+// These operate on a single default predictor configured through the
+// global variables above
+
 // Initialize the predictor
 //
 void init_predictor();
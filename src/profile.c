@@ -0,0 +1,245 @@
+//========================================================//
+//  profile.c                                             //
+//  Per-branch profiler                                   //
+//                                                        //
+//  An open-addressing hash map from PC to the counts     //
+//  behind each branch's misprediction rate               //
+//========================================================//
+
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+// Slots start at this many and double whenever they are half full
+#define PROFILE_INITIAL_SLOTS 4096
+
+typedef struct {
+  uint32_t pc;
+  uint32_t executions;      // 0 marks an empty slot
+  uint32_t mispredictions;
+  uint32_t taken;
+  // Chooser statistics, only kept for predictors with a chooser
+  uint32_t chose_second;    // Times the chooser picked the second component
+  uint32_t first_correct;   // Times each component predicted correctly
+  uint32_t second_correct;
+  uint32_t chooser_wrong;   // Times the chooser picked the wrong component
+} profile_entry;
+
+struct profile {
+  profile_entry *slots;
+  uint32_t mask;            // Number of slots - 1
+  uint32_t used;
+  const char *first;        // Names of the chooser's components, or NULL
+  const char *second;
+};
+
+// The murmur3 finalizer mixes every bit of the PC into the low bits
+// that index the table, so aligned PCs reach every slot
+static inline uint32_t
+profile_hash(uint32_t pc)
+{
+  pc ^= pc >> 16;
+  pc *= 0x85ebca6bu;
+  pc ^= pc >> 13;
+  pc *= 0xc2b2ae35u;
+  pc ^= pc >> 16;
+  return pc;
+}
+
+profile *
+profile_create(const predictor_config *config)
+{
+  profile *prof = calloc(1, sizeof(profile));
+  prof->slots = calloc(PROFILE_INITIAL_SLOTS, sizeof(profile_entry));
+  prof->mask = PROFILE_INITIAL_SLOTS - 1;
+  if (!predictor_choice_components(config, &prof->first, &prof->second)) {
+    prof->first = prof->second = NULL;
+  }
+  return prof;
+}
+
+static void
+profile_grow(profile *prof)
+{
+  uint32_t old_slots = prof->mask + 1;
+  profile_entry *old = prof->slots;
+
+  prof->mask = 2 * old_slots - 1;
+  prof->slots = calloc(2 * old_slots, sizeof(profile_entry));
+  for (uint32_t i = 0; i < old_slots; i++) {
+    if (old[i].executions) {
+      uint32_t s = profile_hash(old[i].pc) & prof->mask;
+      while (prof->slots[s].executions) {
+        s = (s + 1) & prof->mask;
+      }
+      prof->slots[s] = old[i];
+    }
+  }
+  free(old);
+}
+
+// Find the entry for 'pc', adding it if it is new
+static profile_entry *
+profile_lookup(profile *prof, uint32_t pc)
+{
+  uint32_t s = profile_hash(pc) & prof->mask;
+  while (prof->slots[s].executions) {
+    if (prof->slots[s].pc == pc) {
+      return &prof->slots[s];
+    }
+    s = (s + 1) & prof->mask;
+  }
+
+  if (2 * (prof->used + 1) > prof->mask + 1) {
+    profile_grow(prof);
+    return profile_lookup(prof, pc);
+  }
+  prof->used++;
+  prof->slots[s].pc = pc;
+  return &prof->slots[s];
+}
+
+uint32_t
+profile_run(profile *prof, predictor *p, const uint32_t *pcs,
+            const uint8_t *outcomes, uint8_t *predictions, size_t count)
+{
+  uint32_t mispredictions = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    uint32_t pc = pcs[i];
+    uint8_t outcome = outcomes[i];
+    profile_entry *e = profile_lookup(prof, pc);
+
+    // Ask the chooser before training changes what it would pick
+    if (prof->first) {
+      predictor_choice choice;
+      predictor_peek_choice(p, pc, &choice);
+      e->chose_second += choice.chose_second;
+      e->first_correct += choice.first == outcome;
+      e->second_correct += choice.second == outcome;
+      e->chooser_wrong += choice.first != choice.second &&
+                          (choice.chose_second ? choice.second : choice.first) != outcome;
+    }
+
+    uint8_t prediction = predictor_predict_and_update(p, pc, outcome);
+    if (predictions) {
+      predictions[i] = prediction;
+    }
+    e->executions++;
+    e->taken += outcome;
+    e->mispredictions += prediction != outcome;
+    mispredictions += prediction != outcome;
+  }
+
+  return mispredictions;
+}
+
+static int
+compare_entries(const void *a, const void *b)
+{
+  const profile_entry *x = a, *y = b;
+  if (x->mispredictions != y->mispredictions) {
+    return x->mispredictions < y->mispredictions ? 1 : -1;
+  }
+  if (x->executions != y->executions) {
+    return x->executions < y->executions ? 1 : -1;
+  }
+  return x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+// Gather the used entries into an array, worst first
+static profile_entry *
+profile_sorted(profile *prof)
+{
+  profile_entry *entries = malloc((prof->used + 1) * sizeof(profile_entry));
+  uint32_t n = 0;
+  for (uint32_t i = 0; i <= prof->mask; i++) {
+    if (prof->slots[i].executions) {
+      entries[n++] = prof->slots[i];
+    }
+  }
+  qsort(entries, n, sizeof(profile_entry), compare_entries);
+  return entries;
+}
+
+static double
+percent(uint32_t part, uint32_t whole)
+{
+  return whole ? 100.0 * part / whole : 0;
+}
+
+void
+profile_report(profile *prof, FILE *out, int top)
+{
+  profile_entry *entries = profile_sorted(prof);
+  uint32_t total = 0;
+  for (uint32_t i = 0; i < prof->used; i++) {
+    total += entries[i].mispredictions;
+  }
+  if ((uint32_t)top > prof->used) {
+    top = prof->used;
+  }
+
+  fprintf(out, "\nTop %d of %u branches by mispredictions:\n", top, prof->used);
+  fprintf(out, "%-12s %10s %10s %7s %7s %7s", "PC", "Executed", "Incorrect",
+          "Misp%", "Share%", "Taken%");
+  if (prof->first) {
+    fprintf(out, " %9s %9s %9s %9s", "Chose2nd%", "1stOK%", "2ndOK%", "ChooseX%");
+  }
+  fprintf(out, "\n");
+
+  for (int i = 0; i < top; i++) {
+    const profile_entry *e = &entries[i];
+    fprintf(out, "0x%-10x %10u %10u %7.2f %7.2f %7.2f", e->pc, e->executions,
+            e->mispredictions, percent(e->mispredictions, e->executions),
+            percent(e->mispredictions, total), percent(e->taken, e->executions));
+    if (prof->first) {
+      fprintf(out, " %9.2f %9.2f %9.2f %9.2f",
+              percent(e->chose_second, e->executions),
+              percent(e->first_correct, e->executions),
+              percent(e->second_correct, e->executions),
+              percent(e->chooser_wrong, e->executions));
+    }
+    fprintf(out, "\n");
+  }
+  if (prof->first) {
+    fprintf(out, "1st = %s, 2nd = %s; ChooseX%% counts branches where the "
+            "chooser picked the wrong component\n", prof->first, prof->second);
+  }
+
+  free(entries);
+}
+
+void
+profile_write_csv(profile *prof, FILE *out)
+{
+  profile_entry *entries = profile_sorted(prof);
+
+  fprintf(out, "pc,executions,mispredictions,misp_rate,taken_rate");
+  if (prof->first) {
+    fprintf(out, ",chose_%s,%s_correct,%s_correct,chooser_wrong",
+            prof->second, prof->first, prof->second);
+  }
+  fprintf(out, "\n");
+
+  for (uint32_t i = 0; i < prof->used; i++) {
+    const profile_entry *e = &entries[i];
+    fprintf(out, "0x%x,%u,%u,%.3f,%.3f", e->pc, e->executions, e->mispredictions,
+            percent(e->mispredictions, e->executions),
+            percent(e->taken, e->executions));
+    if (prof->first) {
+      fprintf(out, ",%u,%u,%u,%u", e->chose_second, e->first_correct,
+              e->second_correct, e->chooser_wrong);
+    }
+    fprintf(out, "\n");
+  }
+
+  free(entries);
+}
+
+void
+profile_destroy(profile *prof)
+{
+  free(prof->slots);
+  free(prof);
+}
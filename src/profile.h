@@ -0,0 +1,42 @@
+//========================================================//
+//  profile.h                                             //
+//  Header file for the per-branch profiler               //
+//                                                        //
+//  Keeps executions and mispredictions for every static  //
+//  branch, and for predictors with a chooser, which      //
+//  component it picked and which one was right           //
+//========================================================//
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "predictor.h"
+
+typedef struct profile profile;
+
+// Start an empty profile of branches predicted by 'config'
+//
+profile *profile_create(const predictor_config *config);
+
+// Run 'p' over a block of branches as predictor_run() does, recording
+// every branch in the profile
+//
+// Returns the number of mispredictions in the block
+//
+uint32_t profile_run(profile *prof, predictor *p, const uint32_t *pcs,
+                     const uint8_t *outcomes, uint8_t *predictions, size_t count);
+
+// Print the 'top' branches with the most mispredictions as a table
+//
+void profile_report(profile *prof, FILE *out, int top);
+
+// Write every branch, worst first, as CSV
+//
+void profile_write_csv(profile *prof, FILE *out);
+
+void profile_destroy(profile *prof);
+
+#endif
@@ -0,0 +1,504 @@
+//========================================================//
+//  sample.c                                              //
+//  Sampled and parallel simulation                       //
+//                                                        //
+//  Phase sampling clusters per-interval PC signatures    //
+//  with k-means; chunked simulation splits a decoded     //
+//  trace into warmed segments run on the thread pool     //
+//========================================================//
+
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sample.h"
+
+//------------------------------------//
+//         SimPoint Sampling          //
+//------------------------------------//
+
+// An interval's signature counts its branches in this many buckets of PC
+// hashes, a fixed-size stand-in for the full per-PC execution vector.
+// The bucket is the top bits of the PC's Fibonacci hash, which depend on
+// all of its bits.
+#define SIMPOINT_DIM_BITS 5
+#define SIMPOINT_DIMS (1 << SIMPOINT_DIM_BITS)
+#define SIMPOINT_MAX_ITERATIONS 100
+#define SIMPOINT_SEED 0x9e3779b97f4a7c15ULL
+
+typedef struct {
+  float signature[SIMPOINT_DIMS];   // Share of the branches in each bucket
+  uint64_t branches;
+  int phase;
+} simpoint_interval;
+
+// An interval picked for simulation
+typedef struct {
+  int interval;
+  int phase;
+  int representative;       // Nearest the centroid, rather than the error sample
+  uint64_t warm_start;      // First branch of the warm-up
+  uint64_t start;           // First branch counted
+  uint64_t end;
+  predictor **predictors;   // One per config while the sample is being run
+  uint64_t *mispredictions;
+} simpoint_sample;
+
+static inline uint64_t
+simpoint_random(uint64_t *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+static float
+simpoint_distance(const float *a, const float *b)
+{
+  float d = 0;
+  for (int i = 0; i < SIMPOINT_DIMS; i++) {
+    d += (a[i] - b[i]) * (a[i] - b[i]);
+  }
+  return d;
+}
+
+// Close the current interval, turning its bucket counts into shares
+static simpoint_interval *
+simpoint_close_interval(simpoint_interval *intervals, int *count,
+                        uint64_t *counts, uint64_t branches)
+{
+  intervals = realloc(intervals, (*count + 1) * sizeof(simpoint_interval));
+  simpoint_interval *iv = &intervals[(*count)++];
+  for (int d = 0; d < SIMPOINT_DIMS; d++) {
+    iv->signature[d] = (float)counts[d] / branches;
+    counts[d] = 0;
+  }
+  iv->branches = branches;
+  return intervals;
+}
+
+// Read the trace once and record every interval's signature; the last
+// interval may be short
+//
+static simpoint_interval *
+simpoint_profile(trace_reader *trace, uint64_t interval, int *count,
+                 uint64_t *branches)
+{
+  static uint32_t pcs[TRACE_BLOCK_SIZE];
+  static uint8_t outcomes[TRACE_BLOCK_SIZE];
+  simpoint_interval *intervals = NULL;
+  uint64_t counts[SIMPOINT_DIMS] = { 0 };
+  uint64_t in_interval = 0;
+  size_t n;
+
+  *count = 0;
+  *branches = 0;
+  while ((n = trace_read_block(trace, pcs, outcomes, TRACE_BLOCK_SIZE))) {
+    for (size_t i = 0; i < n; i++) {
+      counts[(uint32_t)(pcs[i] * 2654435769u) >> (32 - SIMPOINT_DIM_BITS)]++;
+      if (++in_interval == interval) {
+        intervals = simpoint_close_interval(intervals, count, counts, interval);
+        in_interval = 0;
+      }
+    }
+    *branches += n;
+  }
+  if (in_interval > 0) {
+    intervals = simpoint_close_interval(intervals, count, counts, in_interval);
+  }
+  return intervals;
+}
+
+// Group the intervals into at most 'k' phases with k-means, seeded by
+// k-means++ from a fixed seed so runs are repeatable.  Leaves each
+// interval's phase and 'centroids' filled in.
+//
+// Returns the number of phases, after dropping empty clusters
+//
+static int
+simpoint_cluster(simpoint_interval *intervals, int n, int k,
+                 float (*centroids)[SIMPOINT_DIMS])
+{
+  uint64_t seed = SIMPOINT_SEED;
+  float *nearest = malloc(n * sizeof(float));
+  if (k > n) {
+    k = n;
+  }
+
+  // k-means++: each further centroid is an interval picked with
+  // probability proportional to its squared distance from the nearest
+  memcpy(centroids[0], intervals[simpoint_random(&seed) % n].signature,
+         sizeof(centroids[0]));
+  for (int c = 1; c < k; c++) {
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+      nearest[i] = FLT_MAX;
+      for (int j = 0; j < c; j++) {
+        float d = simpoint_distance(intervals[i].signature, centroids[j]);
+        nearest[i] = d < nearest[i] ? d : nearest[i];
+      }
+      total += nearest[i];
+    }
+    double target = (simpoint_random(&seed) >> 11) * (1.0 / (1ull << 53)) * total;
+    int pick = n - 1;
+    for (int i = 0; i < n; i++) {
+      if ((target -= nearest[i]) < 0) {
+        pick = i;
+        break;
+      }
+    }
+    memcpy(centroids[c], intervals[pick].signature, sizeof(centroids[c]));
+  }
+  free(nearest);
+
+  // Lloyd iterations until no interval changes phase
+  for (int i = 0; i < n; i++) {
+    intervals[i].phase = -1;
+  }
+  for (int iteration = 0; iteration < SIMPOINT_MAX_ITERATIONS; iteration++) {
+    int changed = 0;
+    for (int i = 0; i < n; i++) {
+      int best = 0;
+      float best_d = FLT_MAX;
+      for (int c = 0; c < k; c++) {
+        float d = simpoint_distance(intervals[i].signature, centroids[c]);
+        if (d < best_d) {
+          best_d = d;
+          best = c;
+        }
+      }
+      changed += intervals[i].phase != best;
+      intervals[i].phase = best;
+    }
+    if (!changed) {
+      break;
+    }
+
+    int *members = calloc(k, sizeof(int));
+    memset(centroids, 0, k * sizeof(centroids[0]));
+    for (int i = 0; i < n; i++) {
+      members[intervals[i].phase]++;
+      for (int d = 0; d < SIMPOINT_DIMS; d++) {
+        centroids[intervals[i].phase][d] += intervals[i].signature[d];
+      }
+    }
+    for (int c = 0; c < k; c++) {
+      for (int d = 0; members[c] && d < SIMPOINT_DIMS; d++) {
+        centroids[c][d] /= members[c];
+      }
+    }
+    free(members);
+  }
+
+  // Renumber the phases that kept members
+  int *renumber = malloc(k * sizeof(int));
+  float (*kept)[SIMPOINT_DIMS] = malloc(k * sizeof(*kept));
+  int phases = 0;
+  for (int c = 0; c < k; c++) {
+    renumber[c] = -1;
+  }
+  for (int i = 0; i < n; i++) {
+    int c = intervals[i].phase;
+    if (renumber[c] < 0) {
+      renumber[c] = phases;
+      memcpy(kept[phases++], centroids[c], sizeof(kept[0]));
+    }
+    intervals[i].phase = renumber[c];
+  }
+  memcpy(centroids, kept, phases * sizeof(kept[0]));
+  free(kept);
+  free(renumber);
+  return phases;
+}
+
+static int
+compare_samples(const void *a, const void *b)
+{
+  return ((const simpoint_sample *)a)->interval - ((const simpoint_sample *)b)->interval;
+}
+
+// Choose the representative of each phase and, where the phase has more
+// than one interval, another of its intervals at random for the error
+//
+// Returns the samples in trace order, '*count' of them
+//
+static simpoint_sample *
+simpoint_choose(const simpoint_interval *intervals, int n, int phases,
+                float (*centroids)[SIMPOINT_DIMS], int *count)
+{
+  simpoint_sample *samples = calloc(2 * phases, sizeof(simpoint_sample));
+  uint64_t seed = SIMPOINT_SEED;
+  *count = 0;
+
+  for (int p = 0; p < phases; p++) {
+    int representative = -1, members = 0;
+    float best_d = FLT_MAX;
+    for (int i = 0; i < n; i++) {
+      if (intervals[i].phase != p) {
+        continue;
+      }
+      members++;
+      float d = simpoint_distance(intervals[i].signature, centroids[p]);
+      if (d < best_d) {
+        best_d = d;
+        representative = i;
+      }
+    }
+    samples[*count].interval = representative;
+    samples[*count].phase = p;
+    samples[(*count)++].representative = 1;
+
+    if (members < 2) {
+      continue;
+    }
+    int other = simpoint_random(&seed) % (members - 1);
+    for (int i = 0; i < n; i++) {
+      if (intervals[i].phase == p && i != representative && other-- == 0) {
+        samples[*count].interval = i;
+        samples[(*count)++].phase = p;
+        break;
+      }
+    }
+  }
+
+  qsort(samples, *count, sizeof(simpoint_sample), compare_samples);
+  return samples;
+}
+
+// Read the trace again, simulating only the samples and the warm-up
+// before each one, and seeking past the rest
+//
+static void
+simpoint_simulate(trace_reader *trace, simpoint_sample *samples, int count,
+                  const predictor_config *configs, int num_configs)
+{
+  static uint32_t pcs[TRACE_BLOCK_SIZE];
+  static uint8_t outcomes[TRACE_BLOCK_SIZE];
+  uint64_t pos = 0;
+  int first = 0;            // First sample not yet finished
+  size_t n;
+
+  while (first < count) {
+    // Between samples, skip to the next warm-up; an indexed bzip2 trace
+    // jumps there without decoding the branches in between
+    if (samples[first].warm_start > pos) {
+      if (trace_seek(trace, samples[first].warm_start) != 0) {
+        break;
+      }
+      pos = samples[first].warm_start;
+    }
+    if (!(n = trace_read_block(trace, pcs, outcomes, TRACE_BLOCK_SIZE))) {
+      break;
+    }
+    uint64_t block_end = pos + n;
+
+    for (int s = first; s < count && samples[s].warm_start < block_end; s++) {
+      simpoint_sample *sample = &samples[s];
+      if (sample->end <= pos) {
+        continue;
+      }
+      if (!sample->predictors) {
+        sample->predictors = malloc(num_configs * sizeof(predictor *));
+        for (int c = 0; c < num_configs; c++) {
+          sample->predictors[c] = predictor_create(&configs[c]);
+        }
+      }
+
+      // The part of the block in the warm-up, then the part counted
+      uint64_t a = sample->warm_start > pos ? sample->warm_start : pos;
+      uint64_t b = sample->start < block_end ? sample->start : block_end;
+      uint64_t e = sample->end < block_end ? sample->end : block_end;
+      for (int c = 0; c < num_configs; c++) {
+        if (a < b) {
+          predictor_run(sample->predictors[c], pcs + (a - pos), outcomes + (a - pos),
+                        NULL, b - a);
+        }
+        uint64_t m = a > b ? a : b;
+        if (m < e) {
+          sample->mispredictions[c] +=
+            predictor_run(sample->predictors[c], pcs + (m - pos), outcomes + (m - pos),
+                          NULL, e - m);
+        }
+      }
+
+      if (sample->end <= block_end) {
+        for (int c = 0; c < num_configs; c++) {
+          predictor_destroy(sample->predictors[c]);
+        }
+        free(sample->predictors);
+        sample->predictors = NULL;
+      }
+    }
+    while (first < count && samples[first].end <= block_end) {
+      first++;
+    }
+    pos = block_end;
+  }
+}
+
+int
+simpoint_run(const char *path, const predictor_config *configs,
+             int num_configs, const simpoint_options *options,
+             simpoint_result *results, uint64_t *branches,
+             int *intervals, int *phases)
+{
+  if (!path || !strcmp(path, "-")) {
+    errno = ESPIPE;
+    return -1;
+  }
+
+  trace_reader *trace = trace_open(path);
+  if (!trace) {
+    return -1;
+  }
+  simpoint_interval *iv = simpoint_profile(trace, options->interval, intervals,
+                                           branches);
+  trace_close(trace);
+
+  int n = *intervals;
+  memset(results, 0, num_configs * sizeof(simpoint_result));
+  *phases = 0;
+  if (n == 0) {
+    return 0;
+  }
+
+  float (*centroids)[SIMPOINT_DIMS] = malloc(options->phases * sizeof(*centroids));
+  *phases = simpoint_cluster(iv, n, options->phases, centroids);
+  int count;
+  simpoint_sample *samples = simpoint_choose(iv, n, *phases, centroids, &count);
+  free(centroids);
+
+  // Interval i starts where the ones before it end
+  uint64_t *starts = malloc((n + 1) * sizeof(uint64_t));
+  starts[0] = 0;
+  for (int i = 0; i < n; i++) {
+    starts[i + 1] = starts[i] + iv[i].branches;
+  }
+  for (int s = 0; s < count; s++) {
+    samples[s].start = starts[samples[s].interval];
+    samples[s].end = starts[samples[s].interval + 1];
+    samples[s].warm_start = samples[s].start > options->warmup
+                          ? samples[s].start - options->warmup : 0;
+    samples[s].mispredictions = calloc(num_configs, sizeof(uint64_t));
+  }
+  free(starts);
+
+  if (!(trace = trace_open(path))) {
+    return -1;
+  }
+  simpoint_simulate(trace, samples, count, configs, num_configs);
+  trace_close(trace);
+
+  // Each phase weighs its share of the trace's branches
+  double *weights = calloc(*phases, sizeof(double));
+  for (int i = 0; i < n; i++) {
+    weights[iv[i].phase] += (double)iv[i].branches / *branches;
+  }
+
+  // A warm-up may overlap the sample before it, so each branch simulated
+  // is counted once, walking the samples in trace order
+  uint64_t simulated = 0, covered = 0;
+  for (int s = 0; s < count; s++) {
+    uint64_t from = samples[s].warm_start > covered ? samples[s].warm_start : covered;
+    if (samples[s].end > from) {
+      simulated += samples[s].end - from;
+      covered = samples[s].end;
+    }
+  }
+
+  // The representative gives each phase's rate; the difference from the
+  // other sample estimates the spread of rates within the phase
+  for (int c = 0; c < num_configs; c++) {
+    double variance = 0;
+    results[c].simulated = simulated;
+    for (int s = 0; s < count; s++) {
+      const simpoint_sample *sample = &samples[s];
+      double rate = 100.0 * sample->mispredictions[c] / (sample->end - sample->start);
+      if (!sample->representative) {
+        continue;
+      }
+      double w = weights[sample->phase];
+      results[c].misp_rate += w * rate;
+      for (int o = 0; o < count; o++) {
+        if (samples[o].phase == sample->phase && !samples[o].representative) {
+          double other = 100.0 * samples[o].mispredictions[c] /
+                         (samples[o].end - samples[o].start);
+          variance += w * w * (rate - other) * (rate - other) / 2;
+        }
+      }
+    }
+    results[c].error = sqrt(variance);
+  }
+
+  for (int s = 0; s < count; s++) {
+    free(samples[s].mispredictions);
+  }
+  free(samples);
+  free(weights);
+  free(iv);
+  return 0;
+}
+
+//------------------------------------//
+//         Chunked Simulation         //
+//------------------------------------//
+
+typedef struct {
+  const predictor_config *config;
+  const trace_buffer *trace;
+  size_t warm_start;
+  size_t start;
+  size_t end;
+  uint64_t mispredictions;
+} chunk_job;
+
+// predictor_run() counts in 32 bits, so long ranges go in pieces
+#define CHUNK_PIECE ((size_t)1 << 30)
+
+static uint64_t
+run_range(predictor *p, const trace_buffer *t, size_t start, size_t end)
+{
+  uint64_t mispredictions = 0;
+  for (size_t i = start; i < end; i += CHUNK_PIECE) {
+    size_t n = end - i < CHUNK_PIECE ? end - i : CHUNK_PIECE;
+    mispredictions += predictor_run(p, t->pcs + i, t->outcomes + i, NULL, n);
+  }
+  return mispredictions;
+}
+
+static void
+run_chunk(void *arg)
+{
+  chunk_job *job = arg;
+  predictor *p = predictor_create(job->config);
+
+  run_range(p, job->trace, job->warm_start, job->start);
+  job->mispredictions = run_range(p, job->trace, job->start, job->end);
+  predictor_destroy(p);
+}
+
+uint64_t
+chunked_run(pool *workers, const predictor_config *config,
+            const trace_buffer *trace, int chunks, uint64_t warmup)
+{
+  chunk_job *jobs = calloc(chunks, sizeof(chunk_job));
+  for (int c = 0; c < chunks; c++) {
+    chunk_job *job = &jobs[c];
+    job->config = config;
+    job->trace = trace;
+    job->start = trace->count * c / chunks;
+    job->end = trace->count * (c + 1) / chunks;
+    job->warm_start = job->start > warmup ? job->start - warmup : 0;
+    pool_submit(workers, run_chunk, job);
+  }
+  pool_wait(workers);
+
+  uint64_t mispredictions = 0;
+  for (int c = 0; c < chunks; c++) {
+    mispredictions += jobs[c].mispredictions;
+  }
+  free(jobs);
+  return mispredictions;
+}
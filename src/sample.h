@@ -0,0 +1,64 @@
+//========================================================//
+//  sample.h                                              //
+//  Header file for sampled and parallel simulation       //
+//                                                        //
+//  SimPoint-style phase sampling, and chunked simulation //
+//  of one trace on several threads                       //
+//========================================================//
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+#include "pool.h"
+#include "predictor.h"
+#include "trace.h"
+
+//------------------------------------//
+//         SimPoint Sampling          //
+//------------------------------------//
+
+typedef struct {
+  int phases;               // Most clusters to group the intervals into
+  uint64_t interval;        // Branches per interval
+  uint64_t warmup;          // Branches trained on before each sampled interval
+} simpoint_options;
+
+typedef struct {
+  double misp_rate;         // Weighted misprediction rate, in percent
+  double error;             // Standard error of misp_rate, in percent
+  uint64_t simulated;       // Branches of the trace simulated, warm-ups included
+} simpoint_result;
+
+// Estimate the misprediction rate of every config over the trace at
+// 'path' from a sample of it.  A first pass profiles each interval's
+// branch PCs and clusters the intervals into phases; a second simulates
+// the interval nearest each phase's centroid, after 'warmup' branches
+// of functional warm-up, and weights it by the phase's share of the
+// trace.  One more interval of each phase is simulated to estimate the
+// error.  '*branches' and '*intervals' receive the size of the trace and
+// '*phases' the number of phases found.
+//
+// Returns 0 on success, -1 (with errno set) if the trace cannot be read;
+// the trace is read twice, so it cannot be STDIN
+//
+int simpoint_run(const char *path, const predictor_config *configs,
+                 int num_configs, const simpoint_options *options,
+                 simpoint_result *results, uint64_t *branches,
+                 int *intervals, int *phases);
+
+//------------------------------------//
+//         Chunked Simulation         //
+//------------------------------------//
+
+// Simulate 'config' over 'trace' as 'chunks' contiguous segments on the
+// pool's threads.  Each segment gets its own predictor, trained on up to
+// 'warmup' branches before the segment, so the result differs from a
+// serial run only by what that warm-up misses.
+//
+// Returns the mispredictions summed over the segments
+//
+uint64_t chunked_run(pool *workers, const predictor_config *config,
+                     const trace_buffer *trace, int chunks, uint64_t warmup);
+
+#endif
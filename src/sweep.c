@@ -0,0 +1,453 @@
+//========================================================//
+//  sweep.c                                               //
+//  Parallel parameter sweep driver                       //
+//                                                        //
+//  Runs every (trace, predictor) pair of a sweep on a    //
+//  work-stealing thread pool and writes the results as   //
+//  TESTCASE,history_bits,misp_rate for visualize.py      //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+#include "dist.h"
+#include "pool.h"
+#include "predictor.h"
+#include "trace.h"
+
+// Trace files picked up from the trace directory
+static const char *trace_suffixes[] = {
+  ".bz2", ".gz", ".zst", ".bpt", ".txt",
+};
+
+typedef struct {
+  char *name;               // File name, used as the TESTCASE column
+  char *path;
+  trace_buffer branches;    // Shared read-only by every job on this trace
+  uint64_t count;           // Branches in the trace, decoded or cached
+  char digest[CACHE_DIGEST_CHARS + 1];
+  int missing;              // Configs not found in the result cache
+} sweep_trace;
+
+// Configs of bimodal or gshare that differ only in width share a job,
+// which simulates them in lockstep
+typedef struct {
+  sweep_trace *trace;
+  const predictor_config *configs;
+  int count;
+  uint32_t *mispredictions; // One per config
+} sweep_job;
+
+// What is known of each (trace, config) result
+enum { RESULT_PENDING = 0, RESULT_CACHED, RESULT_SIMULATED };
+
+sweep_trace *traces = NULL;
+int num_traces = 0;
+predictor_config *configs = NULL;
+int num_configs = 0;
+
+// Results in output order, trace-major; rows are written as soon as
+// every row before them is known
+uint32_t *results = NULL;
+char *state = NULL;
+int num_results = 0;
+int next_row = 0;
+FILE *out = NULL;
+result_cache *cache = NULL;
+
+// Print out the Usage information to stderr
+//
+void
+usage()
+{
+  fprintf(stderr,"Usage: sweep <options> <trace directory> --<type>...\n");
+  fprintf(stderr," Options:\n");
+  fprintf(stderr," --help          Print this message\n");
+  fprintf(stderr," --threads=<n>   Number of worker threads (default: one per CPU)\n");
+  fprintf(stderr," --output=<file> Write the CSV to <file> instead of stdout\n");
+  fprintf(stderr," --budget=<bits> Skip predictors whose storage exceeds <bits>\n");
+  fprintf(stderr," --cache=<file>  Reuse the results stored in <file> and add new ones,\n"
+                 "                 simulating only the points not found there\n");
+  fprintf(stderr," --listen=<port> Coordinate: hand the jobs to predictor processes\n"
+                 "                 started with --worker=<host>:<port>, on this or\n"
+                 "                 other machines sharing the traces' paths.  The\n"
+                 "                 port is open to any host and unauthenticated\n");
+  fprintf(stderr," --spawn=<n>     Coordinate, starting <n> local workers (any free\n"
+                 "                 loopback port unless --listen is given)\n");
+  fprintf(stderr," --retries=<n>   Retry a job whose worker fails or disconnects up to\n"
+                 "                 <n> times (default: 2)\n");
+  fprintf(stderr," --timeout=<s>   Take a job back from a worker that holds it for\n"
+                 "                 more than <s> seconds (default: no limit)\n");
+  fprintf(stderr," --<type>        Predictors to sweep, as accepted by predictor,\n"
+                 "                 e.g. --gshare:5..15 --bimodal:10..16, or\n"
+                 "                 --predictor=<type>[:<args>]\n");
+}
+
+static int
+has_trace_suffix(const char *name)
+{
+  size_t len = strlen(name);
+  for (size_t i = 0; i < sizeof(trace_suffixes) / sizeof(trace_suffixes[0]); i++) {
+    size_t n = strlen(trace_suffixes[i]);
+    if (len > n && !strcmp(name + len - n, trace_suffixes[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int
+compare_traces(const void *a, const void *b)
+{
+  return strcmp(((const sweep_trace *)a)->name, ((const sweep_trace *)b)->name);
+}
+
+// Collect the traces in 'dir', sorted by name so the output order does
+// not depend on the directory order
+//
+static void
+find_traces(const char *dir)
+{
+  DIR *d = opendir(dir);
+  if (!d) {
+    perror(dir);
+    exit(1);
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(d))) {
+    if (entry->d_name[0] == '.' || !has_trace_suffix(entry->d_name)) {
+      continue;
+    }
+    traces = realloc(traces, (num_traces + 1) * sizeof(sweep_trace));
+    sweep_trace *t = &traces[num_traces++];
+    memset(t, 0, sizeof(*t));
+    t->name = strdup(entry->d_name);
+    t->path = malloc(strlen(dir) + strlen(entry->d_name) + 2);
+    sprintf(t->path, "%s/%s", dir, entry->d_name);
+  }
+  closedir(d);
+
+  qsort(traces, num_traces, sizeof(sweep_trace), compare_traces);
+}
+
+static void
+load_trace(void *arg)
+{
+  sweep_trace *t = arg;
+  if (trace_load(t->path, &t->branches) != 0) {
+    perror(t->path);
+    exit(1);
+  }
+}
+
+static void
+run_job(void *arg)
+{
+  sweep_job *job = arg;
+  const trace_buffer *b = &job->trace->branches;
+  predictor *p[PREDICTOR_LANES];
+  for (int c = 0; c < job->count; c++) {
+    p[c] = predictor_create(&job->configs[c]);
+  }
+
+  predictor_run_many(p, job->count, b->pcs, b->outcomes, b->count,
+                     job->mispredictions);
+  for (int c = 0; c < job->count; c++) {
+    predictor_destroy(p[c]);
+  }
+}
+
+static void
+write_rows()
+{
+  for (; next_row < num_results && state[next_row]; next_row++) {
+    const sweep_trace *t = &traces[next_row / num_configs];
+    float mispredict_rate = 100*((float)results[next_row] / (float)t->count);
+    fprintf(out, "%s,%d,%.3f\n", t->name,
+            predictor_history_bits(&configs[next_row % num_configs]),
+            mispredict_rate);
+  }
+  fflush(out);
+}
+
+// Record the results of a finished job, in the cache and in the CSV
+//
+static void
+finish_job(const sweep_job *job)
+{
+  int first = job->mispredictions - results;
+  for (int c = 0; c < job->count; c++) {
+    state[first + c] = RESULT_SIMULATED;
+    if (cache) {
+      cache_store(cache, job->trace->digest, &job->configs[c], job->trace->count,
+                  job->mispredictions[c]);
+    }
+  }
+  write_rows();
+}
+
+static void
+dist_done(const dist_job *work, int index, void *arg)
+{
+  sweep_job *job = (sweep_job *)arg + index;
+  job->trace->count = work->branches;
+  finish_job(job);
+}
+
+// Parse a whole decimal number within [min, max] into '*value'
+//
+// Returns True if Successful
+//
+static int
+parse_int(const char *arg, long min, long max, int *value)
+{
+  char *end;
+  long n = strtol(arg, &end, 10);
+  if (end == arg || *end || n < min || n > max) {
+    return 0;
+  }
+  *value = n;
+  return 1;
+}
+
+// Returns the predictor binary beside this one, for the local workers
+//
+static char *
+worker_path(const char *self)
+{
+  const char *slash = strrchr(self, '/');
+  if (!slash) {
+    return strdup("predictor");
+  }
+  char *path = malloc(slash - self + sizeof("/predictor"));
+  sprintf(path, "%.*s/predictor", (int)(slash - self), self);
+  return path;
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *dir = NULL;
+  const char *output = NULL;
+  const char *cache_path = NULL;
+  int threads = 0;
+  uint64_t budget = 0;
+  int distributed = 0;
+  dist_options dist = { 0, 0, 0, NULL, 2, 0 };
+
+  // Process cmdline Arguments
+  for (int i = 1; i < argc; ++i) {
+    int ok = 1;
+    if (!strcmp(argv[i],"--help")) {
+      usage();
+      exit(0);
+    } else if (!strncmp(argv[i],"--threads=",10)) {
+      ok = parse_int(argv[i] + 10, 0, 4096, &threads);
+    } else if (!strncmp(argv[i],"--output=",9)) {
+      output = argv[i] + 9;
+    } else if (!strncmp(argv[i],"--budget=",9)) {
+      char *end;
+      budget = strtoull(argv[i] + 9, &end, 10);
+      ok = end != argv[i] + 9 && !*end;
+    } else if (!strncmp(argv[i],"--cache=",8)) {
+      cache_path = argv[i] + 8;
+    } else if (!strncmp(argv[i],"--listen=",9)) {
+      ok = parse_int(argv[i] + 9, 0, 65535, &dist.port);
+      dist.remote = 1;
+      distributed = 1;
+    } else if (!strncmp(argv[i],"--spawn=",8)) {
+      ok = parse_int(argv[i] + 8, 1, 4096, &dist.spawn);
+      distributed = 1;
+    } else if (!strncmp(argv[i],"--retries=",10)) {
+      ok = parse_int(argv[i] + 10, 0, INT_MAX, &dist.retries);
+    } else if (!strncmp(argv[i],"--timeout=",10)) {
+      ok = parse_int(argv[i] + 10, 0, INT_MAX, &dist.timeout);
+    } else if (!strncmp(argv[i],"--",2)) {
+      const char *spec = strncmp(argv[i], "--predictor=", 12) ? argv[i] + 2 : argv[i] + 12;
+      int count;
+      predictor_config *parsed = parse_predictor_spec(spec, &count);
+      if (!parsed) {
+        printf("Unrecognized option %s\n", argv[i]);
+        usage();
+        exit(1);
+      }
+      configs = realloc(configs, (num_configs + count) * sizeof(predictor_config));
+      memcpy(configs + num_configs, parsed, count * sizeof(predictor_config));
+      num_configs += count;
+      free(parsed);
+    } else {
+      dir = argv[i];
+    }
+    if (!ok) {
+      printf("Unrecognized option %s\n", argv[i]);
+      usage();
+      exit(1);
+    }
+  }
+
+  // Prune configurations over the storage budget before simulating
+  if (budget > 0) {
+    int kept = 0;
+    for (int c = 0; c < num_configs; c++) {
+      if (predictor_storage_bits(&configs[c]) <= budget) {
+        configs[kept++] = configs[c];
+      }
+    }
+    if (kept < num_configs) {
+      fprintf(stderr, "sweep: skipping %d configs over the %llu bit budget\n",
+              num_configs - kept, (unsigned long long)budget);
+    }
+    if (kept == 0 && num_configs > 0) {
+      fprintf(stderr, "sweep: no predictor fits the budget\n");
+      exit(1);
+    }
+    num_configs = kept;
+  }
+
+  if (!dir || num_configs == 0) {
+    usage();
+    exit(1);
+  }
+
+  out = stdout;
+  if (output && !(out = fopen(output, "w"))) {
+    perror(output);
+    exit(1);
+  }
+
+  find_traces(dir);
+  if (num_traces == 0) {
+    fprintf(stderr, "sweep: no traces found in %s\n", dir);
+    exit(1);
+  }
+
+  // Points already in the result cache are neither decoded nor simulated
+  num_results = num_traces * num_configs;
+  results = calloc(num_results, sizeof(uint32_t));
+  state = calloc(num_results, 1);
+  if (cache_path && !(cache = cache_open(cache_path))) {
+    perror(cache_path);
+    exit(1);
+  }
+  for (int t = 0; t < num_traces; t++) {
+    sweep_trace *trace = &traces[t];
+    trace->missing = num_configs;
+    if (!cache) {
+      continue;
+    }
+    if (cache_digest_file(trace->path, trace->digest) != 0) {
+      perror(trace->path);
+      exit(1);
+    }
+    for (int c = 0; c < num_configs; c++) {
+      uint64_t mispredictions;
+      if (cache_lookup(cache, trace->digest, &configs[c], &trace->count,
+                       &mispredictions)) {
+        results[t * num_configs + c] = mispredictions;
+        state[t * num_configs + c] = RESULT_CACHED;
+        trace->missing--;
+      }
+    }
+  }
+
+  fprintf(out, "TESTCASE,history_bits,misp_rate\n");
+  write_rows();
+
+  // One job per (trace, config), or per run of up to PREDICTOR_LANES
+  // configs that can share a pass; results land in a fixed slot so the
+  // output order is independent of scheduling
+  sweep_job *jobs = calloc(num_results, sizeof(sweep_job));
+  int num_jobs = 0;
+  for (int t = 0; t < num_traces; t++) {
+    for (int c = 0; c < num_configs; ) {
+      if (state[t * num_configs + c]) {
+        c++;
+        continue;
+      }
+      sweep_job *job = &jobs[num_jobs++];
+      job->trace = &traces[t];
+      job->configs = &configs[c];
+      job->mispredictions = &results[t * num_configs + c];
+      job->count = 1;
+      while (c + job->count < num_configs && job->count < PREDICTOR_LANES &&
+             predictor_lockstep(&configs[c]) &&
+             configs[c + job->count].type == configs[c].type &&
+             !state[t * num_configs + c + job->count]) {
+        job->count++;
+      }
+      c += job->count;
+    }
+  }
+
+  if (distributed) {
+    // The workers decode the traces themselves
+    dist_job *work = calloc(num_jobs ? num_jobs : 1, sizeof(dist_job));
+    for (int j = 0; j < num_jobs; j++) {
+      work[j].path = jobs[j].trace->path;
+      work[j].configs = jobs[j].configs;
+      work[j].count = jobs[j].count;
+      work[j].mispredictions = jobs[j].mispredictions;
+    }
+    dist.worker_path = worker_path(argv[0]);
+    if (num_jobs > 0 && dist_coordinate(&dist, work, num_jobs, dist_done, jobs) != 0) {
+      fprintf(stderr, "sweep: distributed run failed\n");
+      exit(1);
+    }
+    free(work);
+    free((char *)dist.worker_path);
+  } else {
+    pool *workers = pool_create(threads);
+
+    // Decode every trace once, in parallel
+    for (int t = 0; t < num_traces; t++) {
+      if (traces[t].missing > 0) {
+        pool_submit(workers, load_trace, &traces[t]);
+      }
+    }
+    pool_wait(workers);
+    for (int t = 0; t < num_traces; t++) {
+      if (traces[t].missing > 0) {
+        traces[t].count = traces[t].branches.count;
+      }
+    }
+
+    for (int j = 0; j < num_jobs; j++) {
+      pool_submit(workers, run_job, &jobs[j]);
+    }
+    pool_wait(workers);
+
+    fprintf(stderr, "sweep: %d jobs over %d traces on %d threads\n",
+            num_jobs, num_traces, pool_threads(workers));
+    pool_destroy(workers);
+
+    for (int j = 0; j < num_jobs; j++) {
+      finish_job(&jobs[j]);
+    }
+  }
+
+  if (cache) {
+    cache_close(cache);
+  }
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  // Cleanup
+  for (int t = 0; t < num_traces; t++) {
+    trace_buffer_free(&traces[t].branches);
+    free(traces[t].name);
+    free(traces[t].path);
+  }
+  free(traces);
+  free(jobs);
+  free(results);
+  free(state);
+  free(configs);
+
+  return 0;
+}
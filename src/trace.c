@@ -0,0 +1,1889 @@
+//========================================================//
+//  trace.c                                               //
+//  Source file for the branch trace reader               //
+//                                                        //
+//  Regular files are mmap'd and scanned in place, other  //
+//  inputs are read through a large buffer.  Compressed   //
+//  traces are inflated and parsed by a producer thread   //
+//  that hands blocks to the simulator through a ring.    //
+//  Mapped bzip2 traces are instead split at their block  //
+//  boundaries and the blocks decoded on a thread pool.   //
+//  All text paths share a parser for "0x<pc> <outcome>". //
+//  Binary (.bpt) traces are mapped and decoded directly  //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <bzlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "pool.h"
+#include "trace.h"
+
+// Size of each read() for non-mappable inputs, and of the text buffer
+// compressed traces are inflated into
+#define STREAM_BUFFER_SIZE (1 << 20)
+
+// Compressed input is handed to the codec in slices of this size
+#define CODEC_INPUT_SIZE (256 << 10)
+
+// Number of decoded blocks the producer thread may run ahead
+#define RING_SLOTS 16
+
+// bzip2 blocks decoded ahead of the consumer, per pool thread
+#define BZ2_READAHEAD 2
+
+// The 48-bit magics starting each bzip2 block and ending each stream
+#define BZ2_BLOCK_MAGIC 0x314159265359ULL
+#define BZ2_END_MAGIC   0x177245385090ULL
+
+// The fast path reads this many bytes from the start of a line
+// without bounds checks, so it is only used away from the end
+#define FAST_PATH_SLACK 24
+
+// Text input being parsed, either mapped or refilled through 'fill'
+typedef struct {
+  int mapped;           // True if 'data' is an mmap of the whole file
+  char *data;           // Mapped file or stream buffer
+  size_t size;          // Bytes of valid data in 'data'
+  size_t pos;           // Parse position within 'data'
+  int eof;              // True once 'fill' has returned 0
+
+  // Read up to 'cap' bytes of text into 'buf'
+  // Returns the number of bytes read, 0 at the end of input
+  ssize_t (*fill)(void *ctx, char *buf, size_t cap);
+  void *ctx;
+} text_source;
+
+// Compression formats recognized by their magic bytes
+enum { CODEC_NONE, CODEC_BZIP2, CODEC_GZIP, CODEC_ZSTD };
+
+typedef struct {
+  int kind;
+  int fd;
+  const uint8_t *map;   // Whole compressed file, if mapped
+  size_t map_size;
+  size_t map_pos;
+  uint8_t *in;          // Read buffer when not mapped
+  const uint8_t *next;  // Unconsumed compressed input
+  size_t avail;
+  int input_done;       // True once all input has been handed out
+  int stream_end;       // True between concatenated streams
+  const char *error;
+  union {
+    bz_stream bz;
+    z_stream z;
+#ifdef HAVE_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+  } u;
+} codec;
+
+typedef struct {
+  uint32_t pcs[TRACE_BLOCK_SIZE];
+  uint8_t outcomes[TRACE_BLOCK_SIZE];
+  size_t count;
+} trace_block;
+
+// The integers of .bpt traces and .idx indexes are stored little-endian.
+// These convert between that and host order, in either direction.
+static inline uint32_t
+le32(uint32_t x)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return __builtin_bswap32(x);
+#else
+  return x;
+#endif
+}
+
+static inline uint64_t
+le64(uint64_t x)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return __builtin_bswap64(x);
+#else
+  return x;
+#endif
+}
+
+// On-disk header of a binary trace
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t block_size;
+  uint64_t branches;
+  uint64_t blocks;
+} bpt_header;
+
+static void
+order_bpt_header(bpt_header *h)
+{
+  h->version = le32(h->version);
+  h->block_size = le32(h->block_size);
+  h->branches = le64(h->branches);
+  h->blocks = le64(h->blocks);
+}
+
+// On-disk header of each block of a binary trace
+typedef struct {
+  uint32_t count;
+  uint32_t pc_bytes;
+} bpt_block_header;
+
+// Position within a mapped binary trace
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  size_t pos;           // Offset of the next block header
+  const uint8_t *bits;  // Outcome bits of the current block
+  const uint8_t *pcs;   // Next varint of the current block
+  const uint8_t *pcs_end;
+  uint32_t count;       // Branches in the current block
+  uint32_t index;       // Next branch within the current block
+  uint32_t last_pc;
+} bpt_source;
+
+// Decoding state of a bzip2 slot
+enum { BZ2_FREE, BZ2_RUNNING, BZ2_DONE };
+
+typedef struct bz2_reader bz2_reader;
+
+// One bzip2 block decoded by a pool worker.  Its text is split at the
+// first and last newline: the worker parses the complete lines between
+// them, and the consumer joins the partial lines at either end with the
+// neighbouring blocks.
+typedef struct {
+  bz2_reader *bz;
+  size_t block;         // Index into the reader's block list
+  int state;            // Guarded by the reader's lock while running
+  int failed;           // The block did not decode on its own
+  int has_newline;      // False if the whole block is inside one line
+  char *edges;          // Text before the first and after the last newline
+  size_t head_len;
+  size_t tail_len;
+  uint32_t *pcs;        // Branches of the complete lines
+  uint8_t *outcomes;
+  size_t count;
+} bz2_slot;
+
+// On-disk entry of a bzip2 block index
+typedef struct {
+  uint64_t start_bit;
+  uint64_t end_bit;
+  uint64_t first_branch;
+} trace_index_entry;
+
+// On-disk header of a bzip2 block index
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t trace_size;
+  uint64_t trace_mtime;
+  uint64_t branches;
+  uint64_t blocks;
+} trace_index_header;
+
+static void
+order_index_header(trace_index_header *h)
+{
+  h->version = le32(h->version);
+  h->reserved = le32(h->reserved);
+  h->trace_size = le64(h->trace_size);
+  h->trace_mtime = le64(h->trace_mtime);
+  h->branches = le64(h->branches);
+  h->blocks = le64(h->blocks);
+}
+
+// Mapped bzip2 trace decoded a block at a time on the shared pool
+struct bz2_reader {
+  const uint8_t *map;
+  size_t map_size;
+  size_t blocks;
+  uint64_t *starts;     // Bit offset of each block's magic
+  uint64_t *ends;       // Bit offset just past each block
+  uint64_t *first_branch; // Number of the first branch after each block's
+                        // first newline
+  char *index_path;     // Sidecar index, NULL when reading STDIN
+  uint64_t trace_mtime;
+  int indexed;          // Blocks and branch numbers came from the index
+  int numbered;         // 'first_branch' and 'total' are known, so the
+                        // reader can seek
+  int complete;         // Read in order from the first branch
+  int finished;         // The last block has been delivered
+  uint64_t total;
+
+  pthread_mutex_t lock;
+  pthread_cond_t done;  // Signalled when a slot finishes decoding
+  bz2_slot *slots;      // Ring of 'window' slots, indexed by block
+  size_t window;
+  size_t next_submit;   // Next block to hand to the pool
+  size_t next_deliver;  // Block whose branches are being delivered
+  size_t offset;        // Branches already delivered from it
+  int joined;           // Its edges have been joined with the carry
+
+  char *carry;          // Partial line spanning block boundaries
+  size_t carry_len;
+  size_t carry_cap;
+  int drop_head;        // Started mid-trace, so the first partial line
+                        // is skipped
+  uint64_t delivered;   // Number of the next branch decoded
+  uint64_t discard;     // Branches still to skip after a seek
+};
+
+struct trace_writer {
+  FILE *file;
+  bpt_header header;
+  uint32_t pcs[TRACE_BLOCK_SIZE];
+  uint8_t outcomes[TRACE_BLOCK_SIZE];
+  size_t count;
+  uint8_t *encoded;     // Scratch space for one encoded block
+};
+
+struct trace_reader {
+  int fd;
+  text_source text;
+  bpt_source *binary;   // Set for binary traces instead of 'text'
+  bz2_reader *bz2;      // Set for mapped bzip2 traces instead of 'text'
+  uint64_t position;    // Branches read so far
+
+  // Decompression pipeline, only used for compressed traces
+  codec *codec;
+  pthread_t producer;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  trace_block *ring;
+  size_t head;          // Next slot the producer fills
+  size_t tail;          // Next slot the consumer drains
+  size_t offset;        // Branches already consumed from the tail slot
+  int done;             // Producer has pushed its last block
+  int stop;             // Consumer is closing early
+};
+
+// Hex digit values, 0xff for non-digits.  Readers are opened on several
+// threads at once, so the table is filled exactly once.
+static uint8_t hex_value[256];
+static pthread_once_t hex_table_once = PTHREAD_ONCE_INIT;
+
+static void
+fill_hex_table()
+{
+  memset(hex_value, 0xff, sizeof(hex_value));
+  for (int i = 0; i < 10; i++) {
+    hex_value['0' + i] = i;
+  }
+  for (int i = 0; i < 6; i++) {
+    hex_value['a' + i] = 10 + i;
+    hex_value['A' + i] = 10 + i;
+  }
+}
+
+// Index of the first ' ' in the 16 bytes at 'p', or 16 if there is none
+//
+static inline int
+find_space16(const char *p)
+{
+#ifdef __SSE2__
+  __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+  unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')));
+  return mask ? __builtin_ctz(mask) : 16;
+#else
+  for (int i = 0; i < 16; i++) {
+    if (p[i] == ' ') {
+      return i;
+    }
+  }
+  return 16;
+#endif
+}
+
+// Parse one well-formed line ("0x<1-8 hex digits> <0|1>\n") starting at
+// 'p', which must have at least FAST_PATH_SLACK readable bytes after it
+//
+// Returns the start of the next line, or NULL if the line needs the
+// general parser
+//
+static inline const char *
+parse_line_fast(const char *p, uint32_t *pc, uint8_t *outcome)
+{
+  if (p[0] != '0' || (p[1] | 0x20) != 'x') {
+    return NULL;
+  }
+  p += 2;
+
+  int digits = find_space16(p);
+  if (digits == 0 || digits > 8) {
+    return NULL;
+  }
+
+  uint32_t value = 0;
+  for (int i = 0; i < digits; i++) {
+    uint8_t v = hex_value[(uint8_t)p[i]];
+    if (v == 0xff) {
+      return NULL;
+    }
+    value = (value << 4) | v;
+  }
+  p += digits + 1;
+
+  uint8_t bit = (uint8_t)(p[0] - '0');
+  if (bit > 1) {
+    return NULL;
+  }
+  p++;
+  if (*p == '\r') {
+    p++;
+  }
+  if (*p != '\n') {
+    return NULL;
+  }
+
+  *pc = value;
+  *outcome = bit;
+  return p + 1;
+}
+
+// Parse the line starting at 'p' with full bounds checking.  Tolerates
+// surrounding whitespace, a missing "0x" prefix and CRLF line endings.
+//
+// Returns the start of the next line; '*ok' is cleared for blank or
+// malformed lines, which are skipped
+//
+static const char *
+parse_line_slow(const char *p, const char *end, uint32_t *pc,
+                uint8_t *outcome, int *ok)
+{
+  const char *eol = memchr(p, '\n', end - p);
+  const char *next = eol ? eol + 1 : end;
+  if (!eol) {
+    eol = end;
+  }
+
+  *ok = 0;
+  while (p < eol && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+  if (eol - p >= 2 && p[0] == '0' && (p[1] | 0x20) == 'x') {
+    p += 2;
+  }
+
+  uint32_t value = 0;
+  int digits = 0;
+  while (p < eol && hex_value[(uint8_t)*p] != 0xff) {
+    value = (value << 4) | hex_value[(uint8_t)*p++];
+    digits++;
+  }
+  if (digits == 0) {
+    return next;
+  }
+
+  while (p < eol && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+  if (p == eol || *p < '0' || *p > '9') {
+    return next;
+  }
+
+  uint32_t taken = 0;
+  while (p < eol && *p >= '0' && *p <= '9') {
+    taken = taken * 10 + (*p++ - '0');
+  }
+
+  *pc = value;
+  *outcome = (uint8_t)taken;
+  *ok = 1;
+  return next;
+}
+
+// Parse complete lines in [*cursor, end) into the output arrays
+//
+// Returns the number of branches decoded and advances '*cursor'
+//
+static size_t
+parse_lines(const char **cursor, const char *end, uint32_t *pcs,
+            uint8_t *outcomes, size_t max)
+{
+  const char *p = *cursor;
+  const char *fast_end = (end - p > FAST_PATH_SLACK) ? end - FAST_PATH_SLACK : p;
+  size_t n = 0;
+
+  while (n < max && p < end) {
+    if (p < fast_end) {
+      const char *next = parse_line_fast(p, &pcs[n], &outcomes[n]);
+      if (next) {
+        p = next;
+        n++;
+        continue;
+      }
+    }
+
+    int ok;
+    p = parse_line_slow(p, end, &pcs[n], &outcomes[n], &ok);
+    n += ok;
+  }
+
+  *cursor = p;
+  return n;
+}
+
+// Refill the text buffer, keeping any partial line at its front
+//
+// Returns False once no more data can be read
+//
+static int
+refill_text(text_source *text)
+{
+  if (text->eof) {
+    return 0;
+  }
+
+  size_t keep = text->size - text->pos;
+  memmove(text->data, text->data + text->pos, keep);
+  text->size = keep;
+  text->pos = 0;
+
+  while (text->size < STREAM_BUFFER_SIZE) {
+    ssize_t got = text->fill(text->ctx, text->data + text->size,
+                             STREAM_BUFFER_SIZE - text->size);
+    if (got <= 0) {
+      text->eof = 1;
+      break;
+    }
+    text->size += got;
+  }
+
+  return text->size > 0;
+}
+
+// Decode up to 'max' branches from a text source
+//
+// Returns the number of branches decoded, 0 at the end of the text
+//
+static size_t
+decode_text(text_source *text, uint32_t *pcs, uint8_t *outcomes, size_t max)
+{
+  size_t n = 0;
+
+  while (n < max) {
+    const char *start = text->data + text->pos;
+    const char *end = text->data + text->size;
+
+    if (!text->mapped && !text->eof) {
+      // Only hand complete lines to the parser until the input ends
+      const char *last = memrchr(start, '\n', end - start);
+      if (last) {
+        end = last + 1;
+      } else if (text->size < STREAM_BUFFER_SIZE || text->pos > 0) {
+        if (!refill_text(text)) {
+          break;
+        }
+        continue;
+      }
+    }
+
+    if (start == end) {
+      if (text->mapped || !refill_text(text)) {
+        break;
+      }
+      continue;
+    }
+
+    const char *cursor = start;
+    n += parse_lines(&cursor, end, pcs + n, outcomes + n, max - n);
+    text->pos = cursor - text->data;
+  }
+
+  return n;
+}
+
+static ssize_t
+fill_from_fd(void *ctx, char *buf, size_t cap)
+{
+  int fd = *(int *)ctx;
+  ssize_t got;
+  do {
+    got = read(fd, buf, cap);
+  } while (got < 0 && errno == EINTR);
+  return got;
+}
+
+//------------------------------------//
+//      Compressed Trace Codecs       //
+//------------------------------------//
+
+static int
+detect_codec(const uint8_t *magic, size_t len)
+{
+  if (len >= 3 && magic[0] == 'B' && magic[1] == 'Z' && magic[2] == 'h') {
+    return CODEC_BZIP2;
+  }
+  if (len >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+    return CODEC_GZIP;
+  }
+  if (len >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 &&
+      magic[2] == 0x2f && magic[3] == 0xfd) {
+    return CODEC_ZSTD;
+  }
+  return CODEC_NONE;
+}
+
+static const char *
+codec_start(codec *c)
+{
+  switch (c->kind) {
+    case CODEC_BZIP2:
+      memset(&c->u.bz, 0, sizeof(c->u.bz));
+      if (BZ2_bzDecompressInit(&c->u.bz, 0, 0) != BZ_OK) {
+        return "cannot initialize bzip2 decoder";
+      }
+      return NULL;
+    case CODEC_GZIP:
+      memset(&c->u.z, 0, sizeof(c->u.z));
+      // 15 window bits, +32 to accept both zlib and gzip headers
+      if (inflateInit2(&c->u.z, 15 + 32) != Z_OK) {
+        return "cannot initialize gzip decoder";
+      }
+      return NULL;
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD:
+      c->u.zstd = ZSTD_createDStream();
+      if (!c->u.zstd || ZSTD_isError(ZSTD_initDStream(c->u.zstd))) {
+        return "cannot initialize zstd decoder";
+      }
+      return NULL;
+#endif
+    default:
+      return "zstd support not compiled in (rebuild with 'make ZSTD=1')";
+  }
+}
+
+static void
+codec_end(codec *c)
+{
+  switch (c->kind) {
+    case CODEC_BZIP2:
+      BZ2_bzDecompressEnd(&c->u.bz);
+      break;
+    case CODEC_GZIP:
+      inflateEnd(&c->u.z);
+      break;
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD:
+      ZSTD_freeDStream(c->u.zstd);
+      break;
+#endif
+  }
+}
+
+// Make the next slice of compressed input available
+//
+// Returns False once the input is exhausted
+//
+static int
+codec_next_input(codec *c)
+{
+  if (c->map) {
+    size_t len = c->map_size - c->map_pos;
+    if (len > CODEC_INPUT_SIZE) {
+      len = CODEC_INPUT_SIZE;
+    }
+    c->next = c->map + c->map_pos;
+    c->avail = len;
+    c->map_pos += len;
+  } else {
+    ssize_t got = fill_from_fd(&c->fd, (char *)c->in, CODEC_INPUT_SIZE);
+    c->next = c->in;
+    c->avail = got > 0 ? got : 0;
+  }
+
+  if (c->avail == 0) {
+    c->input_done = 1;
+  }
+  return c->avail > 0;
+}
+
+// Run the decoder on the pending input
+//
+// Returns the number of bytes written to 'buf'; sets 'stream_end' when
+// the current stream is complete and 'error' on corrupt data
+//
+static size_t
+codec_step(codec *c, char *buf, size_t cap)
+{
+  size_t produced = 0;
+  int ret;
+
+  switch (c->kind) {
+    case CODEC_BZIP2:
+      c->u.bz.next_in = (char *)c->next;
+      c->u.bz.avail_in = c->avail;
+      c->u.bz.next_out = buf;
+      c->u.bz.avail_out = cap;
+      ret = BZ2_bzDecompress(&c->u.bz);
+      produced = cap - c->u.bz.avail_out;
+      c->next = (const uint8_t *)c->u.bz.next_in;
+      c->avail = c->u.bz.avail_in;
+      if (ret == BZ_STREAM_END) {
+        c->stream_end = 1;
+      } else if (ret != BZ_OK) {
+        c->error = "corrupt bzip2 data";
+      }
+      break;
+    case CODEC_GZIP:
+      c->u.z.next_in = (Bytef *)c->next;
+      c->u.z.avail_in = c->avail;
+      c->u.z.next_out = (Bytef *)buf;
+      c->u.z.avail_out = cap;
+      ret = inflate(&c->u.z, Z_NO_FLUSH);
+      produced = cap - c->u.z.avail_out;
+      c->next = c->u.z.next_in;
+      c->avail = c->u.z.avail_in;
+      if (ret == Z_STREAM_END) {
+        c->stream_end = 1;
+      } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        c->error = "corrupt gzip data";
+      }
+      break;
+#ifdef HAVE_ZSTD
+    case CODEC_ZSTD: {
+      ZSTD_inBuffer in = { c->next, c->avail, 0 };
+      ZSTD_outBuffer out = { buf, cap, 0 };
+      size_t hint = ZSTD_decompressStream(c->u.zstd, &out, &in);
+      produced = out.pos;
+      c->next += in.pos;
+      c->avail -= in.pos;
+      if (ZSTD_isError(hint)) {
+        c->error = "corrupt zstd data";
+      } else {
+        // A zero hint means a frame just ended; the next one continues
+        // the same stream of text
+        c->stream_end = (hint == 0);
+      }
+      break;
+    }
+#endif
+  }
+
+  return produced;
+}
+
+// Text source callback inflating the next piece of the trace
+//
+static ssize_t
+fill_from_codec(void *ctx, char *buf, size_t cap)
+{
+  codec *c = ctx;
+
+  while (!c->error) {
+    if (c->avail == 0 && !c->input_done) {
+      codec_next_input(c);
+    }
+
+    if (c->avail == 0 && c->input_done) {
+      // Input ended: fine between streams, truncated otherwise
+      if (!c->stream_end) {
+        c->error = "unexpected end of compressed trace";
+      }
+      return 0;
+    }
+
+    if (c->stream_end && c->kind != CODEC_ZSTD) {
+      // Concatenated streams (e.g. from pbzip2) are decoded back to back
+      codec_end(c);
+      c->error = codec_start(c);
+      c->stream_end = 0;
+      continue;
+    }
+
+    size_t produced = codec_step(c, buf, cap);
+    if (produced > 0) {
+      return produced;
+    }
+  }
+
+  return -1;
+}
+
+//------------------------------------//
+//      Decompression Pipeline        //
+//------------------------------------//
+
+// Producer thread: inflate, parse and publish blocks until the trace
+// ends or the consumer closes the reader
+//
+static void *
+produce_blocks(void *arg)
+{
+  trace_reader *reader = arg;
+
+  for (;;) {
+    pthread_mutex_lock(&reader->lock);
+    while (reader->head - reader->tail == RING_SLOTS && !reader->stop) {
+      pthread_cond_wait(&reader->not_full, &reader->lock);
+    }
+    int stop = reader->stop;
+    trace_block *block = &reader->ring[reader->head % RING_SLOTS];
+    pthread_mutex_unlock(&reader->lock);
+
+    if (stop) {
+      break;
+    }
+
+    // The slot is ours until 'head' moves past it
+    block->count = decode_text(&reader->text, block->pcs, block->outcomes,
+                               TRACE_BLOCK_SIZE);
+
+    pthread_mutex_lock(&reader->lock);
+    if (block->count > 0) {
+      reader->head++;
+    } else {
+      reader->done = 1;
+    }
+    pthread_cond_signal(&reader->not_empty);
+    pthread_mutex_unlock(&reader->lock);
+
+    if (block->count == 0) {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+static size_t
+consume_blocks(trace_reader *reader, uint32_t *pcs, uint8_t *outcomes,
+               size_t max)
+{
+  size_t n = 0;
+
+  while (n < max) {
+    pthread_mutex_lock(&reader->lock);
+    while (reader->head == reader->tail && !reader->done) {
+      pthread_cond_wait(&reader->not_empty, &reader->lock);
+    }
+    if (reader->head == reader->tail) {
+      pthread_mutex_unlock(&reader->lock);
+      break;
+    }
+    trace_block *block = &reader->ring[reader->tail % RING_SLOTS];
+    pthread_mutex_unlock(&reader->lock);
+
+    size_t take = block->count - reader->offset;
+    if (take > max - n) {
+      take = max - n;
+    }
+    memcpy(pcs + n, block->pcs + reader->offset, take * sizeof(uint32_t));
+    memcpy(outcomes + n, block->outcomes + reader->offset, take);
+    n += take;
+    reader->offset += take;
+
+    if (reader->offset == block->count) {
+      pthread_mutex_lock(&reader->lock);
+      reader->tail++;
+      reader->offset = 0;
+      pthread_cond_signal(&reader->not_full);
+      pthread_mutex_unlock(&reader->lock);
+    }
+  }
+
+  if (n == 0 && reader->codec->error) {
+    fprintf(stderr, "trace: %s\n", reader->codec->error);
+    exit(1);
+  }
+  return n;
+}
+
+static void
+start_pipeline(trace_reader *reader, codec *c)
+{
+  const char *error = codec_start(c);
+  if (error) {
+    fprintf(stderr, "trace: %s\n", error);
+    exit(1);
+  }
+
+  reader->codec = c;
+  reader->text.data = malloc(STREAM_BUFFER_SIZE);
+  reader->text.fill = fill_from_codec;
+  reader->text.ctx = c;
+  reader->ring = malloc(RING_SLOTS * sizeof(trace_block));
+  pthread_mutex_init(&reader->lock, NULL);
+  pthread_cond_init(&reader->not_empty, NULL);
+  pthread_cond_init(&reader->not_full, NULL);
+  pthread_create(&reader->producer, NULL, produce_blocks, reader);
+}
+
+//------------------------------------//
+//       Parallel bzip2 Decoding      //
+//------------------------------------//
+
+// Pool shared by every bzip2 reader in the process
+static pool *bz2_pool;
+static pthread_once_t bz2_pool_once = PTHREAD_ONCE_INIT;
+
+static void
+create_bz2_pool()
+{
+  bz2_pool = pool_create(0);
+}
+
+static inline int
+read_bit(const uint8_t *data, uint64_t bit)
+{
+  return (data[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+// Writer of an MSB-first bit stream
+typedef struct {
+  uint8_t *out;
+  size_t len;
+  uint64_t acc;
+  int bits;             // Bits of 'acc' not yet written out
+} bit_writer;
+
+static inline void
+put_bits(bit_writer *w, uint64_t value, int count)
+{
+  w->acc = (w->acc << count) | (value & ((1ULL << count) - 1));
+  w->bits += count;
+  while (w->bits >= 8) {
+    w->bits -= 8;
+    w->out[w->len++] = (uint8_t)(w->acc >> w->bits);
+  }
+}
+
+// Find the blocks of a bzip2 file by their magic, which is not byte
+// aligned.  Each block runs to the next block magic or end-of-stream
+// marker, so the stream headers between concatenated streams are left
+// out.
+//
+// Returns the number of blocks found
+//
+static size_t
+find_bz2_blocks(const uint8_t *data, size_t size, uint64_t **starts,
+                uint64_t **ends)
+{
+  const uint64_t mask = (1ULL << 48) - 1;
+  size_t n = 0;
+  size_t capacity = 0;
+  int open = 0;
+  uint64_t window = 0;
+
+  *starts = NULL;
+  *ends = NULL;
+  for (size_t i = 0; i < size; i++) {
+    window = (window << 8) | data[i];
+    if (i < 6) {
+      continue;
+    }
+    // The 48 bits ending 'shift' bits before the end of byte i
+    for (int shift = 7; shift >= 0; shift--) {
+      uint64_t bits = (window >> shift) & mask;
+      if (bits != BZ2_BLOCK_MAGIC && bits != BZ2_END_MAGIC) {
+        continue;
+      }
+      uint64_t bit = (uint64_t)(i + 1) * 8 - shift - 48;
+      if (open) {
+        (*ends)[n - 1] = bit;
+        open = 0;
+      }
+      if (bits == BZ2_BLOCK_MAGIC) {
+        if (n == capacity) {
+          capacity = capacity ? 2 * capacity : 64;
+          *starts = realloc(*starts, capacity * sizeof(uint64_t));
+          *ends = realloc(*ends, capacity * sizeof(uint64_t));
+        }
+        (*starts)[n++] = bit;
+        open = 1;
+      }
+    }
+  }
+  if (open) {
+    // Truncated file; the last block fails to decode
+    (*ends)[n - 1] = (uint64_t)size * 8;
+  }
+
+  return n;
+}
+
+// Decode bits [start, end) of a bzip2 file, which hold one block, by
+// wrapping them in a stream of their own: a header, the block, and an
+// end-of-stream marker whose combined CRC is the block's CRC
+//
+// Returns the text (with its length in '*len'), or NULL if the bits are
+// not a valid block
+//
+static char *
+inflate_bz2_block(const uint8_t *data, uint64_t start, uint64_t end,
+                  size_t *len)
+{
+  bit_writer w = { malloc((end - start) / 8 + 32), 0, 0, 0 };
+
+  // Level 9 allocates for the largest block any level can produce
+  put_bits(&w, 'B', 8);
+  put_bits(&w, 'Z', 8);
+  put_bits(&w, 'h', 8);
+  put_bits(&w, '9', 8);
+
+  uint64_t bit = start;
+  for (; bit < end && (bit & 7); bit++) {
+    put_bits(&w, read_bit(data, bit), 1);
+  }
+  for (; end - bit >= 8; bit += 8) {
+    put_bits(&w, data[bit >> 3], 8);
+  }
+  for (; bit < end; bit++) {
+    put_bits(&w, read_bit(data, bit), 1);
+  }
+
+  uint32_t crc = 0;
+  for (int i = 0; i < 32 && start + 48 + i < end; i++) {
+    crc = (crc << 1) | read_bit(data, start + 48 + i);
+  }
+  put_bits(&w, BZ2_END_MAGIC >> 24, 24);
+  put_bits(&w, BZ2_END_MAGIC, 24);
+  put_bits(&w, crc, 32);
+  if (w.bits > 0) {
+    put_bits(&w, 0, 8 - w.bits);
+  }
+
+  bz_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK) {
+    free(w.out);
+    return NULL;
+  }
+  strm.next_in = (char *)w.out;
+  strm.avail_in = w.len;
+
+  size_t capacity = STREAM_BUFFER_SIZE;
+  size_t size = 0;
+  char *text = malloc(capacity);
+  int ret;
+  for (;;) {
+    strm.next_out = text + size;
+    strm.avail_out = capacity - size;
+    ret = BZ2_bzDecompress(&strm);
+    size = capacity - strm.avail_out;
+    if (ret != BZ_OK || (strm.avail_in == 0 && strm.avail_out > 0)) {
+      break;
+    }
+    if (size == capacity) {
+      capacity *= 2;
+      text = realloc(text, capacity);
+    }
+  }
+  BZ2_bzDecompressEnd(&strm);
+  free(w.out);
+
+  if (ret != BZ_STREAM_END) {
+    free(text);
+    return NULL;
+  }
+  *len = size;
+  return text;
+}
+
+// Decode the slot's block and parse its complete lines
+//
+static void
+decode_bz2_block(bz2_slot *slot)
+{
+  const bz2_reader *bz = slot->bz;
+  size_t len;
+  char *text = inflate_bz2_block(bz->map, bz->starts[slot->block],
+                                 bz->ends[slot->block], &len);
+  if (!text) {
+    slot->failed = 1;
+    return;
+  }
+
+  const char *first = memchr(text, '\n', len);
+  if (!first) {
+    slot->has_newline = 0;
+    slot->edges = text;
+    slot->head_len = len;
+    slot->tail_len = 0;
+    slot->count = 0;
+    return;
+  }
+  const char *last = memrchr(text, '\n', len);
+
+  // Every line that parses is at least 4 bytes long
+  const char *cursor = first + 1;
+  size_t capacity = (last - first) / 4 + 1;
+  slot->pcs = malloc(capacity * sizeof(uint32_t));
+  slot->outcomes = malloc(capacity);
+  slot->count = parse_lines(&cursor, last + 1, slot->pcs, slot->outcomes,
+                            capacity);
+
+  slot->has_newline = 1;
+  slot->head_len = first + 1 - text;
+  slot->tail_len = text + len - (last + 1);
+  slot->edges = malloc(slot->head_len + slot->tail_len + 1);
+  memcpy(slot->edges, text, slot->head_len);
+  memcpy(slot->edges + slot->head_len, last + 1, slot->tail_len);
+  free(text);
+}
+
+// Pool job decoding one slot
+//
+static void
+run_bz2_slot(void *arg)
+{
+  bz2_slot *slot = arg;
+  bz2_reader *bz = slot->bz;
+
+  decode_bz2_block(slot);
+
+  pthread_mutex_lock(&bz->lock);
+  slot->state = BZ2_DONE;
+  pthread_cond_broadcast(&bz->done);
+  pthread_mutex_unlock(&bz->lock);
+}
+
+static void
+release_bz2_slot(bz2_slot *slot)
+{
+  free(slot->edges);
+  free(slot->pcs);
+  free(slot->outcomes);
+  slot->edges = NULL;
+  slot->pcs = NULL;
+  slot->outcomes = NULL;
+  slot->count = 0;
+  slot->failed = 0;
+  slot->state = BZ2_FREE;
+}
+
+// Keep the pool busy with the blocks after the one being delivered
+//
+static void
+submit_bz2_blocks(bz2_reader *bz)
+{
+  while (bz->next_submit < bz->blocks &&
+         bz->next_submit - bz->next_deliver < bz->window) {
+    bz2_slot *slot = &bz->slots[bz->next_submit % bz->window];
+    slot->block = bz->next_submit++;
+    slot->state = BZ2_RUNNING;
+    pool_submit(bz2_pool, run_bz2_slot, slot);
+  }
+}
+
+// Wait for the blocks in flight and drop everything decoded ahead
+//
+static void
+drain_bz2_slots(bz2_reader *bz)
+{
+  pthread_mutex_lock(&bz->lock);
+  for (size_t i = 0; i < bz->window; i++) {
+    while (bz->slots[i].state == BZ2_RUNNING) {
+      pthread_cond_wait(&bz->done, &bz->lock);
+    }
+  }
+  pthread_mutex_unlock(&bz->lock);
+
+  for (size_t i = 0; i < bz->window; i++) {
+    release_bz2_slot(&bz->slots[i]);
+  }
+  bz->next_submit = bz->next_deliver;
+}
+
+// A block that does not decode on its own was cut short by a false
+// boundary, since the 48-bit magic can occur by chance inside compressed
+// data.  Join it with the blocks after it until it decodes.
+//
+static void
+merge_bz2_block(bz2_reader *bz, bz2_slot *slot)
+{
+  size_t k = slot->block;
+  drain_bz2_slots(bz);
+
+  for (int tries = 0; ; tries++) {
+    if (bz->indexed || tries == 8 || k + 1 >= bz->blocks ||
+        bz->ends[k] != bz->starts[k + 1]) {
+      fprintf(stderr, "trace: corrupt bzip2 data\n");
+      exit(1);
+    }
+    bz->ends[k] = bz->ends[k + 1];
+    size_t after = bz->blocks - (k + 2);
+    memmove(bz->starts + k + 1, bz->starts + k + 2, after * sizeof(uint64_t));
+    memmove(bz->ends + k + 1, bz->ends + k + 2, after * sizeof(uint64_t));
+    bz->blocks--;
+
+    release_bz2_slot(slot);
+    slot->block = k;
+    decode_bz2_block(slot);
+    if (!slot->failed) {
+      break;
+    }
+  }
+
+  slot->state = BZ2_DONE;
+  bz->next_submit = k + 1;
+  submit_bz2_blocks(bz);
+}
+
+static void
+append_bz2_carry(bz2_reader *bz, const char *text, size_t len)
+{
+  if (bz->carry_len + len > bz->carry_cap) {
+    bz->carry_cap = 2 * (bz->carry_len + len);
+    bz->carry = realloc(bz->carry, bz->carry_cap);
+  }
+  memcpy(bz->carry + bz->carry_len, text, len);
+  bz->carry_len += len;
+}
+
+// Parse the line that spanned block boundaries
+//
+// Returns the number of branches written (0 or 1)
+//
+static size_t
+flush_bz2_carry(bz2_reader *bz, uint32_t *pc, uint8_t *outcome)
+{
+  const char *cursor = bz->carry;
+  size_t n = parse_lines(&cursor, bz->carry + bz->carry_len, pc, outcome, 1);
+  bz->carry_len = 0;
+  bz->delivered += n;
+  if (n > 0 && bz->discard > 0) {
+    bz->discard--;
+    n = 0;
+  }
+  return n;
+}
+
+// Finish the line running into the slot's block from the blocks before
+// it, and carry the block's own partial last line to the next one
+//
+// Returns the number of branches written (0 or 1)
+//
+static size_t
+join_bz2_edges(bz2_reader *bz, bz2_slot *slot, uint32_t *pc,
+               uint8_t *outcome)
+{
+  size_t k = slot->block;
+  size_t n = 0;
+
+  if (!slot->has_newline) {
+    if (!bz->drop_head) {
+      append_bz2_carry(bz, slot->edges, slot->head_len);
+    }
+    // Not a place to start decoding, so it repeats the previous number
+    if (!bz->indexed) {
+      bz->first_branch[k] = k > 0 ? bz->first_branch[k - 1] : 0;
+    }
+    return 0;
+  }
+
+  if (bz->drop_head) {
+    bz->drop_head = 0;
+    bz->carry_len = 0;
+  } else {
+    append_bz2_carry(bz, slot->edges, slot->head_len);
+    n = flush_bz2_carry(bz, pc, outcome);
+  }
+  if (!bz->indexed) {
+    bz->first_branch[k] = bz->delivered;
+  }
+  append_bz2_carry(bz, slot->edges + slot->head_len, slot->tail_len);
+  return n;
+}
+
+// Decode up to 'max' branches from a bzip2 trace, in order
+//
+// Returns the number of branches decoded, 0 at the end of the trace
+//
+static size_t
+decode_bz2(bz2_reader *bz, uint32_t *pcs, uint8_t *outcomes, size_t max)
+{
+  size_t n = 0;
+
+  while (n < max) {
+    if (bz->next_deliver == bz->blocks) {
+      // The last line of the trace need not end with a newline
+      if (!bz->finished) {
+        if (bz->carry_len > 0 && !bz->drop_head) {
+          n += flush_bz2_carry(bz, pcs + n, outcomes + n);
+        }
+        bz->finished = 1;
+        if (bz->complete) {
+          bz->total = bz->delivered;
+          bz->numbered = 1;
+        }
+      }
+      break;
+    }
+
+    bz2_slot *slot = &bz->slots[bz->next_deliver % bz->window];
+    if (!bz->joined) {
+      pthread_mutex_lock(&bz->lock);
+      while (slot->state == BZ2_RUNNING) {
+        pthread_cond_wait(&bz->done, &bz->lock);
+      }
+      pthread_mutex_unlock(&bz->lock);
+      if (slot->failed) {
+        merge_bz2_block(bz, slot);
+      }
+      n += join_bz2_edges(bz, slot, pcs + n, outcomes + n);
+      bz->joined = 1;
+      continue;
+    }
+
+    size_t left = slot->count - bz->offset;
+    if (bz->discard > 0) {
+      size_t skip = bz->discard < left ? bz->discard : left;
+      bz->offset += skip;
+      bz->discard -= skip;
+      bz->delivered += skip;
+      left -= skip;
+    }
+    size_t take = left < max - n ? left : max - n;
+    memcpy(pcs + n, slot->pcs + bz->offset, take * sizeof(uint32_t));
+    memcpy(outcomes + n, slot->outcomes + bz->offset, take);
+    bz->offset += take;
+    bz->delivered += take;
+    n += take;
+
+    if (bz->offset == slot->count) {
+      release_bz2_slot(slot);
+      bz->next_deliver++;
+      bz->offset = 0;
+      bz->joined = 0;
+      submit_bz2_blocks(bz);
+    }
+  }
+
+  return n;
+}
+
+// Read the sidecar index, if it matches the trace
+//
+// Returns True if the block list was loaded from it
+//
+static int
+load_bz2_index(bz2_reader *bz)
+{
+  FILE *f = fopen(bz->index_path, "rb");
+  if (!f) {
+    return 0;
+  }
+
+  trace_index_header header;
+  int ok = fread(&header, sizeof(header), 1, f) == 1;
+  order_index_header(&header);
+  ok = ok && !memcmp(header.magic, TRACE_INDEX_MAGIC, 8) &&
+           header.version == TRACE_INDEX_VERSION &&
+           header.trace_size == bz->map_size &&
+           header.trace_mtime == bz->trace_mtime &&
+           header.blocks > 0 && header.blocks <= bz->map_size;
+  if (ok) {
+    bz->blocks = header.blocks;
+    bz->total = header.branches;
+    bz->starts = malloc(bz->blocks * sizeof(uint64_t));
+    bz->ends = malloc(bz->blocks * sizeof(uint64_t));
+    bz->first_branch = malloc(bz->blocks * sizeof(uint64_t));
+    for (size_t k = 0; ok && k < bz->blocks; k++) {
+      trace_index_entry entry;
+      ok = fread(&entry, sizeof(entry), 1, f) == 1;
+      entry.start_bit = le64(entry.start_bit);
+      entry.end_bit = le64(entry.end_bit);
+      entry.first_branch = le64(entry.first_branch);
+      ok = ok && entry.start_bit < entry.end_bit &&
+           entry.end_bit <= (uint64_t)bz->map_size * 8;
+      bz->starts[k] = entry.start_bit;
+      bz->ends[k] = entry.end_bit;
+      bz->first_branch[k] = entry.first_branch;
+    }
+    if (!ok) {
+      free(bz->starts);
+      free(bz->ends);
+      free(bz->first_branch);
+    }
+  }
+  fclose(f);
+  return ok;
+}
+
+// Write the sidecar index.  It goes to a temporary file first so that a
+// concurrent reader never sees half of it; failures are ignored, since
+// the index only saves time.
+//
+static void
+write_bz2_index(const bz2_reader *bz)
+{
+  char *tmp = malloc(strlen(bz->index_path) + 32);
+  sprintf(tmp, "%s.%d", bz->index_path, (int)getpid());
+  FILE *f = fopen(tmp, "wb");
+  if (!f) {
+    free(tmp);
+    return;
+  }
+
+  trace_index_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TRACE_INDEX_MAGIC, 8);
+  header.version = TRACE_INDEX_VERSION;
+  header.trace_size = bz->map_size;
+  header.trace_mtime = bz->trace_mtime;
+  header.branches = bz->total;
+  header.blocks = bz->blocks;
+  order_index_header(&header);
+  fwrite(&header, sizeof(header), 1, f);
+  for (size_t k = 0; k < bz->blocks; k++) {
+    trace_index_entry entry = { le64(bz->starts[k]), le64(bz->ends[k]),
+                                le64(bz->first_branch[k]) };
+    fwrite(&entry, sizeof(entry), 1, f);
+  }
+
+  int ok = !ferror(f);
+  if (fclose(f) != 0) {
+    ok = 0;
+  }
+  if (!ok || rename(tmp, bz->index_path) != 0) {
+    unlink(tmp);
+  }
+  free(tmp);
+}
+
+// Set up parallel decoding of a mapped bzip2 trace
+//
+// Returns NULL if no blocks were found, leaving the trace to the serial
+// decoder
+//
+static bz2_reader *
+open_bz2(const uint8_t *map, size_t size, const char *path,
+         const struct stat *st)
+{
+  bz2_reader *bz = calloc(1, sizeof(bz2_reader));
+  bz->map = map;
+  bz->map_size = size;
+  bz->trace_mtime = (uint64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+  if (path && strcmp(path, "-")) {
+    bz->index_path = malloc(strlen(path) + sizeof(TRACE_INDEX_SUFFIX));
+    sprintf(bz->index_path, "%s%s", path, TRACE_INDEX_SUFFIX);
+    bz->indexed = load_bz2_index(bz);
+    bz->numbered = bz->indexed;
+  }
+  if (!bz->indexed) {
+    bz->blocks = find_bz2_blocks(map, size, &bz->starts, &bz->ends);
+    if (bz->blocks == 0) {
+      free(bz->index_path);
+      free(bz);
+      return NULL;
+    }
+    bz->first_branch = calloc(bz->blocks, sizeof(uint64_t));
+  }
+  bz->complete = 1;
+
+  pthread_once(&bz2_pool_once, create_bz2_pool);
+  pthread_mutex_init(&bz->lock, NULL);
+  pthread_cond_init(&bz->done, NULL);
+  bz->window = BZ2_READAHEAD * pool_threads(bz2_pool) + 1;
+  bz->slots = calloc(bz->window, sizeof(bz2_slot));
+  for (size_t i = 0; i < bz->window; i++) {
+    bz->slots[i].bz = bz;
+  }
+  submit_bz2_blocks(bz);
+  return bz;
+}
+
+// Jump to 'branch' using the block numbers
+//
+// Returns 0 on success, -1 if the trace ends first
+//
+static int
+seek_bz2(bz2_reader *bz, uint64_t branch)
+{
+  if (branch > bz->total) {
+    return -1;
+  }
+
+  // The last block whose first complete line is not past 'branch'.
+  // Blocks without a newline repeat the number of the block before them
+  // and are skipped.
+  size_t lo = 0;
+  size_t hi = bz->blocks;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (bz->first_branch[mid] <= branch) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  while (lo > 0 && bz->first_branch[lo - 1] == bz->first_branch[lo]) {
+    lo--;
+  }
+
+  drain_bz2_slots(bz);
+  bz->next_deliver = lo;
+  bz->next_submit = lo;
+  bz->offset = 0;
+  bz->joined = 0;
+  bz->carry_len = 0;
+  bz->drop_head = lo > 0;
+  bz->delivered = lo > 0 ? bz->first_branch[lo] : 0;
+  bz->discard = branch - bz->delivered;
+  bz->finished = 0;
+  bz->complete = 0;
+  submit_bz2_blocks(bz);
+  return 0;
+}
+
+static void
+close_bz2(bz2_reader *bz)
+{
+  drain_bz2_slots(bz);
+  if (bz->index_path && !bz->indexed && bz->complete && bz->finished) {
+    write_bz2_index(bz);
+  }
+
+  pthread_mutex_destroy(&bz->lock);
+  pthread_cond_destroy(&bz->done);
+  munmap((void *)bz->map, bz->map_size);
+  free(bz->slots);
+  free(bz->starts);
+  free(bz->ends);
+  free(bz->first_branch);
+  free(bz->carry);
+  free(bz->index_path);
+  free(bz);
+}
+
+//------------------------------------//
+//        Binary Trace Format         //
+//------------------------------------//
+
+static int
+is_binary_trace(const uint8_t *data, size_t size)
+{
+  return size >= sizeof(bpt_header) && !memcmp(data, BPT_MAGIC, 8);
+}
+
+// Move to the next block of a binary trace
+//
+// Returns False at the end of the trace
+//
+static int
+next_bpt_block(bpt_source *bin)
+{
+  bpt_block_header block;
+  if (bin->size - bin->pos < sizeof(block)) {
+    return 0;
+  }
+  memcpy(&block, bin->data + bin->pos, sizeof(block));
+  block.count = le32(block.count);
+  block.pc_bytes = le32(block.pc_bytes);
+
+  size_t bit_bytes = (block.count + 7) / 8;
+  size_t payload = bit_bytes + block.pc_bytes;
+  if (bin->size - bin->pos - sizeof(block) < payload) {
+    fprintf(stderr, "trace: truncated binary trace\n");
+    exit(1);
+  }
+
+  bin->bits = bin->data + bin->pos + sizeof(block);
+  bin->pcs = bin->bits + bit_bytes;
+  bin->pcs_end = bin->pcs + block.pc_bytes;
+  bin->count = block.count;
+  bin->index = 0;
+  bin->last_pc = 0;
+  bin->pos += sizeof(block) + payload;
+  return 1;
+}
+
+static size_t
+decode_binary(bpt_source *bin, uint32_t *pcs, uint8_t *outcomes, size_t max)
+{
+  size_t n = 0;
+
+  while (n < max) {
+    if (bin->index == bin->count && !next_bpt_block(bin)) {
+      break;
+    }
+
+    uint32_t take = bin->count - bin->index;
+    if (take > max - n) {
+      take = max - n;
+    }
+
+    const uint8_t *p = bin->pcs;
+    uint32_t pc = bin->last_pc;
+    for (uint32_t i = bin->index; i < bin->index + take; i++) {
+      // LEB128 varint, at most 5 bytes for a 32-bit value
+      uint32_t zz = 0;
+      int shift = 0;
+      uint8_t byte;
+      do {
+        if (p == bin->pcs_end) {
+          fprintf(stderr, "trace: corrupt binary trace\n");
+          exit(1);
+        }
+        byte = *p++;
+        zz |= (uint32_t)(byte & 0x7f) << shift;
+        shift += 7;
+      } while ((byte & 0x80) && shift < 35);
+
+      pc += (zz >> 1) ^ -(zz & 1);
+      pcs[n] = pc;
+      outcomes[n] = (bin->bits[i >> 3] >> (i & 7)) & 1;
+      n++;
+    }
+
+    bin->pcs = p;
+    bin->last_pc = pc;
+    bin->index += take;
+  }
+
+  return n;
+}
+
+// Encode the writer's pending branches as one block
+//
+static void
+flush_bpt_block(trace_writer *writer)
+{
+  if (writer->count == 0) {
+    return;
+  }
+
+  size_t bit_bytes = (writer->count + 7) / 8;
+  uint8_t *bits = writer->encoded + sizeof(bpt_block_header);
+  uint8_t *p = bits + bit_bytes;
+  uint32_t last_pc = 0;
+
+  memset(bits, 0, bit_bytes);
+  for (size_t i = 0; i < writer->count; i++) {
+    bits[i >> 3] |= (writer->outcomes[i] & 1) << (i & 7);
+
+    int32_t delta = (int32_t)(writer->pcs[i] - last_pc);
+    uint32_t zz = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    while (zz >= 0x80) {
+      *p++ = (zz & 0x7f) | 0x80;
+      zz >>= 7;
+    }
+    *p++ = zz;
+    last_pc = writer->pcs[i];
+  }
+
+  bpt_block_header block;
+  block.count = le32(writer->count);
+  block.pc_bytes = le32(p - (bits + bit_bytes));
+  memcpy(writer->encoded, &block, sizeof(block));
+  fwrite(writer->encoded, 1, p - writer->encoded, writer->file);
+
+  writer->header.branches += writer->count;
+  writer->header.blocks++;
+  writer->count = 0;
+}
+
+trace_writer *
+trace_writer_open(const char *path)
+{
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    return NULL;
+  }
+
+  trace_writer *writer = calloc(1, sizeof(trace_writer));
+  writer->file = file;
+  memcpy(writer->header.magic, BPT_MAGIC, 8);
+  writer->header.version = BPT_VERSION;
+  writer->header.block_size = TRACE_BLOCK_SIZE;
+  writer->encoded = malloc(sizeof(bpt_block_header) + TRACE_BLOCK_SIZE / 8
+                           + TRACE_BLOCK_SIZE * 5);
+
+  // The header is rewritten with the final counts on close
+  bpt_header header = writer->header;
+  order_bpt_header(&header);
+  fwrite(&header, sizeof(header), 1, file);
+  return writer;
+}
+
+void
+trace_write_block(trace_writer *writer, const uint32_t *pcs,
+                  const uint8_t *outcomes, size_t count)
+{
+  while (count > 0) {
+    size_t take = TRACE_BLOCK_SIZE - writer->count;
+    if (take > count) {
+      take = count;
+    }
+    memcpy(writer->pcs + writer->count, pcs, take * sizeof(uint32_t));
+    memcpy(writer->outcomes + writer->count, outcomes, take);
+    writer->count += take;
+    pcs += take;
+    outcomes += take;
+    count -= take;
+
+    if (writer->count == TRACE_BLOCK_SIZE) {
+      flush_bpt_block(writer);
+    }
+  }
+}
+
+int
+trace_writer_close(trace_writer *writer)
+{
+  flush_bpt_block(writer);
+
+  int ret = 0;
+  bpt_header header = writer->header;
+  order_bpt_header(&header);
+  if (fseek(writer->file, 0, SEEK_SET) != 0 ||
+      fwrite(&header, sizeof(header), 1, writer->file) != 1 ||
+      ferror(writer->file)) {
+    ret = -1;
+  }
+  if (fclose(writer->file) != 0) {
+    ret = -1;
+  }
+
+  free(writer->encoded);
+  free(writer);
+  return ret;
+}
+
+//------------------------------------//
+//      Trace Reader Interface        //
+//------------------------------------//
+
+trace_reader *
+trace_open(const char *path)
+{
+  pthread_once(&hex_table_once, fill_hex_table);
+
+  int fd = STDIN_FILENO;
+  if (path && strcmp(path, "-")) {
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      return NULL;
+    }
+  }
+
+  trace_reader *reader = calloc(1, sizeof(trace_reader));
+  reader->fd = fd;
+  codec *c = calloc(1, sizeof(codec));
+  c->fd = fd;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      c->kind = detect_codec(map, st.st_size);
+      if (is_binary_trace(map, st.st_size)) {
+        bpt_header header;
+        memcpy(&header, map, sizeof(header));
+        order_bpt_header(&header);
+        if (header.version != BPT_VERSION) {
+          fprintf(stderr, "trace: unsupported binary trace version %u\n",
+                  header.version);
+          exit(1);
+        }
+        reader->binary = calloc(1, sizeof(bpt_source));
+        reader->binary->data = map;
+        reader->binary->size = st.st_size;
+        reader->binary->pos = sizeof(header);
+        free(c);
+      } else if (c->kind == CODEC_BZIP2 &&
+                 (reader->bz2 = open_bz2(map, st.st_size, path, &st))) {
+        free(c);
+      } else if (c->kind != CODEC_NONE) {
+        c->map = map;
+        c->map_size = st.st_size;
+        start_pipeline(reader, c);
+      } else {
+        reader->text.mapped = 1;
+        reader->text.data = map;
+        reader->text.size = st.st_size;
+        free(c);
+      }
+      return reader;
+    }
+  }
+
+  // Peek at the first bytes of the stream to spot compressed input
+  uint8_t magic[4];
+  size_t peeked = 0;
+  while (peeked < sizeof(magic)) {
+    ssize_t got = fill_from_fd(&c->fd, (char *)magic + peeked,
+                               sizeof(magic) - peeked);
+    if (got <= 0) {
+      break;
+    }
+    peeked += got;
+  }
+
+  if (peeked == sizeof(magic) && !memcmp(magic, BPT_MAGIC, sizeof(magic))) {
+    fprintf(stderr, "trace: binary traces must be given as a file\n");
+    exit(1);
+  }
+
+  c->kind = detect_codec(magic, peeked);
+  if (c->kind != CODEC_NONE) {
+    c->in = malloc(CODEC_INPUT_SIZE);
+    memcpy(c->in, magic, peeked);
+    c->next = c->in;
+    c->avail = peeked;
+    start_pipeline(reader, c);
+    return reader;
+  }
+  free(c);
+
+  // A line can never be longer than the buffer, so a full buffer with
+  // no newline in it is treated as one (malformed) line
+  reader->text.data = malloc(STREAM_BUFFER_SIZE);
+  memcpy(reader->text.data, magic, peeked);
+  reader->text.size = peeked;
+  reader->text.fill = fill_from_fd;
+  reader->text.ctx = &reader->fd;
+  return reader;
+}
+
+size_t
+trace_read_block(trace_reader *reader, uint32_t *pcs, uint8_t *outcomes,
+                 size_t max)
+{
+  size_t n;
+  if (reader->binary) {
+    n = decode_binary(reader->binary, pcs, outcomes, max);
+  } else if (reader->bz2) {
+    n = decode_bz2(reader->bz2, pcs, outcomes, max);
+  } else if (reader->codec) {
+    n = consume_blocks(reader, pcs, outcomes, max);
+  } else {
+    n = decode_text(&reader->text, pcs, outcomes, max);
+  }
+  reader->position += n;
+  return n;
+}
+
+int
+trace_seek(trace_reader *reader, uint64_t branch)
+{
+  if (reader->bz2 && reader->bz2->numbered) {
+    if (seek_bz2(reader->bz2, branch) != 0) {
+      errno = EINVAL;
+      return -1;
+    }
+    reader->position = branch;
+    return 0;
+  }
+
+  if (branch < reader->position) {
+    errno = ESPIPE;
+    return -1;
+  }
+  trace_block *scratch = malloc(sizeof(trace_block));
+  int ret = 0;
+  while (reader->position < branch) {
+    uint64_t want = branch - reader->position;
+    if (!trace_read_block(reader, scratch->pcs, scratch->outcomes,
+                          want < TRACE_BLOCK_SIZE ? want : TRACE_BLOCK_SIZE)) {
+      errno = EINVAL;
+      ret = -1;
+      break;
+    }
+  }
+  free(scratch);
+  return ret;
+}
+
+void
+trace_close(trace_reader *reader)
+{
+  codec *c = reader->codec;
+  if (c) {
+    pthread_mutex_lock(&reader->lock);
+    reader->stop = 1;
+    pthread_cond_signal(&reader->not_full);
+    pthread_mutex_unlock(&reader->lock);
+    pthread_join(reader->producer, NULL);
+
+    pthread_mutex_destroy(&reader->lock);
+    pthread_cond_destroy(&reader->not_empty);
+    pthread_cond_destroy(&reader->not_full);
+    free(reader->ring);
+
+    codec_end(c);
+    if (c->map) {
+      munmap((void *)c->map, c->map_size);
+    }
+    free(c->in);
+    free(c);
+  }
+
+  if (reader->binary) {
+    munmap((void *)reader->binary->data, reader->binary->size);
+    free(reader->binary);
+  } else if (reader->bz2) {
+    close_bz2(reader->bz2);
+  } else if (reader->text.mapped) {
+    munmap(reader->text.data, reader->text.size);
+  } else {
+    free(reader->text.data);
+  }
+  if (reader->fd != STDIN_FILENO) {
+    close(reader->fd);
+  }
+  free(reader);
+}
+
+int
+trace_load(const char *path, trace_buffer *buffer)
+{
+  trace_reader *reader = trace_open(path);
+  if (!reader) {
+    return -1;
+  }
+
+  size_t capacity = 1 << 20;
+  buffer->pcs = malloc(capacity * sizeof(uint32_t));
+  buffer->outcomes = malloc(capacity);
+  buffer->count = 0;
+
+  for (;;) {
+    if (capacity - buffer->count < TRACE_BLOCK_SIZE) {
+      capacity *= 2;
+      buffer->pcs = realloc(buffer->pcs, capacity * sizeof(uint32_t));
+      buffer->outcomes = realloc(buffer->outcomes, capacity);
+    }
+    size_t n = trace_read_block(reader, buffer->pcs + buffer->count,
+                                buffer->outcomes + buffer->count,
+                                TRACE_BLOCK_SIZE);
+    if (n == 0) {
+      break;
+    }
+    buffer->count += n;
+  }
+
+  trace_close(reader);
+  return 0;
+}
+
+void
+trace_buffer_free(trace_buffer *buffer)
+{
+  free(buffer->pcs);
+  free(buffer->outcomes);
+  buffer->pcs = NULL;
+  buffer->outcomes = NULL;
+  buffer->count = 0;
+}
@@ -0,0 +1,116 @@
+//========================================================//
+//  trace.h                                               //
+//  Header file for the branch trace reader               //
+//                                                        //
+//  Decodes "0x<pc> <outcome>" traces into blocks of      //
+//  PCs and outcomes for the simulation loop              //
+//========================================================//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Number of branches the simulation loop requests per block
+#define TRACE_BLOCK_SIZE 4096
+
+// Binary trace format (.bpt), all integers little-endian:
+//
+//   header   "BPTRACE\0", u32 version, u32 block size,
+//            u64 branch count, u64 block count
+//   blocks   u32 count, u32 pc bytes,
+//            ceil(count/8) bytes of outcome bits (LSB first),
+//            'pc bytes' of LEB128 varints holding the zigzag-encoded
+//            delta of each PC from the previous one
+//
+// PC deltas restart from 0 at each block so blocks decode independently.
+#define BPT_MAGIC   "BPTRACE"
+#define BPT_VERSION 1
+
+// Block index of a bzip2 trace, written next to it as <trace>.idx after
+// the first full read, all integers little-endian:
+//
+//   header   "BPINDEX\0", u32 version, u32 reserved, u64 trace size,
+//            u64 trace mtime in nanoseconds, u64 branch count,
+//            u64 block count
+//   blocks   u64 start bit, u64 end bit, u64 first branch
+//
+// Each block spans bits [start, end) of the compressed file.  Its first
+// branch is the number of the first branch decoded after the block's
+// first newline.  An index whose size or mtime does not match the trace
+// is ignored.
+#define TRACE_INDEX_MAGIC   "BPINDEX"
+#define TRACE_INDEX_VERSION 1
+#define TRACE_INDEX_SUFFIX  ".idx"
+
+typedef struct trace_reader trace_reader;
+typedef struct trace_writer trace_writer;
+
+// A whole trace decoded into memory
+typedef struct {
+  uint32_t *pcs;
+  uint8_t *outcomes;
+  size_t count;
+} trace_buffer;
+
+//------------------------------------//
+//      Trace Function Prototypes     //
+//------------------------------------//
+
+// Open a trace for reading.  A NULL 'path' (or "-") reads from STDIN.
+// Regular files are memory-mapped and parsed in place; pipes and
+// terminals go through a large buffered reader.  bzip2, gzip and zstd
+// input is detected by its magic bytes and decoded on a producer thread,
+// except mapped bzip2 files, whose blocks are decoded in parallel on a
+// thread pool and delivered in order.
+//
+// Returns NULL (with errno set) if the trace cannot be opened
+//
+trace_reader *trace_open(const char *path);
+
+// Decode up to 'max' branches into 'pcs' and 'outcomes'
+//
+// Returns the number of branches decoded, 0 at the end of the trace
+//
+size_t trace_read_block(trace_reader *reader, uint32_t *pcs,
+                        uint8_t *outcomes, size_t max);
+
+// Move the reader so the next block starts at branch 'branch', counting
+// from 0.  bzip2 traces with an index jump straight to the block holding
+// it, in either direction; other traces are decoded up to it and cannot
+// go back.
+//
+// Returns 0 on success, -1 (with errno set) if the trace ends first or
+// cannot seek backwards
+//
+int trace_seek(trace_reader *reader, uint64_t branch);
+
+void trace_close(trace_reader *reader);
+
+// Decode the entire trace at 'path' into 'buffer'
+//
+// Returns 0 on success, -1 (with errno set) if it cannot be opened
+//
+int trace_load(const char *path, trace_buffer *buffer);
+
+void trace_buffer_free(trace_buffer *buffer);
+
+// Create a binary (.bpt) trace at 'path'
+//
+// Returns NULL (with errno set) if the file cannot be created
+//
+trace_writer *trace_writer_open(const char *path);
+
+// Append 'count' branches to the trace
+//
+void trace_write_block(trace_writer *writer, const uint32_t *pcs,
+                       const uint8_t *outcomes, size_t count);
+
+// Flush the trace and fill in its header
+//
+// Returns 0 on success, -1 (with errno set) on a write error
+//
+int trace_writer_close(trace_writer *writer);
+
+#endif
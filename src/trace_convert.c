@@ -0,0 +1,62 @@
+//========================================================//
+//  trace_convert.c                                       //
+//  Converts branch traces to the binary (.bpt) format    //
+//                                                        //
+//  Accepts anything the predictor can read: plain text,  //
+//  bzip2/gzip/zstd compressed text or binary traces      //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+// Print out the Usage information to stderr
+//
+void
+usage()
+{
+  fprintf(stderr,"Usage: trace_convert <input trace> <output.bpt>\n");
+  fprintf(stderr,"       bunzip2 -kc trace.bz2 | trace_convert - <output.bpt>\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  if (argc != 3 || !strcmp(argv[1], "--help")) {
+    usage();
+    exit(argc == 2 && !strcmp(argv[1], "--help") ? 0 : 1);
+  }
+
+  trace_reader *trace = trace_open(argv[1]);
+  if (!trace) {
+    perror(argv[1]);
+    exit(1);
+  }
+
+  trace_writer *writer = trace_writer_open(argv[2]);
+  if (!writer) {
+    perror(argv[2]);
+    exit(1);
+  }
+
+  static uint32_t pcs[TRACE_BLOCK_SIZE];
+  static uint8_t outcomes[TRACE_BLOCK_SIZE];
+  uint64_t num_branches = 0;
+  size_t count;
+
+  while ((count = trace_read_block(trace, pcs, outcomes, TRACE_BLOCK_SIZE))) {
+    trace_write_block(writer, pcs, outcomes, count);
+    num_branches += count;
+  }
+  trace_close(trace);
+
+  if (trace_writer_close(writer) != 0) {
+    perror(argv[2]);
+    exit(1);
+  }
+
+  fprintf(stderr, "%s: %llu branches\n", argv[2],
+          (unsigned long long)num_branches);
+  return 0;
+}
@@ -0,0 +1,666 @@
+//========================================================//
+//  trace_gen.c                                           //
+//  Synthetic branch trace generator                      //
+//                                                        //
+//  Writes traces of any length, as text or binary        //
+//  (.bpt), from a seeded model of loops, correlated,     //
+//  biased and random branches that changes by phase      //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+#include "trace.h"
+
+// Branches per chunk.  Each chunk is generated on its own from the seed
+// and its position, so the output does not depend on the thread count.
+// A chunk runs on to the end of the loop it is in, and the next one
+// starts with a new loop, so no loop is cut short between chunks.
+#define GEN_CHUNK (1 << 18)
+
+// Longest text line: "0x" + 8 hex digits + " 0\n"
+#define GEN_LINE_SIZE 13
+
+enum {
+  KIND_LOOP,                // Loop back-edge: taken on all but the last trip
+  KIND_CORRELATED,          // Same as (or the opposite of) its group's leader
+  KIND_BIASED,              // Mostly one way, at random
+  KIND_RANDOM,              // Either way, at random
+  KINDS
+};
+
+static const char *kind_names[KINDS] = {
+  "loop", "correlated", "biased", "random",
+};
+
+typedef struct {
+  uint64_t length;          // Dynamic branches to write
+  uint64_t seed;
+  int static_branches;
+  int weights[KINDS];       // Share of the static branches of each kind
+  uint32_t trip_min, trip_max;
+  double bias;              // Taken rate of biased branches (or 1 - it)
+  int group;                // Correlated branches per group
+  double noise;             // Chance a correlated branch disagrees
+  int phases;
+  uint64_t phase_length;    // Branches per phase
+} gen_options;
+
+typedef struct {
+  uint32_t pc;
+  uint8_t kind;
+  uint8_t invert;           // Correlated: opposite of the leader
+  uint16_t threshold;       // Taken (or, if correlated, flipped) when a
+                            // 16-bit draw is below it
+  int32_t leader;           // Correlated: leader of the group, -1 for the leader
+} static_branch;
+
+// A loop: its body of non-loop branches, then its back-edge
+typedef struct {
+  int loop;                 // -1 for straight-line code, run once per visit
+  int *body;
+  int body_len;
+} code_block;
+
+typedef struct {
+  uint32_t *trips;          // Per block
+  uint32_t *cumulative;     // Per block, scaled to 2^32, for choosing blocks
+} code_phase;
+
+typedef struct {
+  const gen_options *options;
+  static_branch *branches;
+  code_block *blocks;
+  int num_blocks;
+  code_phase *phases;
+  char (*prefixes)[16];     // "0x<pc> " of each branch
+  uint8_t *prefix_len;
+  size_t max_visit;         // Most branches one visit to a block can run
+} program;
+
+typedef struct {
+  const program *prog;
+  int text;                 // Format the chunk as text
+  uint64_t start;           // Position of the first branch, were chunks
+                            // exactly GEN_CHUNK long
+  size_t count;             // Branches wanted
+  size_t generated;         // Branches made: 'count', up to the end of a visit
+  uint32_t *ids;            // Static branch of each dynamic branch
+  uint8_t *outcomes;
+  uint8_t *last;            // Last outcome of each static branch
+  char *buf;                // Text, or the pcs when writing binary
+  size_t len;
+} gen_chunk;
+
+// Print out the Usage information to stderr
+//
+void
+usage()
+{
+  fprintf(stderr,"Usage: trace_gen <options> <branches> [<output>]\n");
+  fprintf(stderr," Writes <branches> branches (suffixes K, M and G allowed) as text to\n"
+                 " <output> or STDOUT, or as a binary trace if <output> ends in .bpt\n");
+  fprintf(stderr," Options:\n");
+  fprintf(stderr," --help                Print this message\n");
+  fprintf(stderr," --seed=<n>            Seed; equal seeds give equal traces (default: 1)\n");
+  fprintf(stderr," --static=<n>          Static branches (default: 2000)\n");
+  fprintf(stderr," --mix=<loop>:<correlated>:<biased>:<random>\n"
+                 "                       Relative shares of each kind of branch\n"
+                 "                       (default: 30:30:30:10)\n");
+  fprintf(stderr," --trips=<min>:<max>   Loop trip counts (default: 4:64)\n");
+  fprintf(stderr," --bias=<p>            Taken rate of biased branches, or 1 - <p>\n"
+                 "                       (default: 0.95)\n");
+  fprintf(stderr," --group=<n>           Correlated branches per group (default: 4)\n");
+  fprintf(stderr," --noise=<p>           Chance a correlated branch disagrees with its\n"
+                 "                       group (default: 0.02)\n");
+  fprintf(stderr," --phases=<n>:<length> Cycle through <n> phases of <length> branches,\n"
+                 "                       each with its own hot loops and trip counts\n"
+                 "                       (default: 4:10M)\n");
+  fprintf(stderr," --threads=<n>         Generating threads (default: one per CPU)\n");
+}
+
+// Parse a count with an optional K, M or G suffix
+//
+// Returns 0 if it is malformed
+//
+static uint64_t
+parse_count(const char *s)
+{
+  char *end;
+  uint64_t n = strtoull(s, &end, 10);
+  switch (*end) {
+    case 'K': case 'k': n *= 1000; end++; break;
+    case 'M': case 'm': n *= 1000000; end++; break;
+    case 'G': case 'g': n *= 1000000000; end++; break;
+  }
+  return end == s || *end ? 0 : n;
+}
+
+//------------------------------------//
+//          Random Numbers            //
+//------------------------------------//
+
+// xoshiro256**, seeded through splitmix64
+typedef struct {
+  uint64_t s[4];
+  uint64_t bits;            // Unused draws of 16 bits
+  int left;
+} rng;
+
+static uint64_t
+splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static void
+rng_seed(rng *r, uint64_t seed)
+{
+  for (int i = 0; i < 4; i++) {
+    r->s[i] = splitmix64(&seed);
+  }
+  r->left = 0;
+}
+
+static inline uint64_t
+rng_next(rng *r)
+{
+  uint64_t *s = r->s;
+  uint64_t result = ((s[1] * 5) << 7 | (s[1] * 5) >> 57) * 9;
+  uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = (s[3] << 45) | (s[3] >> 19);
+  return result;
+}
+
+static inline uint16_t
+rng_draw16(rng *r)
+{
+  if (r->left == 0) {
+    r->bits = rng_next(r);
+    r->left = 4;
+  }
+  uint16_t draw = r->bits;
+  r->bits >>= 16;
+  r->left--;
+  return draw;
+}
+
+// Returns a number in [0, n)
+//
+static inline uint32_t
+rng_below(rng *r, uint32_t n)
+{
+  return ((rng_next(r) >> 32) * n) >> 32;
+}
+
+static uint16_t
+probability(double p)
+{
+  double scaled = p * 65536;
+  return scaled >= 65535 ? 65535 : scaled <= 0 ? 0 : (uint16_t)scaled;
+}
+
+static void
+shuffle(rng *r, int *items, int n)
+{
+  for (int i = n - 1; i > 0; i--) {
+    int j = rng_below(r, i + 1);
+    int t = items[i];
+    items[i] = items[j];
+    items[j] = t;
+  }
+}
+
+//------------------------------------//
+//           Program Model            //
+//------------------------------------//
+
+// Lay out the static branches in blocks and draw each phase's hot
+// blocks and trip counts, all from the seed
+//
+static void
+build_program(program *prog, const gen_options *o)
+{
+  rng r;
+  rng_seed(&r, o->seed);
+  int n = o->static_branches;
+  prog->options = o;
+  prog->branches = calloc(n, sizeof(static_branch));
+
+  // Kinds in proportion to the weights, each in one run so that
+  // correlated groups are consecutive
+  int total = 0, assigned = 0;
+  int counts[KINDS];
+  for (int k = 0; k < KINDS; k++) {
+    total += o->weights[k];
+  }
+  for (int k = 0; k < KINDS; k++) {
+    counts[k] = (int)((double)o->weights[k] * n / total);
+    assigned += counts[k];
+  }
+  for (int k = 0; assigned < n; k = (k + 1) % KINDS) {
+    if (o->weights[k] > 0) {
+      counts[k]++;
+      assigned++;
+    }
+  }
+  int *order = malloc(n * sizeof(int));
+  for (int k = 0, i = 0; k < KINDS; k++) {
+    for (int c = 0; c < counts[k]; c++, i++) {
+      prog->branches[i].kind = k;
+    }
+  }
+
+  int loops = counts[KIND_LOOP];
+  int leader = -1;
+  for (int i = 0; i < n; i++) {
+    static_branch *b = &prog->branches[i];
+    b->leader = -1;
+    switch (b->kind) {
+      case KIND_BIASED:
+        b->threshold = probability(rng_below(&r, 2) ? o->bias : 1 - o->bias);
+        break;
+      case KIND_CORRELATED:
+        // The first of each run of 'group' leads it, at random
+        if (leader >= 0 && i - leader < o->group) {
+          b->leader = leader;
+          b->invert = rng_below(&r, 2);
+          b->threshold = probability(o->noise);
+        } else {
+          leader = i;
+          b->threshold = probability(0.5);
+        }
+        break;
+      case KIND_RANDOM:
+        b->threshold = probability(0.5);
+        break;
+    }
+  }
+
+  // One block per loop, or a single straight-line block if there are
+  // none; the other branches go into the bodies, groups kept together
+  prog->num_blocks = loops ? loops : 1;
+  prog->blocks = calloc(prog->num_blocks, sizeof(code_block));
+  for (int i = 0, b = 0; i < n; i++) {
+    if (prog->branches[i].kind == KIND_LOOP) {
+      prog->blocks[b++].loop = i;
+    }
+  }
+  if (!loops) {
+    prog->blocks[0].loop = -1;
+  }
+
+  int num_items = 0;
+  for (int i = 0; i < n; i++) {
+    const static_branch *b = &prog->branches[i];
+    if (b->kind != KIND_LOOP && !(b->kind == KIND_CORRELATED && b->leader >= 0)) {
+      order[num_items++] = i;
+    }
+  }
+  shuffle(&r, order, num_items);
+  for (int t = 0; t < num_items; t++) {
+    code_block *block = &prog->blocks[t % prog->num_blocks];
+    int first = order[t];
+    int last = first;
+    while (last + 1 < n && prog->branches[last + 1].leader == first) {
+      last++;
+    }
+    block->body = realloc(block->body, (block->body_len + last - first + 1) * sizeof(int));
+    for (int i = first; i <= last; i++) {
+      block->body[block->body_len++] = i;
+    }
+  }
+  free(order);
+
+  prog->max_visit = 0;
+  for (int k = 0; k < prog->num_blocks; k++) {
+    const code_block *block = &prog->blocks[k];
+    size_t visit = block->loop < 0 ? (size_t)block->body_len
+                                   : (size_t)o->trip_max * (block->body_len + 1);
+    if (visit > prog->max_visit) {
+      prog->max_visit = visit;
+    }
+  }
+
+  // Addresses run through the blocks in order, a few instructions apart
+  uint32_t pc = 0x400000;
+  prog->prefixes = malloc(n * sizeof(*prog->prefixes));
+  prog->prefix_len = malloc(n);
+  for (int k = 0; k < prog->num_blocks; k++) {
+    const code_block *block = &prog->blocks[k];
+    for (int i = 0; i <= block->body_len; i++) {
+      int id = i < block->body_len ? block->body[i] : block->loop;
+      if (id < 0) {
+        continue;
+      }
+      pc += 4 + 4 * rng_below(&r, 16);
+      prog->branches[id].pc = pc;
+      prog->prefix_len[id] = snprintf(prog->prefixes[id], sizeof(prog->prefixes[id]),
+                                      "0x%x ", pc);
+    }
+  }
+
+  // Each phase ranks the blocks afresh, with Zipf-distributed heat, and
+  // draws new trip counts
+  prog->phases = calloc(o->phases, sizeof(code_phase));
+  int *rank = malloc(prog->num_blocks * sizeof(int));
+  double *weight = malloc(prog->num_blocks * sizeof(double));
+  for (int p = 0; p < o->phases; p++) {
+    code_phase *phase = &prog->phases[p];
+    phase->trips = malloc(prog->num_blocks * sizeof(uint32_t));
+    phase->cumulative = malloc(prog->num_blocks * sizeof(uint32_t));
+    for (int k = 0; k < prog->num_blocks; k++) {
+      rank[k] = k;
+      phase->trips[k] = prog->blocks[k].loop < 0 ? 1 :
+                        o->trip_min + rng_below(&r, o->trip_max - o->trip_min + 1);
+    }
+    shuffle(&r, rank, prog->num_blocks);
+    double sum = 0;
+    for (int k = 0; k < prog->num_blocks; k++) {
+      weight[k] = 1.0 / (rank[k] + 1);
+      sum += weight[k];
+    }
+    double cumulative = 0;
+    for (int k = 0; k < prog->num_blocks; k++) {
+      cumulative += weight[k] / sum;
+      phase->cumulative[k] = cumulative >= 1 ? UINT32_MAX : (uint32_t)(cumulative * 4294967296.0);
+    }
+    phase->cumulative[prog->num_blocks - 1] = UINT32_MAX;
+  }
+  free(rank);
+  free(weight);
+}
+
+static void
+free_program(program *prog)
+{
+  for (int k = 0; k < prog->num_blocks; k++) {
+    free(prog->blocks[k].body);
+  }
+  for (int p = 0; p < prog->options->phases; p++) {
+    free(prog->phases[p].trips);
+    free(prog->phases[p].cumulative);
+  }
+  free(prog->blocks);
+  free(prog->phases);
+  free(prog->branches);
+  free(prog->prefixes);
+  free(prog->prefix_len);
+}
+
+// Returns the block a draw of 32 bits picks in 'phase'
+//
+static inline int
+pick_block(const program *prog, const code_phase *phase, uint32_t draw)
+{
+  int lo = 0, hi = prog->num_blocks - 1;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (draw <= phase->cumulative[mid]) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+static inline uint8_t
+outcome_of(const static_branch *b, uint8_t *last, int id, rng *r)
+{
+  uint8_t outcome;
+  if (b->leader >= 0) {
+    outcome = (last[b->leader] ^ b->invert) ^ (rng_draw16(r) < b->threshold);
+  } else {
+    outcome = rng_draw16(r) < b->threshold;
+  }
+  last[id] = outcome;
+  return outcome;
+}
+
+// Generate a chunk: visit blocks in proportion to their heat in the
+// current phase, running each loop for its trip count, until at least
+// 'count' branches are made.  Correlated groups sit within one block, so
+// clearing the last outcomes between chunks leaves them unchanged.
+//
+static void
+generate_chunk(void *arg)
+{
+  gen_chunk *c = arg;
+  const program *prog = c->prog;
+  const gen_options *o = prog->options;
+  rng r;
+  uint64_t seed = o->seed ^ (c->start / GEN_CHUNK + 1) * 0xd1342543de82ef95ULL;
+  rng_seed(&r, seed);
+  memset(c->last, 0, o->static_branches);
+
+  size_t n = 0;
+  while (n < c->count) {
+    const code_phase *phase = &prog->phases[((c->start + n) / o->phase_length) % o->phases];
+    int k = pick_block(prog, phase, rng_next(&r) >> 32);
+    const code_block *block = &prog->blocks[k];
+    uint32_t trips = phase->trips[k];
+
+    for (uint32_t t = 0; t < trips; t++) {
+      for (int i = 0; i < block->body_len; i++) {
+        int id = block->body[i];
+        c->ids[n] = id;
+        c->outcomes[n++] = outcome_of(&prog->branches[id], c->last, id, &r);
+      }
+      if (block->loop >= 0) {
+        c->ids[n] = block->loop;
+        c->outcomes[n++] = t + 1 < trips;
+      }
+    }
+  }
+  c->generated = n;
+
+  // Format the chunk, copying each branch's prefix whole and then
+  // moving on by its length
+  if (c->text) {
+    char *p = c->buf;
+    for (size_t i = 0; i < n; i++) {
+      uint32_t id = c->ids[i];
+      memcpy(p, prog->prefixes[id], 16);
+      p += prog->prefix_len[id];
+      p[0] = '0' + c->outcomes[i];
+      p[1] = '\n';
+      p += 2;
+    }
+    c->len = p - c->buf;
+  } else {
+    uint32_t *pcs = (uint32_t *)c->buf;
+    for (size_t i = 0; i < n; i++) {
+      pcs[i] = prog->branches[c->ids[i]].pc;
+    }
+  }
+}
+
+//------------------------------------//
+//             Main Loop              //
+//------------------------------------//
+
+int
+main(int argc, char *argv[])
+{
+  gen_options o = {
+    .length = 0, .seed = 1, .static_branches = 2000,
+    .weights = { 30, 30, 30, 10 }, .trip_min = 4, .trip_max = 64,
+    .bias = 0.95, .group = 4, .noise = 0.02, .phases = 4,
+    .phase_length = 10000000,
+  };
+  const char *output = NULL;
+  int threads = 0;
+
+  // Process cmdline Arguments
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    int ok = 1;
+    if (!strcmp(arg,"--help")) {
+      usage();
+      exit(0);
+    } else if (!strncmp(arg,"--seed=",7)) {
+      o.seed = strtoull(arg + 7, NULL, 10);
+    } else if (!strncmp(arg,"--static=",9)) {
+      o.static_branches = parse_count(arg + 9);
+      ok = o.static_branches > 0;
+    } else if (!strncmp(arg,"--mix=",6)) {
+      ok = sscanf(arg + 6, "%d:%d:%d:%d", &o.weights[0], &o.weights[1],
+                  &o.weights[2], &o.weights[3]) == KINDS &&
+           o.weights[0] >= 0 && o.weights[1] >= 0 && o.weights[2] >= 0 &&
+           o.weights[3] >= 0 &&
+           o.weights[0] + o.weights[1] + o.weights[2] + o.weights[3] > 0;
+    } else if (!strncmp(arg,"--trips=",8)) {
+      ok = sscanf(arg + 8, "%u:%u", &o.trip_min, &o.trip_max) == 2 &&
+           o.trip_min >= 1 && o.trip_min <= o.trip_max;
+    } else if (!strncmp(arg,"--bias=",7)) {
+      o.bias = atof(arg + 7);
+      ok = o.bias >= 0.5 && o.bias <= 1;
+    } else if (!strncmp(arg,"--group=",8)) {
+      o.group = atoi(arg + 8);
+      ok = o.group >= 1;
+    } else if (!strncmp(arg,"--noise=",8)) {
+      o.noise = atof(arg + 8);
+      ok = o.noise >= 0 && o.noise <= 1;
+    } else if (!strncmp(arg,"--phases=",9)) {
+      const char *colon = strchr(arg + 9, ':');
+      o.phases = atoi(arg + 9);
+      if (colon) {
+        o.phase_length = parse_count(colon + 1);
+      }
+      ok = o.phases >= 1 && o.phase_length > 0;
+    } else if (!strncmp(arg,"--threads=",10)) {
+      threads = atoi(arg + 10);
+    } else if (!strncmp(arg,"--",2)) {
+      ok = 0;
+    } else if (!o.length) {
+      o.length = parse_count(arg);
+      ok = o.length > 0;
+    } else {
+      output = arg;
+    }
+    if (!ok) {
+      printf("Unrecognized option %s\n", arg);
+      usage();
+      exit(1);
+    }
+  }
+
+  if (!o.length) {
+    usage();
+    exit(1);
+  }
+
+  // Binary traces go through the trace writer, text straight out
+  size_t out_len = output ? strlen(output) : 0;
+  int text = !(out_len > 4 && !strcmp(output + out_len - 4, ".bpt"));
+  trace_writer *writer = NULL;
+  FILE *out = stdout;
+  if (!text && !(writer = trace_writer_open(output))) {
+    perror(output);
+    exit(1);
+  }
+  if (text && output && strcmp(output, "-") && !(out = fopen(output, "w"))) {
+    perror(output);
+    exit(1);
+  }
+
+  program prog;
+  build_program(&prog, &o);
+  int counts[KINDS] = { 0 };
+  for (int i = 0; i < o.static_branches; i++) {
+    counts[prog.branches[i].kind]++;
+  }
+  fprintf(stderr, "trace_gen: %d static branches (", o.static_branches);
+  for (int k = 0; k < KINDS; k++) {
+    fprintf(stderr, "%s%d %s", k ? ", " : "", counts[k], kind_names[k]);
+  }
+  fprintf(stderr, ") in %d blocks\n", prog.num_blocks);
+
+  // Generate a batch of chunks in parallel, then write them in order.
+  // Chunks run a little long, so the last one written is cut to length
+  // and any after it are dropped.
+  pool *workers = pool_create(threads);
+  int batch = 2 * pool_threads(workers);
+  size_t capacity = GEN_CHUNK + prog.max_visit;
+  gen_chunk *chunks = calloc(batch, sizeof(gen_chunk));
+  for (int b = 0; b < batch; b++) {
+    chunks[b].prog = &prog;
+    chunks[b].text = text;
+    chunks[b].ids = malloc(capacity * sizeof(uint32_t));
+    chunks[b].outcomes = malloc(capacity);
+    chunks[b].last = malloc(o.static_branches);
+    // The prefix copy may run past the line by up to 16 bytes
+    chunks[b].buf = malloc(text ? capacity * GEN_LINE_SIZE + 16
+                                : capacity * sizeof(uint32_t));
+  }
+
+  uint64_t written = 0;
+  for (uint64_t start = 0; written < o.length; ) {
+    int used = 0;
+    for (; used < batch && start < o.length; used++) {
+      chunks[used].start = start;
+      chunks[used].count = o.length - start < GEN_CHUNK ? o.length - start : GEN_CHUNK;
+      start += chunks[used].count;
+      pool_submit(workers, generate_chunk, &chunks[used]);
+    }
+    pool_wait(workers);
+
+    for (int b = 0; b < used && written < o.length; b++) {
+      gen_chunk *c = &chunks[b];
+      size_t count = c->generated;
+      if (count > o.length - written) {
+        count = o.length - written;
+      }
+      if (text) {
+        size_t len = c->len;
+        if (count < c->generated) {
+          const char *end = c->buf;
+          for (size_t i = 0; i < count; i++) {
+            end = memchr(end, '\n', c->buf + c->len - end) + 1;
+          }
+          len = end - c->buf;
+        }
+        if (fwrite(c->buf, 1, len, out) != len) {
+          perror(output ? output : "stdout");
+          exit(1);
+        }
+      } else {
+        trace_write_block(writer, (uint32_t *)c->buf, c->outcomes, count);
+      }
+      written += count;
+    }
+  }
+  pool_destroy(workers);
+
+  if (writer && trace_writer_close(writer) != 0) {
+    perror(output);
+    exit(1);
+  }
+  if (out != stdout && fclose(out) != 0) {
+    perror(output);
+    exit(1);
+  }
+  fflush(stdout);
+
+  for (int b = 0; b < batch; b++) {
+    free(chunks[b].ids);
+    free(chunks[b].outcomes);
+    free(chunks[b].last);
+    free(chunks[b].buf);
+  }
+  free(chunks);
+  free_program(&prog);
+
+  return 0;
+}
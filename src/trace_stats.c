@@ -0,0 +1,554 @@
+//========================================================//
+//  trace_stats.c                                         //
+//  One-pass trace characterization                       //
+//                                                        //
+//  Streams each trace once, in bounded memory, and       //
+//  writes its branch counts, footprint, bias and         //
+//  history entropy as JSON                               //
+//========================================================//
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+// HyperLogLog registers, 2^HLL_BITS of them: about 0.8% standard error
+#define HLL_BITS 14
+
+// Count-min sketch rows and their width
+#define CM_DEPTH 4
+#define CM_BITS 16
+
+// Global history bits whose patterns are counted exactly for the
+// entropy figures; shorter histories are folded out of the same table
+#define ENTROPY_BITS 16
+
+// Global history lengths of the (PC, history) footprints
+static const int footprint_bits[] = { 8, 16, 32 };
+#define FOOTPRINTS (int)(sizeof(footprint_bits) / sizeof(footprint_bits[0]))
+
+// Static branches per bucket of taken rate in the bias histogram
+#define BIAS_BUCKETS 10
+
+// Shares of the dynamic branches the hot-branch footprint is given for
+static const double coverage_points[] = { 0.5, 0.9, 0.99 };
+#define COVERAGE_POINTS (int)(sizeof(coverage_points) / sizeof(coverage_points[0]))
+
+int top = 4096;             // Static branches tracked exactly
+
+// Print out the Usage information to stderr
+//
+void
+usage()
+{
+  fprintf(stderr,"Usage: trace_stats <options> <trace>...\n");
+  fprintf(stderr," Options:\n");
+  fprintf(stderr," --help            Print this message\n");
+  fprintf(stderr," --top=<n>         Hottest static branches tracked exactly, for the\n"
+                 "                   bias and footprint figures (default: 4096)\n");
+  fprintf(stderr," --output=<file>   Write the JSON to <file> instead of stdout\n");
+}
+
+// The splitmix64 finalizer
+static inline uint64_t
+mix64(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+//------------------------------------//
+//            HyperLogLog             //
+//------------------------------------//
+
+typedef struct {
+  uint8_t registers[1 << HLL_BITS];
+} hll;
+
+static inline void
+hll_add(hll *h, uint64_t hash)
+{
+  uint32_t index = hash >> (64 - HLL_BITS);
+  uint64_t rest = (hash << HLL_BITS) | (1ULL << (HLL_BITS - 1));
+  uint8_t rank = __builtin_clzll(rest) + 1;
+  if (rank > h->registers[index]) {
+    h->registers[index] = rank;
+  }
+}
+
+// Returns the estimated number of distinct hashes added
+//
+static double
+hll_estimate(const hll *h)
+{
+  const double m = 1 << HLL_BITS;
+  double sum = 0;
+  int zeros = 0;
+  for (int i = 0; i < (1 << HLL_BITS); i++) {
+    sum += ldexp(1.0, -h->registers[i]);
+    zeros += h->registers[i] == 0;
+  }
+  double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+
+  // Linear counting is more accurate while many registers are empty
+  if (estimate <= 2.5 * m && zeros > 0) {
+    estimate = m * log(m / zeros);
+  }
+  return estimate;
+}
+
+//------------------------------------//
+//     Count-Min and Hot Branches     //
+//------------------------------------//
+
+// The hottest static branches are kept in a min-heap ordered by their
+// execution counts, so the coldest of them can be replaced.  A branch
+// enters with the count-min estimate of its executions so far and is
+// then counted exactly; when it is replaced its count goes back into
+// the sketch.
+typedef struct {
+  uint32_t pc;
+  uint64_t executions;
+  uint64_t taken;           // Counted from when it entered
+  uint64_t seen;            // Executions counted exactly
+  uint32_t slot;            // Its slot in the PC index
+} hot_branch;
+
+typedef struct {
+  uint32_t cm[CM_DEPTH][1 << CM_BITS];
+  hot_branch *heap;
+  int count;
+  int capacity;
+  int *slots;               // Open-addressing PC index into the heap, -1 if empty
+  uint32_t slot_mask;
+} branch_counts;
+
+// Returns the slot holding 'pc', whose hash is 'hash', or the empty slot
+// where it would go
+//
+static inline uint32_t
+find_slot(const branch_counts *b, uint32_t pc, uint64_t hash)
+{
+  uint32_t s = hash & b->slot_mask;
+  while (b->slots[s] >= 0 && b->heap[b->slots[s]].pc != pc) {
+    s = (s + 1) & b->slot_mask;
+  }
+  return s;
+}
+
+// Remove the entry in slot 's', shifting back later entries of its
+// probe run so that lookups still find them
+//
+static void
+clear_slot(branch_counts *b, uint32_t s)
+{
+  b->slots[s] = -1;
+  for (uint32_t next = (s + 1) & b->slot_mask; b->slots[next] >= 0;
+       next = (next + 1) & b->slot_mask) {
+    uint32_t home = mix64(b->heap[b->slots[next]].pc) & b->slot_mask;
+    // Move it if its home is not in (s, next]
+    if (((next - home) & b->slot_mask) >= ((next - s) & b->slot_mask)) {
+      b->slots[s] = b->slots[next];
+      b->heap[b->slots[s]].slot = s;
+      b->slots[next] = -1;
+      s = next;
+    }
+  }
+}
+
+static inline void
+heap_swap(branch_counts *b, int i, int j)
+{
+  hot_branch t = b->heap[i];
+  b->heap[i] = b->heap[j];
+  b->heap[j] = t;
+  b->slots[b->heap[i].slot] = i;
+  b->slots[b->heap[j].slot] = j;
+}
+
+static void
+sift_down(branch_counts *b, int i)
+{
+  for (;;) {
+    int smallest = i;
+    int left = 2 * i + 1, right = left + 1;
+    if (left < b->count && b->heap[left].executions < b->heap[smallest].executions) {
+      smallest = left;
+    }
+    if (right < b->count && b->heap[right].executions < b->heap[smallest].executions) {
+      smallest = right;
+    }
+    if (smallest == i) {
+      return;
+    }
+    heap_swap(b, i, smallest);
+    i = smallest;
+  }
+}
+
+static void
+sift_up(branch_counts *b, int i)
+{
+  while (i > 0 && b->heap[(i - 1) / 2].executions > b->heap[i].executions) {
+    heap_swap(b, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void
+branch_counts_init(branch_counts *b, int capacity)
+{
+  memset(b->cm, 0, sizeof(b->cm));
+  b->heap = malloc(capacity * sizeof(hot_branch));
+  b->count = 0;
+  b->capacity = capacity;
+  uint32_t slots = 1;
+  while (slots < 2 * (uint32_t)capacity) {
+    slots <<= 1;
+  }
+  b->slots = malloc(slots * sizeof(int));
+  memset(b->slots, -1, slots * sizeof(int));
+  b->slot_mask = slots - 1;
+}
+
+// Conservative update: raise each row only as far as the new estimate
+//
+// Returns the estimated executions of 'pc', this one included
+//
+static inline uint64_t
+cm_add(branch_counts *b, uint64_t hash, uint64_t amount)
+{
+  uint32_t *cells[CM_DEPTH];
+  uint64_t estimate = UINT32_MAX;
+  for (int d = 0; d < CM_DEPTH; d++) {
+    cells[d] = &b->cm[d][(hash >> (d * CM_BITS)) & ((1 << CM_BITS) - 1)];
+    if (*cells[d] < estimate) {
+      estimate = *cells[d];
+    }
+  }
+  estimate += amount;
+  if (estimate > UINT32_MAX) {
+    estimate = UINT32_MAX;
+  }
+  for (int d = 0; d < CM_DEPTH; d++) {
+    if (*cells[d] < estimate) {
+      *cells[d] = estimate;
+    }
+  }
+  return estimate;
+}
+
+// Raise each row of 'hash' to at least 'count'
+//
+static void
+cm_raise(branch_counts *b, uint64_t hash, uint64_t count)
+{
+  uint32_t value = count < UINT32_MAX ? count : UINT32_MAX;
+  for (int d = 0; d < CM_DEPTH; d++) {
+    uint32_t *cell = &b->cm[d][(hash >> (d * CM_BITS)) & ((1 << CM_BITS) - 1)];
+    if (*cell < value) {
+      *cell = value;
+    }
+  }
+}
+
+static inline void
+count_branch(branch_counts *b, uint32_t pc, uint64_t hash, uint8_t outcome)
+{
+  uint32_t s = find_slot(b, pc, hash);
+  if (b->slots[s] >= 0) {
+    int i = b->slots[s];
+    b->heap[i].executions++;
+    b->heap[i].taken += outcome;
+    b->heap[i].seen++;
+    sift_down(b, i);
+    return;
+  }
+
+  uint64_t estimate = cm_add(b, hash, 1);
+  if (b->count == b->capacity) {
+    if (estimate <= b->heap[0].executions) {
+      return;
+    }
+    // Replace the coldest tracked branch, returning its count to the sketch
+    hot_branch *cold = &b->heap[0];
+    cm_raise(b, mix64(cold->pc), cold->executions);
+    clear_slot(b, cold->slot);
+    b->heap[0] = b->heap[--b->count];
+    if (b->count > 0) {
+      b->slots[b->heap[0].slot] = 0;
+      sift_down(b, 0);
+    }
+    s = find_slot(b, pc, hash);
+  }
+
+  int i = b->count++;
+  b->heap[i] = (hot_branch){ pc, estimate, outcome, 1, s };
+  b->slots[s] = i;
+  sift_up(b, i);
+}
+
+static int
+compare_hot(const void *a, const void *b)
+{
+  uint64_t x = ((const hot_branch *)a)->executions;
+  uint64_t y = ((const hot_branch *)b)->executions;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+//------------------------------------//
+//           Characterization         //
+//------------------------------------//
+
+typedef struct {
+  uint64_t branches;
+  uint64_t taken;
+  hll pcs;
+  hll footprints[FOOTPRINTS];
+  branch_counts counts;
+  uint64_t (*patterns)[2]; // Outcomes after each ENTROPY_BITS of history
+} trace_stats;
+
+// Returns the entropy in bits of an outcome taken 'taken' times in 'n'
+//
+static double
+entropy(uint64_t taken, uint64_t n)
+{
+  if (taken == 0 || taken == n) {
+    return 0;
+  }
+  double p = (double)taken / n;
+  return -p * log2(p) - (1 - p) * log2(1 - p);
+}
+
+// Returns the entropy of the outcome given the last 'bits' outcomes
+//
+static double
+history_entropy(const trace_stats *s, int bits)
+{
+  uint32_t contexts = 1u << bits;
+  uint32_t folds = 1u << (ENTROPY_BITS - bits);
+  double sum = 0;
+  for (uint32_t c = 0; c < contexts; c++) {
+    uint64_t counts[2] = { 0, 0 };
+    for (uint32_t f = 0; f < folds; f++) {
+      counts[0] += s->patterns[(f << bits) | c][0];
+      counts[1] += s->patterns[(f << bits) | c][1];
+    }
+    uint64_t n = counts[0] + counts[1];
+    sum += n ? (double)n * entropy(counts[1], n) : 0;
+  }
+  return s->branches ? sum / s->branches : 0;
+}
+
+static void
+characterize(trace_reader *trace, trace_stats *s)
+{
+  static uint32_t pcs[TRACE_BLOCK_SIZE];
+  static uint8_t outcomes[TRACE_BLOCK_SIZE];
+  uint64_t history = 0;
+  size_t count;
+
+  while ((count = trace_read_block(trace, pcs, outcomes, TRACE_BLOCK_SIZE))) {
+    for (size_t i = 0; i < count; i++) {
+      uint32_t pc = pcs[i];
+      uint8_t outcome = outcomes[i] != 0;
+
+      uint64_t hash = mix64(pc);
+
+      hll_add(&s->pcs, hash);
+      for (int f = 0; f < FOOTPRINTS; f++) {
+        uint64_t h = footprint_bits[f] < 64 ?
+                     history & ((1ULL << footprint_bits[f]) - 1) : history;
+        // One multiply mixes the history in well enough for the top bits
+        hll_add(&s->footprints[f],
+                (hash ^ (h * 0x9e3779b97f4a7c15ULL)) * 0xbf58476d1ce4e5b9ULL);
+      }
+      count_branch(&s->counts, pc, hash, outcome);
+      s->patterns[history & ((1 << ENTROPY_BITS) - 1)][outcome]++;
+
+      s->taken += outcome;
+      history = (history << 1) | outcome;
+    }
+    s->branches += count;
+  }
+}
+
+// Write 's' as a quoted JSON string
+//
+static void
+print_json_string(FILE *out, const char *s)
+{
+  fputc('"', out);
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      fprintf(out, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(out, "\\u%04x", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+// Write the figures of one trace as a JSON object
+//
+static void
+print_stats(FILE *out, const char *name, trace_stats *s)
+{
+  branch_counts *b = &s->counts;
+  qsort(b->heap, b->count, sizeof(hot_branch), compare_hot);
+
+  uint64_t tracked = 0;
+  double pc_entropy = 0;
+  uint64_t static_bias[BIAS_BUCKETS] = { 0 };
+  double dynamic_bias[BIAS_BUCKETS] = { 0 };
+  for (int i = 0; i < b->count; i++) {
+    const hot_branch *h = &b->heap[i];
+    tracked += h->executions;
+    int bucket = (int)((double)h->taken / h->seen * BIAS_BUCKETS);
+    bucket = bucket < BIAS_BUCKETS ? bucket : BIAS_BUCKETS - 1;
+    static_bias[bucket]++;
+    dynamic_bias[bucket] += h->executions;
+    pc_entropy += h->executions * entropy(h->taken, h->seen);
+  }
+
+  fprintf(out, "    {\n      \"trace\": ");
+  print_json_string(out, name);
+  fprintf(out, ",\n");
+  fprintf(out, "      \"branches\": %llu,\n", (unsigned long long)s->branches);
+  fprintf(out, "      \"taken_ratio\": %.6f,\n",
+          s->branches ? (double)s->taken / s->branches : 0);
+  fprintf(out, "      \"static_branches\": %.0f,\n", hll_estimate(&s->pcs));
+
+  fprintf(out, "      \"pc_history_contexts\": {");
+  for (int f = 0; f < FOOTPRINTS; f++) {
+    fprintf(out, "%s\"%d\": %.0f", f ? ", " : "", footprint_bits[f],
+            hll_estimate(&s->footprints[f]));
+  }
+  fprintf(out, "},\n");
+
+  fprintf(out, "      \"hot_branches\": {\"tracked\": %d, \"coverage\": %.6f",
+          b->count, s->branches ? (double)tracked / s->branches : 0);
+  for (int c = 0; c < COVERAGE_POINTS; c++) {
+    uint64_t sum = 0;
+    int needed = -1;
+    for (int i = 0; i < b->count && needed < 0; i++) {
+      sum += b->heap[i].executions;
+      if (sum >= coverage_points[c] * s->branches) {
+        needed = i + 1;
+      }
+    }
+    fprintf(out, ", \"for_%g\": ", coverage_points[c] * 100);
+    if (needed < 0) {
+      fprintf(out, "null");
+    } else {
+      fprintf(out, "%d", needed);
+    }
+  }
+  fprintf(out, "},\n");
+
+  fprintf(out, "      \"bias\": {\"static\": [");
+  for (int k = 0; k < BIAS_BUCKETS; k++) {
+    fprintf(out, "%s%llu", k ? ", " : "", (unsigned long long)static_bias[k]);
+  }
+  fprintf(out, "], \"dynamic\": [");
+  for (int k = 0; k < BIAS_BUCKETS; k++) {
+    fprintf(out, "%s%.6f", k ? ", " : "", tracked ? dynamic_bias[k] / tracked : 0);
+  }
+  fprintf(out, "]},\n");
+
+  fprintf(out, "      \"entropy\": {\"outcome\": %.6f, \"pc\": %.6f, \"global_history\": {",
+          entropy(s->taken, s->branches), tracked ? pc_entropy / tracked : 0);
+  for (int bits = 4; bits <= ENTROPY_BITS; bits += 4) {
+    fprintf(out, "%s\"%d\": %.6f", bits > 4 ? ", " : "", bits,
+            history_entropy(s, bits));
+  }
+  fprintf(out, "}}\n    }");
+}
+
+int
+main(int argc, char *argv[])
+{
+  const char *output = NULL;
+  const char **paths = NULL;
+  int num_paths = 0;
+
+  // Process cmdline Arguments
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i],"--help")) {
+      usage();
+      exit(0);
+    } else if (!strncmp(argv[i],"--top=",6)) {
+      top = atoi(argv[i] + 6);
+    } else if (!strncmp(argv[i],"--output=",9)) {
+      output = argv[i] + 9;
+    } else if (!strncmp(argv[i],"--",2)) {
+      printf("Unrecognized option %s\n", argv[i]);
+      usage();
+      exit(1);
+    } else {
+      paths = realloc(paths, (num_paths + 1) * sizeof(char *));
+      paths[num_paths++] = argv[i];
+    }
+  }
+
+  if (num_paths == 0 || top < 1) {
+    usage();
+    exit(1);
+  }
+
+  FILE *out = stdout;
+  if (output && !(out = fopen(output, "w"))) {
+    perror(output);
+    exit(1);
+  }
+
+  trace_stats *s = malloc(sizeof(trace_stats));
+  branch_counts_init(&s->counts, top);
+  s->patterns = malloc(sizeof(*s->patterns) << ENTROPY_BITS);
+
+  fprintf(out, "{\n  \"traces\": [\n");
+  for (int t = 0; t < num_paths; t++) {
+    trace_reader *trace = trace_open(paths[t]);
+    if (!trace) {
+      perror(paths[t]);
+      exit(1);
+    }
+
+    s->branches = s->taken = 0;
+    memset(&s->pcs, 0, sizeof(s->pcs));
+    memset(s->footprints, 0, sizeof(s->footprints));
+    memset(s->counts.cm, 0, sizeof(s->counts.cm));
+    memset(s->counts.slots, -1, (s->counts.slot_mask + 1) * sizeof(int));
+    s->counts.count = 0;
+    memset(s->patterns, 0, sizeof(*s->patterns) << ENTROPY_BITS);
+
+    characterize(trace, s);
+    trace_close(trace);
+
+    const char *name = strrchr(paths[t], '/');
+    print_stats(out, name ? name + 1 : paths[t], s);
+    fprintf(out, t + 1 < num_paths ? ",\n" : "\n");
+  }
+  fprintf(out, "  ]\n}\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  free(s->counts.heap);
+  free(s->counts.slots);
+  free(s->patterns);
+  free(s);
+  free(paths);
+
+  return 0;
+}